@@ -0,0 +1,58 @@
+/*
+ * allocator.c - the malloc packages mdriver knows about.
+ *
+ * mm.c and libc malloc are described here; the other packages define
+ * their own allocator_t next to their code.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "memlib.h"
+#include "mm.h"
+
+/*
+ * The libc package has no heap of its own to reset, and its footprint
+ * can't be read off memlib
+ */
+static int libc_init(void) { return 0; }
+static void libc_reset(void) { }
+static size_t libc_heapsize(void) { return 0; }
+static void *libc_malloc(uint32_t size) { return malloc(size); }
+static void libc_free(void *ptr) { free(ptr); }
+static void *libc_realloc(void *ptr, uint32_t size) { return realloc(ptr, size); }
+
+allocator_t mm_allocator = {
+    "mm", mm_init, mm_malloc, mm_free, mm_realloc, 
+    mem_reset_brk, mem_heapsize, 1
+};
+
+allocator_t libc_allocator = {
+    "libc", libc_init, libc_malloc, libc_free, libc_realloc, 
+    libc_reset, libc_heapsize, 0
+};
+
+allocator_t *allocators[] = {
+    &mm_allocator,
+    &libc_allocator,
+    &bump_allocator,
+    &buddy_allocator,
+    &explicit_allocator,
+    &explicit_ptr_allocator,
+    &tlsf_allocator,
+    &aofit_allocator,
+    NULL
+};
+
+/*
+ * find_allocator - look up a package by name, or return NULL
+ */
+allocator_t *find_allocator(const char *name)
+{
+    int i;
+
+    for (i = 0; allocators[i] != NULL; i++)
+	if (!strcmp(allocators[i]->name, name))
+	    return allocators[i];
+    return NULL;
+}
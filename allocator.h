@@ -0,0 +1,38 @@
+/*
+ * allocator.h - a table of entry points for a malloc package, so that
+ *               mdriver can evaluate several packages in one run
+ */
+#ifndef __ALLOCATOR_H_
+#define __ALLOCATOR_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+    const char *name;
+    int (*init)(void);                        /* start an empty heap */
+    void *(*malloc)(uint32_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, uint32_t size);
+    void (*reset)(void);                      /* discard the heap */
+    size_t (*heapsize)(void);                 /* heap bytes, 0 if unknown */
+    int in_memlib;       /* do payloads lie in the memlib heap? */
+} allocator_t;
+
+/* The packages linked into mdriver, terminated by NULL */
+extern allocator_t *allocators[];
+
+allocator_t *find_allocator(const char *name);
+
+extern allocator_t mm_allocator;
+extern allocator_t libc_allocator;
+
+/* Defined by the packages other than mm.c and libc */
+extern allocator_t bump_allocator;
+extern allocator_t buddy_allocator;
+extern allocator_t explicit_allocator;
+extern allocator_t explicit_ptr_allocator;
+extern allocator_t tlsf_allocator;
+extern allocator_t aofit_allocator;
+
+#endif /* __ALLOCATOR_H_ */
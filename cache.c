@@ -0,0 +1,455 @@
+/*
+ * cache.c - per-thread and per-CPU caches of small free blocks.
+ *
+ * A cache is a stack of free blocks for each size class. The mt_ front
+ * end pushes small blocks onto a cache when they are freed and pops
+ * them off again to satisfy mallocs of the same class, so most small
+ * requests never touch the heap or its lock.
+ *
+ * With thread caches, each thread owns one cache, so no other thread
+ * ever touches it. But a thread's cache keeps its blocks however long
+ * the thread goes without allocating, and a process with many more
+ * threads than CPUs holds many more blocks in caches.
+ *
+ * With CPU caches, each CPU owns one cache instead, and a thread uses
+ * the cache of whichever CPU it is running on. A push or pop is a Linux
+ * restartable sequence: a short run of instructions that ends in a
+ * single store, which the kernel restarts from the top if the thread is
+ * preempted, migrated or signaled before that store. So a thread owns
+ * its CPU's cache for the length of the sequence without any lock or
+ * atomic instruction, and the blocks held are bounded by the number of
+ * CPUs rather than of threads. glibc registers each thread's rseq area;
+ * where it hasn't (older kernels or libcs, or not x86-64), CPU mode
+ * falls back to thread caches.
+ *
+ * Blocks in a cache are allocated as far as the heap is concerned, and
+ * go back to it through the release function given to cache_init. A
+ * thread's cache goes back when the thread exits, from the destructor
+ * of a pthread key. cache_scavenge also takes back the caches of threads
+ * that have not used them since the last scavenge. A thread takes its
+ * own cache's busy flag for each get or put, and the scavenger only
+ * empties a cache whose flag it could take, so the two never collide.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "cache.h"
+
+#if defined(__x86_64__) && defined(__linux__) && __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define HAVE_RSEQ 1
+#else
+#define HAVE_RSEQ 0
+#endif
+
+/* A stack of free blocks per class, on a cache line of its own */
+typedef struct cache {
+    long count[CACHE_CLASSES];
+    void *slots[CACHE_CLASSES][CACHE_SLOTS];
+    int busy;             /* thread cache: held by its owner or a scavenger */
+    int used;             /* thread cache: used since the last scavenge? */
+    struct cache *next;   /* next live thread cache */
+} __attribute__((aligned(64))) cache_t;
+
+/* private variables */
+static CacheMode mode = CACHE_NONE;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static cache_t *thread_caches;  /* caches of threads that haven't exited */
+static unsigned generation;     /* bumped by cache_init */
+static void (*release)(void **blocks, int n); /* gives blocks to the heap */
+static size_t scavenged;        /* bytes cache_scavenge has given back */
+static pthread_key_t cache_key; /* destructor empties an exiting thread's */
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static cache_t *cpu_caches;     /* one per configured CPU */
+static long ncpus;
+
+static __thread cache_t *my_cache;
+static __thread unsigned my_generation;
+
+/*
+ * thread_cache - the calling thread's cache, made on its first use
+ *     since the last cache_init; NULL if there's no memory for one
+ */
+static cache_t *thread_cache(void)
+{
+    cache_t *c;
+
+    if (my_cache != NULL && my_generation == generation)
+	return my_cache;
+    if ((c = (cache_t *)aligned_alloc(64, sizeof(cache_t))) == NULL)
+	return NULL;
+    memset(c, 0, sizeof(cache_t));
+    pthread_mutex_lock(&cache_lock);
+    c->next = thread_caches;
+    thread_caches = c;
+    pthread_mutex_unlock(&cache_lock);
+    my_cache = c;
+    my_generation = generation;
+    pthread_setspecific(cache_key, c);
+    return c;
+}
+
+/* held - payload bytes of the blocks in cache c */
+static size_t held(cache_t *c)
+{
+    size_t bytes = 0;
+    int cls;
+
+    for (cls = 0; cls < CACHE_CLASSES; cls++)
+	bytes += __atomic_load_n(&c->count[cls], __ATOMIC_RELAXED) * 
+	    cache_class_size(cls);
+    return bytes;
+}
+
+/*
+ * empty - hand every block in cache c, which the caller has the busy
+ *     flag of, to release; returns their payload bytes
+ */
+static size_t empty(cache_t *c)
+{
+    void *blocks[CACHE_SLOTS];
+    size_t bytes = held(c);
+    int cls, n;
+
+    for (cls = 0; cls < CACHE_CLASSES; cls++) {
+	if ((n = c->count[cls]) == 0)
+	    continue;
+	memcpy(blocks, c->slots[cls], n * sizeof(void *));
+	__atomic_store_n(&c->count[cls], 0, __ATOMIC_RELAXED);
+	release(blocks, n);
+    }
+    return bytes;
+}
+
+/*
+ * thread_exit - pthread key destructor: give an exiting thread's cache
+ *     back to the heap, once any scavenger is done with it, and forget it
+ */
+static void thread_exit(void *arg)
+{
+    cache_t *c = (cache_t *)arg, **pp;
+
+    /* A cache of before the last cache_init is freed already */
+    if (my_generation != generation || my_cache != c)
+	return;
+    while (__atomic_exchange_n(&c->busy, 1, __ATOMIC_ACQUIRE))
+	sched_yield();
+    empty(c);
+    pthread_mutex_lock(&cache_lock);
+    for (pp = &thread_caches; *pp != NULL; pp = &(*pp)->next)
+	if (*pp == c) {
+	    *pp = c->next;
+	    break;
+	}
+    pthread_mutex_unlock(&cache_lock);
+    free(c);
+    my_cache = NULL;
+}
+
+static void make_key(void)
+{
+    pthread_key_create(&cache_key, thread_exit);
+}
+
+#if HAVE_RSEQ
+/*
+ * Each restartable sequence is described by a struct rseq_cs in the
+ * __rseq_cs section: the sequence runs from label 1 to label 2, and
+ * aborts to label 4, which must follow the signature glibc registered.
+ * The abort handler lives out of line and just starts over.
+ */
+#define RSEQ_CS_TABLE \
+    ".pushsection __rseq_cs, \"aw\"\n\t" \
+    ".balign 32\n\t" \
+    "3:\n\t" \
+    ".long 0, 0\n\t" \
+    ".quad 1f, 2f - 1f, 4f\n\t" \
+    ".popsection\n\t" \
+    "leaq 3b(%%rip), %%rax\n\t" \
+    "movq %%rax, %[rseq_cs]\n\t"
+
+#define RSEQ_ABORT \
+    ".pushsection __rseq_failure, \"ax\"\n\t" \
+    ".byte 0x0f, 0xb9, 0x3d\n\t" \
+    ".long 0x53053053\n\t" \
+    "4:\n\t" \
+    "jmp %l[restart]\n\t" \
+    ".popsection\n\t"
+
+#define STR_(x) #x
+#define STR(x) STR_(x)
+
+/* rseq_area - the calling thread's registered struct rseq */
+static inline struct rseq *rseq_area(void)
+{
+    return (struct rseq *)((char *)__builtin_thread_pointer() + __rseq_offset);
+}
+
+/* rseq_ok - has glibc registered an rseq area the kernel keeps up? */
+static int rseq_ok(void)
+{
+    return __rseq_size > 0 && (int)rseq_area()->cpu_id >= 0 &&
+	(int)rseq_area()->cpu_id < ncpus;
+}
+
+/*
+ * cpu_push - push p on class cls of the current CPU's cache;
+ *     returns 0 if that stack is full
+ */
+static int cpu_push(int cls, void *p)
+{
+    struct rseq *rs = rseq_area();
+    cache_t *c;
+    int cpu;
+
+    for (;;) {
+	cpu = __atomic_load_n(&rs->cpu_id, __ATOMIC_RELAXED);
+	c = &cpu_caches[cpu];
+	__asm__ __volatile__ goto (
+	    RSEQ_CS_TABLE
+	    "1:\n\t"
+	    "cmpl %[cpu], %[cpu_id]\n\t"
+	    "jnz %l[restart]\n\t"
+	    "movq %[count], %%rcx\n\t"
+	    "cmpq $" STR(CACHE_SLOTS) ", %%rcx\n\t"
+	    "jae %l[full]\n\t"
+	    "movq %[p], (%[slots], %%rcx, 8)\n\t"
+	    "addq $1, %%rcx\n\t"
+	    "movq %%rcx, %[count]\n\t"  /* commit */
+	    "2:\n\t"
+	    RSEQ_ABORT
+	    :
+	    : [cpu_id] "m" (rs->cpu_id), [rseq_cs] "m" (rs->rseq_cs),
+	      [cpu] "r" (cpu), [count] "m" (c->count[cls]), [p] "r" (p),
+	      [slots] "r" (c->slots[cls])
+	    : "memory", "cc", "rax", "rcx"
+	    : restart, full);
+	return 1;
+    full:
+	return 0;
+    restart:
+	;
+    }
+}
+
+/*
+ * cpu_pop - pop a block off class cls of the current CPU's cache;
+ *     NULL if that stack is empty
+ */
+static void *cpu_pop(int cls)
+{
+    struct rseq *rs = rseq_area();
+    cache_t *c;
+    void *p;
+    int cpu;
+
+    for (;;) {
+	cpu = __atomic_load_n(&rs->cpu_id, __ATOMIC_RELAXED);
+	c = &cpu_caches[cpu];
+	__asm__ __volatile__ goto (
+	    RSEQ_CS_TABLE
+	    "1:\n\t"
+	    "cmpl %[cpu], %[cpu_id]\n\t"
+	    "jnz %l[restart]\n\t"
+	    "movq %[count], %%rcx\n\t"
+	    "testq %%rcx, %%rcx\n\t"
+	    "jz %l[empty]\n\t"
+	    "subq $1, %%rcx\n\t"
+	    "movq (%[slots], %%rcx, 8), %%rax\n\t"
+	    "movq %%rax, (%[out])\n\t"
+	    "movq %%rcx, %[count]\n\t"  /* commit */
+	    "2:\n\t"
+	    RSEQ_ABORT
+	    :
+	    : [cpu_id] "m" (rs->cpu_id), [rseq_cs] "m" (rs->rseq_cs),
+	      [cpu] "r" (cpu), [count] "m" (c->count[cls]), [out] "r" (&p),
+	      [slots] "r" (c->slots[cls])
+	    : "memory", "cc", "rax", "rcx"
+	    : restart, empty);
+	return p;
+    empty:
+	return NULL;
+    restart:
+	;
+    }
+}
+#else
+static int rseq_ok(void) { return 0; }
+static int cpu_push(int cls, void *p) { return 0; }
+static void *cpu_pop(int cls) { return NULL; }
+#endif /* HAVE_RSEQ */
+
+/*
+ * cache_init - forget every cache and start caching in the given mode,
+ *     or in thread caches if CPU caches can't be used; cached blocks go
+ *     back to the heap through release_fn. Must be called while no
+ *     other thread uses the caches. Returns the mode in use.
+ */
+CacheMode cache_init(CacheMode want, void (*release_fn)(void **blocks, int n))
+{
+    cache_t *c;
+
+    pthread_once(&key_once, make_key);
+    release = release_fn;
+    scavenged = 0;
+    pthread_mutex_lock(&cache_lock);
+    while ((c = thread_caches) != NULL) {
+	thread_caches = c->next;
+	free(c);
+    }
+    generation++;
+    pthread_mutex_unlock(&cache_lock);
+
+    if (cpu_caches == NULL) {
+	ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (ncpus < 1)
+	    ncpus = 1;
+	cpu_caches = (cache_t *)aligned_alloc(64, ncpus * sizeof(cache_t));
+    }
+    if (cpu_caches != NULL)
+	memset(cpu_caches, 0, ncpus * sizeof(cache_t));
+
+    if (want == CACHE_CPU && (cpu_caches == NULL || !rseq_ok()))
+	want = CACHE_THREAD;
+    return mode = want;
+}
+
+/* cache_mode - the mode cache_init settled on */
+CacheMode cache_mode(void)
+{
+    return mode;
+}
+
+/* cache_mode_name - how a mode is spelled on command lines */
+const char *cache_mode_name(CacheMode m)
+{
+    switch (m) {
+    case CACHE_THREAD:
+	return "thread";
+    case CACHE_CPU:
+	return "cpu";
+    default:
+	return "none";
+    }
+}
+
+/*
+ * cache_get - a cached free block of class cls, or NULL if the
+ *     caller's cache has none
+ */
+void *cache_get(int cls)
+{
+    cache_t *c;
+    void *p = NULL;
+    long n;
+
+    if (mode == CACHE_CPU)
+	return cpu_pop(cls);
+    if (mode != CACHE_THREAD || (c = thread_cache()) == NULL ||
+	__atomic_exchange_n(&c->busy, 1, __ATOMIC_ACQUIRE))
+	return NULL;
+    if ((n = c->count[cls]) > 0) {
+	p = c->slots[cls][n - 1];
+	__atomic_store_n(&c->count[cls], n - 1, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&c->used, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->busy, 0, __ATOMIC_RELEASE);
+    return p;
+}
+
+/*
+ * cache_put - keep free block p of class cls in the caller's cache;
+ *     returns 0 if the cache has no room for it
+ */
+int cache_put(int cls, void *p)
+{
+    cache_t *c;
+    long n;
+    int ok = 0;
+
+    if (mode == CACHE_CPU)
+	return cpu_push(cls, p);
+    if (mode != CACHE_THREAD || (c = thread_cache()) == NULL ||
+	__atomic_exchange_n(&c->busy, 1, __ATOMIC_ACQUIRE))
+	return 0;
+    if ((n = c->count[cls]) < CACHE_SLOTS) {
+	c->slots[cls][n] = p;
+	__atomic_store_n(&c->count[cls], n + 1, __ATOMIC_RELAXED);
+	ok = 1;
+    }
+    __atomic_store_n(&c->used, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->busy, 0, __ATOMIC_RELEASE);
+    return ok;
+}
+
+/*
+ * cache_scavenge - give the blocks in thread caches that haven't been
+ *     used since the last call back to the heap; returns their payload
+ *     bytes. The blocks are collected under the cache lock and released
+ *     after it, so the heap lock is never taken inside the cache lock.
+ */
+size_t cache_scavenge(void)
+{
+    cache_t *c;
+    void **blocks = NULL;
+    size_t bytes = 0;
+    int n = 0, max = 0, cls, k;
+
+    pthread_mutex_lock(&cache_lock);
+    for (c = thread_caches; c != NULL; c = c->next) {
+	if (__atomic_exchange_n(&c->used, 0, __ATOMIC_RELAXED) ||
+	    __atomic_exchange_n(&c->busy, 1, __ATOMIC_ACQUIRE))
+	    continue;
+	for (cls = 0; cls < CACHE_CLASSES; cls++) {
+	    for (k = 0; k < c->count[cls]; k++) {
+		if (n == max) {
+		    max = max ? 2 * max : CACHE_CLASSES * CACHE_SLOTS;
+		    if ((blocks = realloc(blocks, max * sizeof(void *))) == NULL) {
+			fprintf(stderr, "cache_scavenge: realloc failed\n");
+			exit(1);
+		    }
+		}
+		blocks[n++] = c->slots[cls][k];
+	    }
+	    bytes += c->count[cls] * cache_class_size(cls);
+	    __atomic_store_n(&c->count[cls], 0, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&c->busy, 0, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    if (n > 0)
+	release(blocks, n);
+    free(blocks);
+    __atomic_add_fetch(&scavenged, bytes, __ATOMIC_RELAXED);
+    return bytes;
+}
+
+/* cache_scavenged - payload bytes scavenged since cache_init */
+size_t cache_scavenged(void)
+{
+    return __atomic_load_n(&scavenged, __ATOMIC_RELAXED);
+}
+
+/*
+ * cache_bytes - payload bytes held in all caches. Only exact while no
+ *     thread is using them.
+ */
+size_t cache_bytes(void)
+{
+    size_t bytes = 0;
+    cache_t *c;
+    long cpu;
+
+    pthread_mutex_lock(&cache_lock);
+    for (c = thread_caches; c != NULL; c = c->next)
+	bytes += held(c);
+    pthread_mutex_unlock(&cache_lock);
+    for (cpu = 0; cpu_caches != NULL && cpu < ncpus; cpu++)
+	bytes += held(&cpu_caches[cpu]);
+    return bytes;
+}
@@ -0,0 +1,45 @@
+/*
+ * cache.h - per-thread and per-CPU caches of small free blocks, which
+ *           let the mt_ front end skip the heap lock
+ */
+#ifndef __CACHE_H_
+#define __CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CACHE_QUANTUM 16   /* payload sizes are rounded up to this */
+#define CACHE_CLASSES 16   /* so classes cover payloads up to ... */
+#define CACHE_MAX     (CACHE_QUANTUM * CACHE_CLASSES) /* ... 256 bytes */
+#define CACHE_SLOTS   64   /* blocks each cache holds per class */
+#define CACHE_BATCH   16   /* blocks moved to or from the heap at once */
+
+/* Where freed small blocks are kept */
+typedef enum {
+    CACHE_NONE,    /* nowhere: every call takes the heap lock */
+    CACHE_THREAD,  /* in a cache owned by the freeing thread */
+    CACHE_CPU      /* in a cache owned by the CPU, using rseq */
+} CacheMode;
+
+/* cache_class - the class of a payload of 1..CACHE_MAX bytes */
+static inline int cache_class(uint32_t size)
+{
+    return (size - 1) / CACHE_QUANTUM;
+}
+
+/* cache_class_size - the payload size every block in class cls holds */
+static inline uint32_t cache_class_size(int cls)
+{
+    return (cls + 1) * CACHE_QUANTUM;
+}
+
+CacheMode cache_init(CacheMode mode, void (*release)(void **blocks, int n));
+CacheMode cache_mode(void);
+const char *cache_mode_name(CacheMode mode);
+void *cache_get(int cls);
+int cache_put(int cls, void *p);
+size_t cache_bytes(void);
+size_t cache_scavenge(void);
+size_t cache_scavenged(void);
+
+#endif /* __CACHE_H_ */
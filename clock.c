@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/times.h>
+#include <time.h>
 #include "clock.h"
 
 
@@ -21,7 +22,7 @@
  * You can verify this for yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__)  
+#if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
  * Pentium versions of start_counter() and get_counter()
  *******************************************************/
@@ -71,6 +72,15 @@ double get_counter()
 }
 /* $end x86cyclecounter */
 
+/* Return the cycle counter as one 64-bit number */
+unsigned long long read_counter(void)
+{
+    unsigned hi, lo;
+
+    access_counter(&hi, &lo);
+    return ((unsigned long long)hi << 32) | lo;
+}
+
 #elif defined(__alpha)
 
 /****************************************************
@@ -133,6 +143,11 @@ double get_counter()
     return result;
 }
 
+unsigned long long read_counter(void)
+{
+    return counter();
+}
+
 #else
 
 /****************************************************************
@@ -158,6 +173,19 @@ double get_counter()
     printf("Please choose another timing package in config.h.\n");
     exit(1);
 }
+
+/* 
+ * Without a cycle counter, read_counter counts nanoseconds instead.
+ * Its callers only take differences of its readings, or scale them by
+ * a rate they measure themselves, so the unit doesn't matter to them.
+ */
+unsigned long long read_counter(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 #endif
 
 
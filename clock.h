@@ -6,6 +6,10 @@ void start_counter();
 /* Get # cycles since counter started */
 double get_counter();
 
+/* Read the cycle counter itself; unlike get_counter, any thread can.
+   Counts nanoseconds on platforms without a cycle counter. */
+unsigned long long read_counter(void);
+
 /* Measure overhead for counter */
 double ovhd();
 
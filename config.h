@@ -33,6 +33,15 @@
   "realloc-bal.rep",\
   "realloc2-bal.rep"
 
+/*
+ * These are the default tracefiles for the threaded replay (-x). They
+ * are extended traces, which record the thread that made each request
+ * and when (see trace.c).
+ */
+#define DEFAULT_MT_TRACEFILES \
+  "threads-bal.rep",\
+  "prodcons-bal.rep"
+
 /*
  * This constant gives the estimated performance of the libc malloc
  * package using our traces on some reference system, typically the
@@ -61,6 +70,12 @@
  */
 #define MAX_HEAP (200*(1<<20))  /* 200 MB */
 
+/*
+ * Address a file-backed heap is mapped at, the same in every process
+ * so that pointers stored in the heap stay good when it is reopened
+ */
+#define MEM_FILE_BASE ((void *)0x300000000000UL)
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
@@ -0,0 +1,331 @@
+/*
+ * epoch.c - epoch-based reclamation of blocks.
+ *
+ * A lock-free reader can still be looking at a block after a writer
+ * has unlinked it from a shared structure, so the writer can't free it
+ * then. It retires the block instead, and the block is freed once no
+ * reader can hold it any more. Readers mark where they look with
+ * epoch_enter and epoch_exit, which only write the reader's own record:
+ * on entering, the global epoch it saw; on exiting, that it is out.
+ *
+ * A block retired in epoch e goes on the retiring thread's list for e,
+ * one of three kept in turn. The lists are arrays of their own, since a
+ * reader may still follow a retired block's links and its payload must
+ * stay as the writer left it until the block is freed. Every
+ * EPOCH_BATCH retirements the thread tries to move the global epoch on,
+ * which it may do when every reader inside a section has seen the
+ * current epoch. Once the global epoch is e + 2, every reader inside a
+ * section entered after the block was unlinked, so the blocks retired
+ * in e are freed, in batches through the release function. A thread's
+ * list for e is freed when it next retires in e + 3 or tries to advance
+ * after e + 2, whichever comes first.
+ *
+ * Records are made on a thread's first use after epoch_init and kept on
+ * a list the advancing thread walks under the epoch lock. When a thread
+ * exits, its record leaves the list and whatever it still had retired
+ * becomes an orphan batch, freed by the next advance that allows it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "epoch.h"
+
+#define SLOTS 3                /* retired lists kept by each thread */
+#define ACTIVE 1UL             /* low bit of a record's state */
+
+/* Blocks retired in one epoch */
+typedef struct {
+    void **blocks;
+    int n, max;
+    unsigned long when;         /* the epoch */
+} limbo_t;
+
+/* One thread's record, on a cache line of its own */
+typedef struct rec {
+    unsigned long state;        /* epoch seen << 1 | ACTIVE, or 0 if out */
+    int depth;                  /* of nested sections */
+    limbo_t limbo[SLOTS];       /* blocks retired in epoch e, at e % SLOTS */
+    int count;                  /* retired since the last try to advance */
+    long retired;               /* retired since epoch_init */
+    struct rec *next;           /* next record of a thread that hasn't exited */
+} __attribute__((aligned(64))) rec_t;
+
+/* Blocks an exited thread retired in one epoch */
+typedef struct orphan {
+    limbo_t limbo;
+    struct orphan *next;
+} orphan_t;
+
+/* private variables */
+static unsigned long global;    /* the epoch, changed by compare-and-swap */
+static pthread_mutex_t epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+static rec_t *records;          /* of threads that haven't exited */
+static orphan_t *orphans;       /* retired by threads that have */
+static long exited_retired;     /* retired by threads that have exited */
+static epochstat_t stats;       /* freed and advances, updated atomically */
+static void (*release)(void **blocks, int n); /* gives blocks to the heap */
+static unsigned generation;     /* bumped by epoch_init */
+static pthread_key_t epoch_key; /* destructor orphans an exiting thread's */
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+static __thread rec_t *me;
+static __thread unsigned my_generation;
+
+/*
+ * free_limbo - free the blocks of l, EPOCH_BATCH at a time, and empty it
+ */
+static void free_limbo(limbo_t *l)
+{
+    int i;
+
+    for (i = 0; i < l->n; i += EPOCH_BATCH)
+	release(l->blocks + i, l->n - i < EPOCH_BATCH ? l->n - i : EPOCH_BATCH);
+    __atomic_add_fetch(&stats.freed, l->n, __ATOMIC_RELAXED);
+    l->n = 0;
+}
+
+/*
+ * my_rec - the calling thread's record, made on its first use since
+ *     the last epoch_init
+ */
+static rec_t *my_rec(void)
+{
+    rec_t *r;
+
+    if (my_generation == generation)
+	return me;
+    if ((r = (rec_t *)aligned_alloc(64, sizeof(rec_t))) == NULL) {
+	fprintf(stderr, "my_rec: aligned_alloc failed\n");
+	exit(1);
+    }
+    memset(r, 0, sizeof(rec_t));
+    pthread_mutex_lock(&epoch_lock);
+    r->next = records;
+    records = r;
+    pthread_mutex_unlock(&epoch_lock);
+    me = r;
+    my_generation = generation;
+    pthread_setspecific(epoch_key, r);
+    return r;
+}
+
+/*
+ * reclaim - free r's lists of epochs at least two behind e
+ */
+static void reclaim(rec_t *r, unsigned long e)
+{
+    int i;
+
+    for (i = 0; i < SLOTS; i++)
+	if (r->limbo[i].n > 0 && r->limbo[i].when + 2 <= e)
+	    free_limbo(&r->limbo[i]);
+}
+
+/*
+ * advance - move the global epoch on if every reader inside a section
+ *     has seen it, and free the orphans that allows; returns the epoch
+ */
+static unsigned long advance(void)
+{
+    unsigned long e, s;
+    orphan_t *o, **pp, *ready = NULL;
+    rec_t *r;
+
+    /* The retired blocks' unlinking must be seen before the records */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    e = __atomic_load_n(&global, __ATOMIC_ACQUIRE);
+    pthread_mutex_lock(&epoch_lock);
+    for (r = records; r != NULL; r = r->next) {
+	s = __atomic_load_n(&r->state, __ATOMIC_ACQUIRE);
+	if ((s & ACTIVE) && (s >> 1) != e) {
+	    pthread_mutex_unlock(&epoch_lock);
+	    return e;
+	}
+    }
+    if (__atomic_compare_exchange_n(&global, &e, e + 1, 0,
+				    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+	e++;
+	__atomic_add_fetch(&stats.advances, 1, __ATOMIC_RELAXED);
+    }
+    for (pp = &orphans; (o = *pp) != NULL; )
+	if (o->limbo.when + 2 <= e) {
+	    *pp = o->next;
+	    o->next = ready;
+	    ready = o;
+	}
+	else
+	    pp = &o->next;
+    pthread_mutex_unlock(&epoch_lock);
+
+    /* Free outside the epoch lock, since freeing takes the heap lock */
+    while ((o = ready) != NULL) {
+	ready = o->next;
+	free_limbo(&o->limbo);
+	free(o->limbo.blocks);
+	free(o);
+    }
+    return e;
+}
+
+/*
+ * thread_exit - pthread key destructor: orphan what an exiting thread
+ *     still had retired, and forget its record
+ */
+static void thread_exit(void *arg)
+{
+    rec_t *r = (rec_t *)arg, **pp;
+    orphan_t *o;
+    int i;
+
+    /* A record of before the last epoch_fini is freed already */
+    if (my_generation != generation || me != r)
+	return;
+    pthread_mutex_lock(&epoch_lock);
+    for (pp = &records; *pp != NULL; pp = &(*pp)->next)
+	if (*pp == r) {
+	    *pp = r->next;
+	    break;
+	}
+    for (i = 0; i < SLOTS; i++) {
+	if (r->limbo[i].n == 0) {
+	    free(r->limbo[i].blocks);
+	    continue;
+	}
+	if ((o = (orphan_t *)malloc(sizeof(orphan_t))) == NULL) {
+	    fprintf(stderr, "thread_exit: malloc failed\n");
+	    exit(1);
+	}
+	o->limbo = r->limbo[i];
+	o->next = orphans;
+	orphans = o;
+    }
+    exited_retired += r->retired;
+    pthread_mutex_unlock(&epoch_lock);
+    free(r);
+    me = NULL;
+}
+
+static void make_key(void)
+{
+    pthread_key_create(&epoch_key, thread_exit);
+}
+
+/*
+ * epoch_init - forget every record and empty the counts; blocks go back
+ *     to the heap through release_fn. Must be called after epoch_fini,
+ *     while no other thread uses reclamation.
+ */
+void epoch_init(void (*release_fn)(void **blocks, int n))
+{
+    pthread_once(&key_once, make_key);
+    release = release_fn;
+    global = 0;
+    exited_retired = 0;
+    memset(&stats, 0, sizeof(stats));
+    generation++;
+}
+
+/*
+ * epoch_fini - free every retired block, of live threads and exited
+ *     ones alike. Must be called once no thread reads or retires.
+ */
+void epoch_fini(void)
+{
+    rec_t *r;
+    orphan_t *o;
+    int i;
+
+    pthread_mutex_lock(&epoch_lock);
+    while ((o = orphans) != NULL) {
+	orphans = o->next;
+	free_limbo(&o->limbo);
+	free(o->limbo.blocks);
+	free(o);
+    }
+    while ((r = records) != NULL) {
+	records = r->next;
+	for (i = 0; i < SLOTS; i++) {
+	    free_limbo(&r->limbo[i]);
+	    free(r->limbo[i].blocks);
+	}
+	exited_retired += r->retired;
+	free(r);
+    }
+    generation++;
+    pthread_mutex_unlock(&epoch_lock);
+}
+
+/*
+ * epoch_enter - start a read section: blocks retired from here on stay
+ *     put until the matching epoch_exit. Sections may nest.
+ */
+void epoch_enter(void)
+{
+    rec_t *r = my_rec();
+
+    if (r->depth++ > 0)
+	return;
+    /* Released, so the reads of earlier sections come before it */
+    __atomic_store_n(&r->state,
+		     __atomic_load_n(&global, __ATOMIC_RELAXED) << 1 | ACTIVE,
+		     __ATOMIC_RELEASE);
+    /* The store must be seen before any of the section's loads */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+ * epoch_exit - end a read section
+ */
+void epoch_exit(void)
+{
+    rec_t *r = my_rec();
+
+    if (--r->depth > 0)
+	return;
+    __atomic_store_n(&r->state, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * epoch_retire - free block p once no reader inside a section can hold
+ *     it; the caller must have unlinked it first
+ */
+void epoch_retire(void *p)
+{
+    rec_t *r = my_rec();
+    unsigned long e = __atomic_load_n(&global, __ATOMIC_ACQUIRE);
+    limbo_t *l = &r->limbo[e % SLOTS];
+
+    if (l->n > 0 && l->when != e)
+	reclaim(r, e);
+    if (l->n == l->max) {
+	l->max = l->max ? 2 * l->max : EPOCH_BATCH;
+	if ((l->blocks = (void **)realloc(l->blocks, 
+					  l->max * sizeof(void *))) == NULL) {
+	    fprintf(stderr, "epoch_retire: realloc failed\n");
+	    exit(1);
+	}
+    }
+    l->blocks[l->n++] = p;
+    l->when = e;
+    __atomic_store_n(&r->retired, r->retired + 1, __ATOMIC_RELAXED);
+    if (++r->count >= EPOCH_BATCH) {
+	r->count = 0;
+	reclaim(r, advance());
+    }
+}
+
+/* epoch_stats - copy out the counts since epoch_init */
+void epoch_stats(epochstat_t *s)
+{
+    rec_t *r;
+
+    pthread_mutex_lock(&epoch_lock);
+    s->retired = exited_retired;
+    for (r = records; r != NULL; r = r->next)
+	s->retired += __atomic_load_n(&r->retired, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&epoch_lock);
+    s->freed = __atomic_load_n(&stats.freed, __ATOMIC_RELAXED);
+    s->advances = __atomic_load_n(&stats.advances, __ATOMIC_RELAXED);
+}
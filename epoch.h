@@ -0,0 +1,24 @@
+/*
+ * epoch.h - epoch-based reclamation: blocks that readers may still be
+ *           looking at are freed once every reader has moved on
+ */
+#ifndef __EPOCH_H_
+#define __EPOCH_H_
+
+#define EPOCH_BATCH 64     /* blocks retired between tries to advance */
+
+/* What reclamation has been through since epoch_init */
+typedef struct {
+    long retired;    /* blocks handed to epoch_retire */
+    long freed;      /* ... and since freed */
+    long advances;   /* times the global epoch moved on */
+} epochstat_t;
+
+void epoch_init(void (*release)(void **blocks, int n));
+void epoch_fini(void);
+void epoch_enter(void);
+void epoch_exit(void);
+void epoch_retire(void *p);
+void epoch_stats(epochstat_t *stats);
+
+#endif /* __EPOCH_H_ */
@@ -0,0 +1,165 @@
+/*
+ * freeq.c - offloading frees to a background thread.
+ *
+ * Freeing a block in mm.c means coalescing it with its neighbors under
+ * the heap lock, and the freeing thread waits for that though it gets
+ * nothing back. With the queue on, the mt_ front end pushes each block
+ * it would free onto a lock-free stack instead, linked through the
+ * blocks' own payloads, and a background thread takes the whole stack
+ * at once and frees its blocks FREEQ_BATCH to an acquisition of the
+ * heap lock. The order blocks are freed in doesn't matter, so a stack
+ * does as well as a queue; and since blocks only ever come off it all
+ * at once, with an exchange, the pushes are safe from ABA.
+ *
+ * The drainer is signaled when FREEQ_BATCH blocks are waiting, and
+ * wakes every FREEQ_MS milliseconds anyway, which also covers a signal
+ * sent just before it waited. Blocks on the queue can't be reused, so
+ * the queue is bounded: a thread whose push finds FREEQ_MAX blocks
+ * waiting drains the queue itself before it returns. That is the
+ * backpressure: freeing threads are slowed to the pace at which the
+ * heap takes blocks back, and the queue never holds much more.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "freeq.h"
+
+/* private variables */
+static int on;
+static void *head;               /* the stack, linked through payloads */
+static long pending;             /* blocks on it, roughly */
+static freeqstat_t stats;        /* updated atomically */
+static void (*release)(void **blocks, int n); /* gives blocks to the heap */
+static pthread_t drainer;
+static int drainer_running;
+static pthread_mutex_t drainer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t drainer_wake = PTHREAD_COND_INITIALIZER;
+
+/*
+ * drain - take every block on the queue and free them in batches;
+ *     returns how many there were
+ */
+static long drain(void)
+{
+    void *blocks[FREEQ_BATCH];
+    void *p = __atomic_exchange_n(&head, NULL, __ATOMIC_ACQUIRE);
+    long total = 0;
+    int n;
+
+    while (p != NULL) {
+	/* Read each link before its block is freed */
+	for (n = 0; p != NULL && n < FREEQ_BATCH; p = *(void **)p)
+	    blocks[n++] = p;
+	release(blocks, n);
+	__atomic_add_fetch(&stats.batches, 1, __ATOMIC_RELAXED);
+	total += n;
+    }
+    __atomic_sub_fetch(&pending, total, __ATOMIC_RELAXED);
+    return total;
+}
+
+/* drain_loop - drainer thread body: drain until freeq_fini */
+static void *drain_loop(void *arg)
+{
+    struct timespec ts;
+    long n;
+
+    pthread_mutex_lock(&drainer_lock);
+    while (drainer_running) {
+	if (__atomic_load_n(&pending, __ATOMIC_RELAXED) < FREEQ_BATCH) {
+	    clock_gettime(CLOCK_REALTIME, &ts);
+	    ts.tv_nsec += FREEQ_MS * 1000000L;
+	    ts.tv_sec += ts.tv_nsec / 1000000000L;
+	    ts.tv_nsec %= 1000000000L;
+	    pthread_cond_timedwait(&drainer_wake, &drainer_lock, &ts);
+	}
+	if (!drainer_running)
+	    break;
+	pthread_mutex_unlock(&drainer_lock);
+	n = drain();
+	__atomic_add_fetch(&stats.drained, n, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&drainer_lock);
+    }
+    pthread_mutex_unlock(&drainer_lock);
+    return NULL;
+}
+
+/*
+ * freeq_init - empty the counts and queue frees or not; blocks go back
+ *     to the heap through release_fn. Starts the drainer if on. Must be
+ *     called after freeq_fini, while no other thread uses the queue.
+ */
+void freeq_init(int want, void (*release_fn)(void **blocks, int n))
+{
+    release = release_fn;
+    head = NULL;
+    pending = 0;
+    memset(&stats, 0, sizeof(stats));
+    on = want;
+    if (!on)
+	return;
+    drainer_running = 1;
+    if (pthread_create(&drainer, NULL, drain_loop, NULL) != 0) {
+	fprintf(stderr, "freeq_init: pthread_create error\n");
+	exit(1);
+    }
+}
+
+/*
+ * freeq_fini - stop the drainer, free whatever is still queued, and
+ *     stop queueing. Must be called once no thread pushes blocks.
+ */
+void freeq_fini(void)
+{
+    pthread_mutex_lock(&drainer_lock);
+    if (!drainer_running) {
+	pthread_mutex_unlock(&drainer_lock);
+	return;
+    }
+    drainer_running = 0;
+    pthread_cond_signal(&drainer_wake);
+    pthread_mutex_unlock(&drainer_lock);
+    pthread_join(drainer, NULL);
+    stats.drained += drain();
+    on = 0;
+}
+
+/*
+ * freeq_push - queue block p to be freed; returns 0 if the queue is
+ *     off, and the caller has to free p itself
+ */
+int freeq_push(void *p)
+{
+    void *old;
+    long depth;
+
+    if (!on)
+	return 0;
+    old = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    do
+	*(void **)p = old;
+    while (!__atomic_compare_exchange_n(&head, &old, p, 1,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    depth = __atomic_add_fetch(&pending, 1, __ATOMIC_RELAXED);
+    if (depth > __atomic_load_n(&stats.deepest, __ATOMIC_RELAXED))
+	__atomic_store_n(&stats.deepest, depth, __ATOMIC_RELAXED);
+    if (depth == FREEQ_BATCH)
+	pthread_cond_signal(&drainer_wake);
+    else if (depth >= FREEQ_MAX)
+	__atomic_add_fetch(&stats.helped, drain(), __ATOMIC_RELAXED);
+    return 1;
+}
+
+/* freeq_stats - copy out the counts since freeq_init */
+void freeq_stats(freeqstat_t *s)
+{
+    s->drained = __atomic_load_n(&stats.drained, __ATOMIC_RELAXED);
+    s->helped = __atomic_load_n(&stats.helped, __ATOMIC_RELAXED);
+    s->batches = __atomic_load_n(&stats.batches, __ATOMIC_RELAXED);
+    s->deepest = __atomic_load_n(&stats.deepest, __ATOMIC_RELAXED);
+    s->queued = s->drained + s->helped +
+	__atomic_load_n(&pending, __ATOMIC_RELAXED);
+}
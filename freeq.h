@@ -0,0 +1,28 @@
+/*
+ * freeq.h - a queue of blocks waiting to be freed, which a background
+ *           thread hands back to the heap in batches
+ */
+#ifndef __FREEQ_H_
+#define __FREEQ_H_
+
+#include <stddef.h>
+
+#define FREEQ_BATCH 64     /* blocks freed per acquisition of the heap lock */
+#define FREEQ_MAX   1024   /* queued blocks at which freeing threads drain it */
+#define FREEQ_MS    1      /* drainer wakes at least this often (ms) */
+
+/* What the queue has been through since freeq_init */
+typedef struct {
+    long queued;     /* blocks pushed on the queue */
+    long drained;    /* ... freed by the background thread */
+    long helped;     /* ... freed by freeing threads, when it was full */
+    long batches;    /* acquisitions of the heap lock to free them */
+    long deepest;    /* most blocks queued at once */
+} freeqstat_t;
+
+void freeq_init(int on, void (*release)(void **blocks, int n));
+void freeq_fini(void);
+int freeq_push(void *p);
+void freeq_stats(freeqstat_t *stats);
+
+#endif /* __FREEQ_H_ */
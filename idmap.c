@@ -0,0 +1,135 @@
+/*
+ * idmap.c - map from trace block ids to live blocks.
+ *
+ * A linear-probing hash table that only holds the ids that are
+ * currently allocated, so its size tracks the live set rather than
+ * the number of ids in the trace. Removal shifts later entries of the
+ * probe run back, so there are no tombstones and the table never needs
+ * rebuilding on account of frees.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "idmap.h"
+
+#define IDMAP_MINSLOTS 1024 /* initial table size (a power of 2) */
+
+/* hash - scatter consecutive ids across the table */
+static inline size_t hash(int id)
+{
+    return (size_t)((unsigned)id * 2654435761u);
+}
+
+/* alloc_slots - allocate n empty slots */
+static idmap_entry_t *alloc_slots(size_t n)
+{
+    idmap_entry_t *slots;
+    size_t i;
+
+    if ((slots = (idmap_entry_t *)malloc(n * sizeof(idmap_entry_t))) == NULL) {
+	fprintf(stderr, "idmap: malloc error\n");
+	exit(1);
+    }
+    for (i = 0; i < n; i++)
+	slots[i].id = -1;
+    return slots;
+}
+
+/* grow - double the table once it is half full */
+static void grow(idmap_t *map)
+{
+    idmap_entry_t *old = map->slots;
+    size_t oldsize = map->mask + 1;
+    size_t i, j;
+
+    map->slots = alloc_slots(2 * oldsize);
+    map->mask = 2 * oldsize - 1;
+    for (i = 0; i < oldsize; i++) {
+	if (old[i].id < 0)
+	    continue;
+	for (j = hash(old[i].id) & map->mask; map->slots[j].id >= 0; 
+	     j = (j + 1) & map->mask)
+	    ;
+	map->slots[j] = old[i];
+    }
+    free(old);
+}
+
+/*
+ * idmap_init - create an empty map
+ */
+void idmap_init(idmap_t *map)
+{
+    map->slots = alloc_slots(IDMAP_MINSLOTS);
+    map->mask = IDMAP_MINSLOTS - 1;
+    map->count = 0;
+}
+
+/*
+ * idmap_destroy - free the storage used by the map
+ */
+void idmap_destroy(idmap_t *map)
+{
+    free(map->slots);
+    map->slots = NULL;
+    map->count = 0;
+}
+
+/*
+ * idmap_get - return the entry for id, or NULL if id is not live
+ */
+idmap_entry_t *idmap_get(idmap_t *map, int id)
+{
+    size_t i;
+
+    for (i = hash(id) & map->mask; map->slots[i].id >= 0; 
+	 i = (i + 1) & map->mask)
+	if (map->slots[i].id == id)
+	    return &map->slots[i];
+    return NULL;
+}
+
+/*
+ * idmap_put - return the entry for id, adding it if it is not live.
+ *     The returned pointer is only good until the next put or remove.
+ */
+idmap_entry_t *idmap_put(idmap_t *map, int id)
+{
+    size_t i;
+
+    if (2 * (map->count + 1) > map->mask + 1)
+	grow(map);
+    for (i = hash(id) & map->mask; map->slots[i].id >= 0; 
+	 i = (i + 1) & map->mask)
+	if (map->slots[i].id == id)
+	    return &map->slots[i];
+    map->slots[i].id = id;
+    map->slots[i].ptr = NULL;
+    map->slots[i].size = 0;
+    map->count++;
+    return &map->slots[i];
+}
+
+/*
+ * idmap_remove - forget id, if it is live
+ */
+void idmap_remove(idmap_t *map, int id)
+{
+    size_t i, j, home;
+
+    for (i = hash(id) & map->mask; map->slots[i].id != id; 
+	 i = (i + 1) & map->mask)
+	if (map->slots[i].id < 0)
+	    return;
+
+    /* Shift back any later entry whose home slot is at or before the hole */
+    for (j = (i + 1) & map->mask; map->slots[j].id >= 0; j = (j + 1) & map->mask) {
+	home = hash(map->slots[j].id) & map->mask;
+	if (((j - home) & map->mask) >= ((j - i) & map->mask)) {
+	    map->slots[i] = map->slots[j];
+	    i = j;
+	}
+    }
+    map->slots[i].id = -1;
+    map->count--;
+}
@@ -0,0 +1,28 @@
+/*
+ * idmap.h - compact map from trace block ids to the live blocks they
+ *           name, for replays that cannot afford arrays sized by num_ids
+ */
+#ifndef __IDMAP_H_
+#define __IDMAP_H_
+
+#include <stddef.h>
+
+typedef struct {
+    int id;        /* trace block id, or -1 for an empty slot */
+    char *ptr;     /* payload returned by malloc/realloc */
+    size_t size;   /* payload size requested */
+} idmap_entry_t;
+
+typedef struct {
+    idmap_entry_t *slots; /* open-addressed table, size a power of 2 */
+    size_t mask;          /* number of slots - 1 */
+    size_t count;         /* number of live ids */
+} idmap_t;
+
+void idmap_init(idmap_t *map);
+void idmap_destroy(idmap_t *map);
+idmap_entry_t *idmap_get(idmap_t *map, int id);
+idmap_entry_t *idmap_put(idmap_t *map, int id);
+void idmap_remove(idmap_t *map, int id);
+
+#endif /* __IDMAP_H_ */
@@ -0,0 +1,156 @@
+/*
+ * locality.c - spatial locality metrics for allocation placement.
+ *
+ * The driver reports every payload that becomes live or dead. We keep
+ * a reference count per cache line and per page of the heap, so the
+ * number of lines and pages the live set touches is always at hand and
+ * can be compared with the minimum needed to hold the live bytes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "locality.h"
+
+#define LINESIZE 64 /* cache line size (bytes) */
+
+/* private variables */
+static char *heap_base;          /* first byte of the heap */
+static size_t heap_limit;        /* bytes covered by the count arrays */
+static size_t pagesize;          /* system page size */
+static unsigned char *line_refs; /* live payloads touching each line */
+static unsigned short *page_refs;/* live payloads touching each page */
+static size_t live_bytes;        /* bytes in live payloads */
+static size_t live_lines;        /* lines with a nonzero count */
+static size_t live_pages;        /* pages with a nonzero count */
+
+static char *last_alloc;         /* previous payload handed out */
+static double distance_sum;      /* sum of |addr delta| between allocations */
+static long num_allocs;          /* allocations seen so far */
+
+static double lines_sum, min_lines_sum, pages_sum, min_pages_sum;
+static long num_samples;         /* calls to loc_sample */
+static long total_ops;           /* ops in the trace, to place checkpoints */
+static int next_ckpt;            /* next checkpoint to be recorded */
+static locality_t current;       /* peaks and checkpoints gathered so far */
+
+/*
+ * loc_reset - start measuring a new run over a heap of at most
+ *     heap_max bytes beginning at heap_lo
+ */
+void loc_reset(char *heap_lo, size_t heap_max, long num_ops)
+{
+    pagesize = (size_t)getpagesize();
+    if (line_refs == NULL || heap_max > heap_limit) {
+	free(line_refs);
+	free(page_refs);
+	heap_limit = heap_max;
+	line_refs = calloc(heap_limit / LINESIZE + 1, sizeof(*line_refs));
+	page_refs = calloc(heap_limit / pagesize + 1, sizeof(*page_refs));
+	if (line_refs == NULL || page_refs == NULL) {
+	    fprintf(stderr, "loc_reset: calloc error\n");
+	    exit(1);
+	}
+    }
+    else {
+	memset(line_refs, 0, (heap_limit / LINESIZE + 1) * sizeof(*line_refs));
+	memset(page_refs, 0, (heap_limit / pagesize + 1) * sizeof(*page_refs));
+    }
+
+    heap_base = heap_lo;
+    total_ops = num_ops;
+    live_bytes = live_lines = live_pages = 0;
+    last_alloc = NULL;
+    distance_sum = 0;
+    num_allocs = 0;
+    lines_sum = min_lines_sum = pages_sum = min_pages_sum = 0;
+    num_samples = 0;
+    next_ckpt = 0;
+    memset(&current, 0, sizeof(current));
+}
+
+/*
+ * loc_alloc - payload [p, p+size) just became live
+ */
+void loc_alloc(char *p, size_t size)
+{
+    size_t lo = p - heap_base;
+    size_t hi = lo + size - 1;
+    size_t i;
+
+    if (last_alloc != NULL)
+	distance_sum += (p > last_alloc) ? p - last_alloc : last_alloc - p;
+    last_alloc = p;
+    num_allocs++;
+
+    for (i = lo / LINESIZE; i <= hi / LINESIZE; i++)
+	if (line_refs[i]++ == 0)
+	    live_lines++;
+    for (i = lo / pagesize; i <= hi / pagesize; i++)
+	if (page_refs[i]++ == 0)
+	    live_pages++;
+    live_bytes += size;
+}
+
+/*
+ * loc_free - payload [p, p+size) is no longer live
+ */
+void loc_free(char *p, size_t size)
+{
+    size_t lo = p - heap_base;
+    size_t hi = lo + size - 1;
+    size_t i;
+
+    for (i = lo / LINESIZE; i <= hi / LINESIZE; i++)
+	if (--line_refs[i] == 0)
+	    live_lines--;
+    for (i = lo / pagesize; i <= hi / pagesize; i++)
+	if (--page_refs[i] == 0)
+	    live_pages--;
+    live_bytes -= size;
+}
+
+/*
+ * loc_sample - account for the live set after one more trace op
+ */
+void loc_sample(void)
+{
+    size_t min_lines = (live_bytes + LINESIZE - 1) / LINESIZE;
+    size_t min_pages = (live_bytes + pagesize - 1) / pagesize;
+
+    lines_sum += live_lines;
+    min_lines_sum += min_lines;
+    pages_sum += live_pages;
+    min_pages_sum += min_pages;
+    num_samples++;
+
+    if (live_pages > current.peak_pages)
+	current.peak_pages = live_pages;
+    if (min_pages > current.peak_min_pages)
+	current.peak_min_pages = min_pages;
+
+    /* Checkpoint k records the live set after (k+1)/LOC_CHECKPOINTS of the ops */
+    while (next_ckpt < LOC_CHECKPOINTS && 
+	   num_samples >= (long)(next_ckpt + 1) * total_ops / LOC_CHECKPOINTS) {
+	current.ckpt_pages[next_ckpt] = live_pages;
+	current.ckpt_min_pages[next_ckpt] = min_pages;
+	next_ckpt++;
+    }
+}
+
+/*
+ * loc_summary - report the metrics for the run so far
+ */
+void loc_summary(locality_t *loc)
+{
+    *loc = current;
+    loc->avg_distance = (num_allocs > 1) ? distance_sum / (num_allocs - 1) : 0;
+    if (num_samples > 0) {
+	loc->avg_lines = lines_sum / num_samples;
+	loc->avg_min_lines = min_lines_sum / num_samples;
+	loc->avg_pages = pages_sum / num_samples;
+	loc->avg_min_pages = min_pages_sum / num_samples;
+    }
+}
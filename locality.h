@@ -0,0 +1,31 @@
+/*
+ * locality.h - spatial locality metrics for the blocks an allocator
+ *              hands out, computed by mdriver during the validity pass
+ */
+#ifndef __LOCALITY_H_
+#define __LOCALITY_H_
+
+#include <stddef.h>
+
+/* Number of evenly spaced points at which the live set is sampled */
+#define LOC_CHECKPOINTS 10
+
+typedef struct {
+    double avg_distance;  /* mean |addr delta| between successive allocations */
+    double avg_lines;     /* mean # of cache lines spanned by the live set */
+    double avg_min_lines; /* ... and the fewest that could hold it */
+    double avg_pages;     /* mean # of pages spanned by the live set */
+    double avg_min_pages; /* ... and the fewest that could hold it */
+    size_t peak_pages;    /* most pages spanned at any point */
+    size_t peak_min_pages;/* most pages needed at any point */
+    size_t ckpt_pages[LOC_CHECKPOINTS];     /* pages spanned over time */
+    size_t ckpt_min_pages[LOC_CHECKPOINTS]; /* pages needed over time */
+} locality_t;
+
+void loc_reset(char *heap_lo, size_t heap_max, long num_ops);
+void loc_alloc(char *p, size_t size);
+void loc_free(char *p, size_t size);
+void loc_sample(void);
+void loc_summary(locality_t *loc);
+
+#endif /* __LOCALITY_H_ */
@@ -0,0 +1,263 @@
+/*
+ * lock.c - locks for the heap, which can count how often, and for how
+ *          many cycles, they are waited for and held.
+ *
+ * Heap critical sections are short, so a thread that finds the lock
+ * held can often get it sooner by spinning than by sleeping in the
+ * kernel and being woken. There are three kinds of lock:
+ *
+ * LOCK_MUTEX is a pthread mutex, as a baseline.
+ *
+ * LOCK_ADAPTIVE is a futex lock in the style of Drepper's "Futexes Are
+ * Tricky": its word is 0 when free, 1 when held, and 2 when held with
+ * threads parked on it, so releasing an uncontended lock is a single
+ * exchange and no system call. A thread that finds it held first spins
+ * with pause for up to spin_budget iterations. Each time a spinner gets
+ * the lock, the spins it took measure what was left of the holder's
+ * hold, and the budget moves an eighth of the way to twice that; each
+ * time a spinner gives up, the holds are evidently longer than is worth
+ * spinning for, and the budget shrinks by a quarter. With one CPU the
+ * holder can't run while we spin, so there is no spinning at all.
+ *
+ * LOCK_TICKET hands out tickets and serves them in order, so waiters
+ * get the lock first come, first served. A waiter spins, and yields the
+ * CPU once it has spun for a while, so that on an oversubscribed machine
+ * the thread whose turn it is gets to run.
+ *
+ * When counting, an acquisition first tries the lock; only if that
+ * fails is it counted as contended, and the cycles until the lock is
+ * taken are added to the wait. The hold time runs from taking the lock
+ * to releasing it. All the counts are updated by the thread holding the
+ * lock, so they need no atomics of their own, and an uncontended
+ * acquire and release read the cycle counter just twice. That is still
+ * not free (tens of nanoseconds in some VMs), so counting is off unless
+ * lock_reset turns it on.
+ */
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "lock.h"
+#include "clock.h"
+
+#define SPIN_MIN      8    /* least adaptive budget, so it keeps learning */
+#define SPIN_MAX      512  /* most pauses an adaptive waiter spins */
+#define SPIN_START    64   /* adaptive budget after a reset */
+#define TICKET_SPINS  128  /* pauses before a ticket waiter yields */
+
+/* Spin at all? Not with one CPU */
+static int spinning = 1;
+
+static inline void cpu_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static void futex_wait(int *word, int val)
+{
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(int *word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/*
+ * try_acquire - take the lock if it is free; returns 0 if it is held
+ */
+static int try_acquire(lock_t *l)
+{
+    int zero = 0;
+    unsigned t;
+
+    switch (l->kind) {
+    case LOCK_ADAPTIVE:
+	return __atomic_compare_exchange_n(&l->word, &zero, 1, 0,
+					   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    case LOCK_TICKET:
+	t = __atomic_load_n(&l->now_serving, __ATOMIC_ACQUIRE);
+	return __atomic_compare_exchange_n(&l->next_ticket, &t, t + 1, 0,
+					   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    default:
+	return pthread_mutex_trylock(&l->mutex) == 0;
+    }
+}
+
+/*
+ * adaptive_wait - take an adaptive lock that was held: spin within the
+ *     budget, then park. Returns 1 if spinning got it.
+ */
+static int adaptive_wait(lock_t *l)
+{
+    int budget = __atomic_load_n(&l->spin_budget, __ATOMIC_RELAXED);
+    int zero, i;
+
+    for (i = 0; spinning && i < budget; i++) {
+	cpu_relax();
+	zero = 0;
+	if (__atomic_load_n(&l->word, __ATOMIC_RELAXED) == 0 &&
+	    __atomic_compare_exchange_n(&l->word, &zero, 1, 0,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+	    budget += (2 * i - budget) / 8;
+	    __atomic_store_n(&l->spin_budget,
+			     budget < SPIN_MIN ? SPIN_MIN :
+			     budget > SPIN_MAX ? SPIN_MAX : budget,
+			     __ATOMIC_RELAXED);
+	    return 1;
+	}
+    }
+    if (spinning) {
+	budget -= budget / 4;
+	__atomic_store_n(&l->spin_budget, budget < SPIN_MIN ? SPIN_MIN : budget,
+			 __ATOMIC_RELAXED);
+    }
+
+    /* Mark the lock as having waiters, and sleep until it is ours */
+    while (__atomic_exchange_n(&l->word, 2, __ATOMIC_ACQUIRE) != 0)
+	futex_wait(&l->word, 2);
+    return 0;
+}
+
+/*
+ * ticket_wait - take a ticket lock that was held: take a ticket and
+ *     wait for it to be served. Returns 1 if it was served while we spun.
+ */
+static int ticket_wait(lock_t *l)
+{
+    unsigned me = __atomic_fetch_add(&l->next_ticket, 1, __ATOMIC_RELAXED);
+    int i = 0, yielded = 0;
+
+    while (__atomic_load_n(&l->now_serving, __ATOMIC_ACQUIRE) != me) {
+	if (spinning && i < TICKET_SPINS) {
+	    cpu_relax();
+	    i++;
+	}
+	else {
+	    sched_yield();
+	    yielded = 1;
+	}
+    }
+    return !yielded;
+}
+
+/*
+ * wait_acquire - take a lock that try_acquire found held; returns 1 if
+ *     it was got by spinning rather than sleeping or yielding
+ */
+static int wait_acquire(lock_t *l)
+{
+    switch (l->kind) {
+    case LOCK_ADAPTIVE:
+	return adaptive_wait(l);
+    case LOCK_TICKET:
+	return ticket_wait(l);
+    default:
+	pthread_mutex_lock(&l->mutex);
+	return 0;
+    }
+}
+
+/*
+ * lock_acquire - take the lock, counting any wait
+ */
+void lock_acquire(lock_t *l)
+{
+    unsigned long long start, now;
+    int spun;
+
+    if (!l->counting) {
+	if (!try_acquire(l))
+	    wait_acquire(l);
+	return;
+    }
+    if (try_acquire(l)) {
+	now = read_counter();
+	l->stats.acquires++;
+    }
+    else {
+	start = read_counter();
+	spun = wait_acquire(l);
+	now = read_counter();
+	l->stats.acquires++;
+	l->stats.contended++;
+	l->stats.spun += spun;
+	l->stats.wait_cycles += now - start;
+    }
+    l->acquired_at = now;
+}
+
+/*
+ * release - release the lock, without counting
+ */
+static void release(lock_t *l)
+{
+    switch (l->kind) {
+    case LOCK_ADAPTIVE:
+	if (__atomic_exchange_n(&l->word, 0, __ATOMIC_RELEASE) == 2)
+	    futex_wake(&l->word);
+	break;
+    case LOCK_TICKET:
+	__atomic_store_n(&l->now_serving, l->now_serving + 1, __ATOMIC_RELEASE);
+	break;
+    default:
+	pthread_mutex_unlock(&l->mutex);
+    }
+}
+
+/*
+ * lock_release - release the lock, counting the time it was held
+ */
+void lock_release(lock_t *l)
+{
+    if (l->counting)
+	l->stats.hold_cycles += read_counter() - l->acquired_at;
+    release(l);
+}
+
+/*
+ * lock_reset - make l a free lock of the given kind with no counts,
+ *     counting from now on or not. No thread may be using the lock.
+ */
+void lock_reset(lock_t *l, LockKind kind, int counting)
+{
+    spinning = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+    l->kind = kind;
+    l->word = 0;
+    l->spin_budget = SPIN_START;
+    l->next_ticket = l->now_serving = 0;
+    l->counting = counting;
+    memset(&l->stats, 0, sizeof(l->stats));
+}
+
+/*
+ * lock_stats - copy out the counts, which are consistent as of the
+ *     moment they are copied
+ */
+void lock_stats(lock_t *l, lockstat_t *stats)
+{
+    if (!try_acquire(l))
+	wait_acquire(l);
+    *stats = l->stats;
+    stats->spin_budget = (l->kind == LOCK_ADAPTIVE && spinning) ?
+	__atomic_load_n(&l->spin_budget, __ATOMIC_RELAXED) : 0;
+    release(l);
+}
+
+/* lock_kind_name - how a kind of lock is spelled on command lines */
+const char *lock_kind_name(LockKind kind)
+{
+    switch (kind) {
+    case LOCK_ADAPTIVE:
+	return "adaptive";
+    case LOCK_TICKET:
+	return "ticket";
+    default:
+	return "mutex";
+    }
+}
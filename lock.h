@@ -0,0 +1,50 @@
+/*
+ * lock.h - locks for the heap: a pthread mutex, an adaptive lock that
+ *          spins before it parks on a futex, or a ticket lock; each can
+ *          count how often, and for how many cycles, it is waited for
+ *          and held
+ */
+#ifndef __LOCK_H_
+#define __LOCK_H_
+
+#include <pthread.h>
+
+/* How a lock waits */
+typedef enum {
+    LOCK_MUTEX,     /* pthread_mutex_lock */
+    LOCK_ADAPTIVE,  /* spin for a learned while, then park on a futex */
+    LOCK_TICKET     /* spin, then yield, until our ticket is served */
+} LockKind;
+
+/* What a lock has been through since it was last reset */
+typedef struct {
+    long acquires;                  /* times it was taken */
+    long contended;                 /* ... when another thread held it */
+    long spun;                      /* ... and it was freed while we spun */
+    unsigned long long wait_cycles; /* cycles spent waiting for it */
+    unsigned long long hold_cycles; /* cycles it was held */
+    int spin_budget;                /* adaptive: spins it had learned */
+} lockstat_t;
+
+typedef struct {
+    LockKind kind;
+    pthread_mutex_t mutex;          /* LOCK_MUTEX */
+    int word;                       /* LOCK_ADAPTIVE: 0 free, 1 held, 2 waiters */
+    int spin_budget;                /* LOCK_ADAPTIVE: pauses worth spinning */
+    unsigned next_ticket;           /* LOCK_TICKET: next ticket handed out */
+    unsigned now_serving;           /* LOCK_TICKET: ticket that holds it */
+    int counting;                   /* keep the counts? */
+    unsigned long long acquired_at; /* cycle counter when last taken */
+    lockstat_t stats;               /* only changed by the holder */
+} lock_t;
+
+#define LOCK_INITIALIZER \
+    { LOCK_MUTEX, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 0, 0, { 0 } }
+
+void lock_acquire(lock_t *l);
+void lock_release(lock_t *l);
+void lock_reset(lock_t *l, LockKind kind, int counting);
+void lock_stats(lock_t *l, lockstat_t *stats);
+const char *lock_kind_name(LockKind kind);
+
+#endif /* __LOCK_H_ */
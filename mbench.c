@@ -0,0 +1,866 @@
+/*
+ * mbench.c - Microbenchmarks for the building blocks of the malloc
+ *     packages, each timed in isolation from any trace.
+ *
+ * Each benchmark is named on the command line (or all are run) and
+ * prints its own results, as nanoseconds per operation.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "pagemap.h"
+#include "memlib.h"
+#include "mm.h"
+#include "mt.h"
+#include "verify.h"
+
+#define DEFAULT_OPS  (1 << 22) /* operations per benchmark (-n) */
+
+/* A benchmark: its name, what it measures, and how to run it */
+typedef struct {
+    const char *name;
+    const char *what;
+    void (*run)(long ops);
+} bench_t;
+
+static void bench_pagemap(long ops);
+static void bench_caches(long ops);
+static void bench_falseshare(long ops);
+static void bench_reclaim(long ops);
+static void bench_compact(long ops);
+
+static bench_t benches[] = {
+    {"pagemap", "pointer-to-span lookups in the radix page map", bench_pagemap},
+    {"caches", "small-block churn through the mt_ caches on many threads", 
+     bench_caches},
+    {"falseshare", "threads writing their own small blocks, with and without "
+     "owned runs", bench_falseshare},
+    {"reclaim", "lock-free readers of a linked list a writer updates, with "
+     "deferred frees", bench_reclaim},
+    {"compact", "a long-running cache's churn through handles, with and "
+     "without compaction", bench_compact},
+    {NULL, NULL, NULL}
+};
+
+/* Function prototypes */
+static double now(void);
+static unsigned long xorshift(unsigned long *state);
+static void usage(void);
+static void unix_error(const char *msg);
+
+/* Keeps results live so the timed loops aren't optimized away */
+static volatile unsigned long sink;
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv)
+{
+    int c, i, j;
+    long ops = DEFAULT_OPS;
+
+    while ((c = getopt(argc, argv, "hn:")) != EOF) {
+        switch (c) {
+        case 'n': /* Operations per benchmark */
+            ops = atol(optarg);
+            if (ops <= 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'h': /* Print this message */
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+
+    for (i = 0; benches[i].name != NULL; i++) {
+        if (optind < argc) {
+            for (j = optind; j < argc; j++)
+                if (!strcmp(argv[j], benches[i].name))
+                    break;
+            if (j == argc)
+                continue;
+        }
+        printf("%s: %s\n", benches[i].name, benches[i].what);
+        benches[i].run(ops);
+        printf("\n");
+    }
+    for (j = optind; j < argc; j++) {
+        for (i = 0; benches[i].name != NULL; i++)
+            if (!strcmp(argv[j], benches[i].name))
+                break;
+        if (benches[i].name == NULL)
+            fprintf(stderr, "Unknown benchmark: %s\n", argv[j]);
+    }
+    exit(0);
+}
+
+/*****************************************************
+ * pagemap: the radix tree against a binary search over
+ * the same spans
+ *****************************************************/
+
+#define PM_BENCH_PAGES  (1 << 16) /* 256MB of address space */
+#define PM_BENCH_PTRS   (1 << 16) /* distinct pointers looked up */
+
+/*
+ * span_search - the span holding p, by binary search over spans sorted
+ *     by address; the structure the page map replaces
+ */
+static span_t *span_search(span_t *spans, int n, char *p)
+{
+    int lo = 0, hi = n - 1, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (spans[mid].start <= p)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return &spans[lo];
+}
+
+/*
+ * bench_pagemap - carve 256MB of reserved address space into spans of
+ *     1-16 pages, enter them in the page map, and look up random
+ *     pointers into them. "independent" lookups can overlap in the
+ *     pipeline; in "dependent" ones each pointer is chosen by the span
+ *     the last lookup found, which exposes the latency of the two loads.
+ */
+static void bench_pagemap(long ops)
+{
+    size_t len = (size_t)PM_BENCH_PAGES << PM_PAGE_SHIFT;
+    char *base, **ptrs;
+    span_t *spans, *s;
+    int nspans = 0;
+    size_t pn, npages;
+    unsigned long state = 88172645463325252UL;
+    unsigned long sum, idx;
+    double start, map_ns, search_ns, dep_ns;
+    long i;
+
+    base = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                -1, 0);
+    if (base == MAP_FAILED)
+        unix_error("mmap failed in bench_pagemap");
+    spans = (span_t *)malloc(PM_BENCH_PAGES * sizeof(span_t));
+    ptrs = (char **)malloc(PM_BENCH_PTRS * sizeof(char *));
+    if (spans == NULL || ptrs == NULL)
+        unix_error("malloc failed in bench_pagemap");
+
+    /* Carve the region into spans and map them */
+    pagemap_init(base);
+    for (pn = 0; pn < PM_BENCH_PAGES; pn += npages) {
+        npages = 1 + xorshift(&state) % 16;
+        if (pn + npages > PM_BENCH_PAGES)
+            npages = PM_BENCH_PAGES - pn;
+        spans[nspans].start = base + (pn << PM_PAGE_SHIFT);
+        spans[nspans].npages = npages;
+        spans[nspans].kind = SPAN_SLAB;
+        pagemap_set(spans[nspans].start, npages << PM_PAGE_SHIFT, &spans[nspans]);
+        nspans++;
+    }
+    for (i = 0; i < PM_BENCH_PTRS; i++)
+        ptrs[i] = base + xorshift(&state) % len;
+
+    /* Check the map against the search before timing either */
+    for (i = 0; i < PM_BENCH_PTRS; i++) {
+        if (pagemap_lookup(ptrs[i]) != span_search(spans, nspans, ptrs[i])) {
+            fprintf(stderr, "pagemap: wrong span for %p\n", ptrs[i]);
+            exit(1);
+        }
+    }
+
+    sum = 0;
+    start = now();
+    for (i = 0; i < ops; i++)
+        sum += pagemap_lookup(ptrs[i & (PM_BENCH_PTRS - 1)])->npages;
+    map_ns = (now() - start) * 1e9 / ops;
+    sink += sum;
+
+    sum = 0;
+    start = now();
+    for (i = 0; i < ops; i++)
+        sum += span_search(spans, nspans, ptrs[i & (PM_BENCH_PTRS - 1)])->npages;
+    search_ns = (now() - start) * 1e9 / ops;
+    sink += sum;
+
+    idx = 0;
+    start = now();
+    for (i = 0; i < ops; i++) {
+        s = pagemap_lookup(ptrs[idx]);
+        idx = (idx + s->npages + 1) & (PM_BENCH_PTRS - 1);
+    }
+    dep_ns = (now() - start) * 1e9 / ops;
+    sink += idx;
+
+    printf("  %d spans over %d pages, %ld lookups\n", nspans, PM_BENCH_PAGES, ops);
+    printf("  %-28s %8.2f ns/lookup\n", "page map, independent", map_ns);
+    printf("  %-28s %8.2f ns/lookup\n", "page map, dependent", dep_ns);
+    printf("  %-28s %8.2f ns/lookup\n", "binary search, independent", search_ns);
+
+    pagemap_init(NULL);
+    free(spans);
+    free(ptrs);
+    munmap(base, len);
+}
+
+/*****************************************************
+ * caches: mt_ throughput and memory held in caches,
+ * with no caches, thread caches and CPU caches
+ *****************************************************/
+
+#define CB_LIVE  64   /* blocks each thread keeps live */
+
+static const int cb_threads[] = {1, 4, 16, 64, 256, 0};
+
+/* One churning thread */
+typedef struct {
+    long ops;
+    unsigned long state;
+    pthread_barrier_t *barrier;
+    pthread_t thread;
+} cb_worker_t;
+
+/*
+ * cb_worker - free or allocate a random one of the thread's blocks, of
+ *     a random small size, ops times; then free them all
+ */
+static void *cb_worker(void *arg)
+{
+    cb_worker_t *w = (cb_worker_t *)arg;
+    char *live[CB_LIVE];
+    long i;
+    int k;
+
+    memset(live, 0, sizeof(live));
+    pthread_barrier_wait(w->barrier);
+    for (i = 0; i < w->ops; i++) {
+        k = xorshift(&w->state) % CB_LIVE;
+        if (live[k] != NULL) {
+            mt_free(live[k]);
+            live[k] = NULL;
+        }
+        else {
+            if ((live[k] = mt_malloc(1 + xorshift(&w->state) % CACHE_MAX)) == NULL) {
+                fprintf(stderr, "caches: mt_malloc failed\n");
+                exit(1);
+            }
+            live[k][0] = (char)k;
+        }
+    }
+    for (k = 0; k < CB_LIVE; k++)
+        if (live[k] != NULL)
+            mt_free(live[k]);
+    return NULL;
+}
+
+/*
+ * bench_caches - split ops among 1 to 256 threads churning small blocks
+ *     through the mt_ front end. Once every thread has exited and freed
+ *     all its blocks, whatever the caches still hold is memory no thread
+ *     can reuse; the heap size shows what it cost.
+ */
+static void bench_caches(long ops)
+{
+    static const CacheMode modes[] = {CACHE_NONE, CACHE_THREAD, CACHE_CPU};
+    pthread_barrier_t barrier;
+    cb_worker_t *workers;
+    double start, secs;
+    int m, t, n, i;
+
+    mem_init();
+    printf("  %-8s %8s %10s %10s %10s\n", 
+           "caches", "threads", "Mops/s", "heap KB", "cached KB");
+    for (m = 0; m < 3; m++) {
+        for (t = 0; (n = cb_threads[t]) != 0; t++) {
+            if ((workers = (cb_worker_t *)calloc(n, sizeof(cb_worker_t))) == NULL)
+                unix_error("calloc failed in bench_caches");
+            mem_reset_brk();
+            mt_set_cache(modes[m]);
+            if (mt_init() < 0) {
+                fprintf(stderr, "caches: mt_init failed\n");
+                exit(1);
+            }
+            pthread_barrier_init(&barrier, NULL, n + 1);
+            for (i = 0; i < n; i++) {
+                workers[i].ops = ops / n;
+                workers[i].state = 88172645463325252UL + i;
+                workers[i].barrier = &barrier;
+                if (pthread_create(&workers[i].thread, NULL, cb_worker, 
+                                   &workers[i]) != 0)
+                    unix_error("pthread_create failed in bench_caches");
+            }
+            start = now();
+            pthread_barrier_wait(&barrier);
+            for (i = 0; i < n; i++)
+                pthread_join(workers[i].thread, NULL);
+            secs = now() - start;
+            pthread_barrier_destroy(&barrier);
+
+            printf("  %-8s %8d %10.2f %10.1f %10.1f\n", 
+                   cache_mode_name(cache_mode()), n, 
+                   (ops / n) * n / secs / 1e6,
+                   mem_heapsize() / 1024.0, mt_cached_bytes() / 1024.0);
+            free(workers);
+        }
+    }
+    mt_set_cache(CACHE_NONE);   /* leave the later benches uncached */
+    mem_deinit();
+}
+
+/*****************************************************
+ * falseshare: threads writing their own small blocks,
+ * placed by the shared heap or in thread-owned runs
+ *****************************************************/
+
+#define FS_OBJS  64   /* blocks each thread allocates and writes */
+#define FS_SIZE  16   /* payload bytes of each */
+
+static const int fs_threads[] = {1, 2, 4, 8, 0};
+
+/* One writing thread */
+typedef struct {
+    int tid, n;
+    long ops;
+    int *turn;           /* whose turn it is to allocate */
+    long *objs[FS_OBJS];
+    double start, end;   /* when the writes began and ended */
+    pthread_barrier_t *barrier;
+    pthread_t thread;
+} fs_worker_t;
+
+/*
+ * fs_worker - allocate the thread's blocks in turn with the other
+ *     threads, so a shared heap interleaves them; then, from the
+ *     barrier on, increment them round robin ops times
+ */
+static void *fs_worker(void *arg)
+{
+    fs_worker_t *w = (fs_worker_t *)arg;
+    long i;
+    int k;
+
+    for (k = 0; k < FS_OBJS; k++) {
+        while (__atomic_load_n(w->turn, __ATOMIC_ACQUIRE) != k * w->n + w->tid)
+            sched_yield();
+        if ((w->objs[k] = (long *)mt_malloc(FS_SIZE)) == NULL) {
+            fprintf(stderr, "falseshare: mt_malloc failed\n");
+            exit(1);
+        }
+        *w->objs[k] = 0;
+        __atomic_store_n(w->turn, k * w->n + w->tid + 1, __ATOMIC_RELEASE);
+    }
+    pthread_barrier_wait(w->barrier);
+    w->start = now();
+    for (i = 0; i < w->ops; i++)
+        (*(volatile long *)w->objs[i % FS_OBJS])++;
+    w->end = now();
+    return NULL;
+}
+
+/* A block's cache line and the thread that owns it */
+typedef struct {
+    uintptr_t line;
+    int tid;
+} fs_line_t;
+
+static int fs_line_cmp(const void *a, const void *b)
+{
+    const fs_line_t *x = (const fs_line_t *)a, *y = (const fs_line_t *)b;
+
+    if (x->line != y->line)
+        return x->line < y->line ? -1 : 1;
+    return x->tid - y->tid;
+}
+
+/*
+ * fs_shared - the cache lines holding blocks of more than one of the
+ *     n workers
+ */
+static int fs_shared(fs_worker_t *workers, int n)
+{
+    fs_line_t *lines;
+    uintptr_t first, last, l;
+    int i, j, k, m = 0, shared = 0;
+
+    if (n <= 0)
+        return 0;
+    if ((lines = (fs_line_t *)malloc((size_t)n * FS_OBJS * 2 * 
+                                     sizeof(fs_line_t))) == NULL)
+        unix_error("malloc failed in bench_falseshare");
+    for (i = 0; i < n; i++)
+        for (k = 0; k < FS_OBJS; k++) {
+            first = (uintptr_t)workers[i].objs[k] / 64;
+            last = ((uintptr_t)workers[i].objs[k] + FS_SIZE - 1) / 64;
+            for (l = first; l <= last; l++) {
+                lines[m].line = l;
+                lines[m++].tid = i;
+            }
+        }
+    qsort(lines, m, sizeof(fs_line_t), fs_line_cmp);
+    for (i = 0; i < m; i = j) {
+        for (j = i + 1; j < m && lines[j].line == lines[i].line; j++)
+            ;
+        shared += (lines[j - 1].tid != lines[i].tid);
+    }
+    free(lines);
+    return shared;
+}
+
+/*
+ * bench_falseshare - have 1 to 8 threads allocate small blocks in turn
+ *     and then write only their own, with the blocks placed by the
+ *     shared heap and then in runs owned by each thread. Blocks of two
+ *     threads on one line make the writes contend for it, on a machine
+ *     with the CPUs to run the threads at once.
+ */
+static void bench_falseshare(long ops)
+{
+    pthread_barrier_t barrier;
+    fs_worker_t *workers;
+    double start, end;
+    int runs, t, n, i, k, turn;
+
+    mem_init();
+    printf("  %-6s %8s %12s %14s\n", "runs", "threads", "Mwrites/s", 
+           "shared lines");
+    for (runs = 0; runs < 2; runs++) {
+        for (t = 0; (n = fs_threads[t]) != 0; t++) {
+            if ((workers = (fs_worker_t *)calloc(n, sizeof(fs_worker_t))) == NULL)
+                unix_error("calloc failed in bench_falseshare");
+            mem_reset_brk();
+            mt_set_runs(runs);
+            if (mt_init() < 0) {
+                fprintf(stderr, "falseshare: mt_init failed\n");
+                exit(1);
+            }
+            turn = 0;
+            pthread_barrier_init(&barrier, NULL, n + 1);
+            for (i = 0; i < n; i++) {
+                workers[i].tid = i;
+                workers[i].n = n;
+                workers[i].ops = ops / n;
+                workers[i].turn = &turn;
+                workers[i].barrier = &barrier;
+                if (pthread_create(&workers[i].thread, NULL, fs_worker, 
+                                   &workers[i]) != 0)
+                    unix_error("pthread_create failed in bench_falseshare");
+            }
+            pthread_barrier_wait(&barrier);
+            start = 1e30;
+            end = 0;
+            for (i = 0; i < n; i++) {
+                pthread_join(workers[i].thread, NULL);
+                if (workers[i].start < start)
+                    start = workers[i].start;
+                if (workers[i].end > end)
+                    end = workers[i].end;
+            }
+            pthread_barrier_destroy(&barrier);
+
+            printf("  %-6s %8d %12.1f %14d\n", runs ? "owned" : "none", n,
+                   (ops / n) * n / (end - start) / 1e6, fs_shared(workers, n));
+            for (i = 0; i < n; i++)
+                for (k = 0; k < FS_OBJS; k++)
+                    mt_free(workers[i].objs[k]);
+            free(workers);
+        }
+    }
+    mt_set_runs(0);
+    mem_deinit();
+}
+
+/*****************************************************
+ * reclaim: a linked list read without locks while a
+ * writer replaces its nodes, freeing the old ones by
+ * epoch or leaking them
+ *****************************************************/
+
+#define RC_NODES   128        /* nodes on the list */
+#define RC_WALK    64         /* list nodes per update, as ops */
+#define RC_MAGIC   0x9e3779b97f4a7c15UL
+
+static const int rc_readers[] = {1, 2, 4, 0};
+
+/* A list node; a published node is never written again */
+typedef struct rc_node {
+    struct rc_node *next;
+    unsigned long key, val;
+    unsigned long check;      /* key * RC_MAGIC ^ val */
+} rc_node_t;
+
+/* The list, and what its readers saw */
+typedef struct {
+    rc_node_t *head;
+    int stop;                 /* set when the writer is done */
+    long reads;               /* whole walks by every reader */
+    long torn;                /* nodes whose check didn't hold */
+} rc_list_t;
+
+/* rc_node - a new node, or exit if the heap is out of memory */
+static rc_node_t *rc_node(unsigned long key, unsigned long val, 
+                          rc_node_t *next)
+{
+    rc_node_t *n;
+
+    if ((n = (rc_node_t *)mt_malloc(sizeof(rc_node_t))) == NULL) {
+        fprintf(stderr, "reclaim: mt_malloc failed\n");
+        exit(1);
+    }
+    n->key = key;
+    n->val = val;
+    n->check = key * RC_MAGIC ^ val;
+    n->next = next;
+    return n;
+}
+
+/*
+ * rc_reader - walk the list inside a read section, checking every
+ *     node, until the writer is done. A node freed under a reader would
+ *     show up as a torn check or worse.
+ */
+static void *rc_reader(void *arg)
+{
+    rc_list_t *l = (rc_list_t *)arg;
+    rc_node_t *n;
+    long reads = 0, torn = 0;
+    unsigned long sum = 0;
+
+    while (!__atomic_load_n(&l->stop, __ATOMIC_RELAXED)) {
+        mt_read_enter();
+        for (n = __atomic_load_n(&l->head, __ATOMIC_ACQUIRE); n != NULL;
+             n = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE)) {
+            torn += (n->check != (n->key * RC_MAGIC ^ n->val));
+            sum += n->val;
+        }
+        mt_read_exit();
+        reads++;
+    }
+    __atomic_add_fetch(&sink, sum, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&l->reads, reads, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&l->torn, torn, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/*
+ * bench_reclaim - have one writer replace random nodes of a list, each
+ *     with a copy holding a new value, while 1 to 4 readers walk it
+ *     without locks. The old nodes are either leaked, the only safe
+ *     thing to do without reclamation, or freed with mt_free_deferred;
+ *     the heap size shows what leaking costs, and pending the blocks
+ *     reclamation held back when the writer was done.
+ */
+static void bench_reclaim(long ops)
+{
+    rc_list_t list;
+    rc_node_t **pp, *old, *n;
+    pthread_t *readers;
+    epochstat_t es;
+    double start, secs;
+    long i, updates = ops / RC_WALK;
+    unsigned long state = 88172645463325252UL;
+    int deferred, t, nr, k;
+
+    mem_init();
+    printf("  %-8s %8s %12s %12s %8s %10s %10s\n", "frees", "readers", 
+           "Kupdates/s", "Kwalks/s", "torn", "heap KB", "pending");
+    for (deferred = 0; deferred < 2; deferred++) {
+        for (t = 0; (nr = rc_readers[t]) != 0; t++) {
+            if ((readers = (pthread_t *)calloc(nr, sizeof(pthread_t))) == NULL)
+                unix_error("calloc failed in bench_reclaim");
+            mem_reset_brk();
+            if (mt_init() < 0) {
+                fprintf(stderr, "reclaim: mt_init failed\n");
+                exit(1);
+            }
+            memset(&list, 0, sizeof(list));
+            for (k = RC_NODES - 1; k >= 0; k--)
+                list.head = rc_node(k, 0, list.head);
+            for (i = 0; i < nr; i++)
+                if (pthread_create(&readers[i], NULL, rc_reader, &list) != 0)
+                    unix_error("pthread_create failed in bench_reclaim");
+
+            start = now();
+            for (i = 0; i < updates; i++) {
+                k = xorshift(&state) % RC_NODES;
+                for (pp = &list.head; k > 0; k--)
+                    pp = &(*pp)->next;
+                old = *pp;
+                n = rc_node(old->key, old->val + 1, old->next);
+                __atomic_store_n(pp, n, __ATOMIC_RELEASE);
+                if (deferred)
+                    mt_free_deferred(old);
+            }
+            secs = now() - start;
+            mt_epoch_stats(&es);
+            __atomic_store_n(&list.stop, 1, __ATOMIC_RELAXED);
+            for (i = 0; i < nr; i++)
+                pthread_join(readers[i], NULL);
+
+            printf("  %-8s %8d %12.1f %12.1f %8ld %10.1f %10ld\n", 
+                   deferred ? "deferred" : "leaked", nr, updates / secs / 1e3,
+                   list.reads / secs / 1e3, list.torn,
+                   mem_heapsize() / 1024.0, es.retired - es.freed);
+            for (n = list.head; n != NULL; n = old) {
+                old = n->next;
+                mt_free(n);
+            }
+            mt_fini();
+            free(readers);
+        }
+    }
+    mem_deinit();
+}
+
+/*****************************************************
+ * compact: heap size over a generated churn of handle
+ * blocks whose live set grows and shrinks, with and
+ * without incremental compaction
+ *****************************************************/
+
+#define CP_DIV      16          /* ops per churn op */
+#define CP_LIVE     (1 << 12)   /* most live blocks */
+#define CP_PHASES   4           /* times the live set grows and shrinks */
+#define CP_SAMPLES  16          /* heap size samples over the churn */
+#define CP_STEP     4096        /* bytes mm_compact may move per free */
+#define CP_PINNED   64          /* every this many blocks stays pinned */
+
+/* A churn op: allocate size bytes into a slot, or free it if size is 0 */
+typedef struct {
+    int slot;
+    uint32_t size;
+} cp_op_t;
+
+/*
+ * cp_generate - n churn ops. In each phase the live set grows to
+ *     CP_LIVE blocks, is churned there, and shrinks to an eighth, with
+ *     random frees throughout; the phases alternate between small and
+ *     large blocks, so a phase can't reuse the holes the last one left.
+ */
+static cp_op_t *cp_generate(long n, unsigned long *state)
+{
+    cp_op_t *ops;
+    int *live, *where, nlive = 0, slot, target;
+    long i, len = n / CP_PHASES, t;
+    uint32_t lo, span;
+
+    ops = (cp_op_t *)malloc(n * sizeof(cp_op_t));
+    live = (int *)malloc(CP_LIVE * sizeof(int));
+    where = (int *)malloc(CP_LIVE * sizeof(int));
+    if (ops == NULL || live == NULL || where == NULL)
+        unix_error("malloc failed in cp_generate");
+    for (slot = 0; slot < CP_LIVE; slot++)
+        where[slot] = -1;
+
+    for (i = 0; i < n; i++) {
+        t = i % len;
+        if (t < len / 4)
+            target = CP_LIVE * t / (len / 4);
+        else if (t < 3 * len / 4)
+            target = CP_LIVE;
+        else
+            target = CP_LIVE - (CP_LIVE - CP_LIVE / 8) * (t - 3 * len / 4) /
+                (len - 3 * len / 4);
+        lo = (i / len) % 2 ? 256 : 16;
+        span = (i / len) % 2 ? 3840 : 240;
+        if (nlive == 0 || (nlive < target && xorshift(state) % 4 != 0)) {
+            /* a free slot: live has every live one first */
+            for (slot = xorshift(state) % CP_LIVE; where[slot] >= 0; )
+                slot = (slot + 1) % CP_LIVE;
+            where[slot] = nlive;
+            live[nlive++] = slot;
+            ops[i].slot = slot;
+            ops[i].size = lo + xorshift(state) % span;
+        } else {
+            int k = xorshift(state) % nlive;
+            slot = live[k];
+            live[k] = live[--nlive];
+            where[live[k]] = k;
+            where[slot] = -1;
+            ops[i].slot = slot;
+            ops[i].size = 0;
+        }
+    }
+    free(live);
+    free(where);
+    return ops;
+}
+
+/*
+ * cp_run - play the churn ops on a fresh heap through handles, calling
+ *     mm_compact after each free if compact is set, and sample the heap
+ *     size and live payload bytes. Each payload holds the number of the
+ *     op that allocated it, then that number's low byte all the way to
+ *     its end, and is checked in full when freed. Returns the secs
+ *     taken, and the bytes moved in *moved.
+ */
+static double cp_run(cp_op_t *ops, long n, int compact, size_t *heap, 
+                     size_t *live, size_t *moved)
+{
+    mm_handle_t *h;
+    char *pinned;
+    unsigned long *p;
+    double start, secs;
+    long i, bad = 0;
+    size_t bytes = 0;
+    int slot;
+
+    h = (mm_handle_t *)calloc(CP_LIVE, sizeof(mm_handle_t));
+    pinned = (char *)calloc(CP_LIVE, 1);
+    if (h == NULL || pinned == NULL)
+        unix_error("calloc failed in cp_run");
+    mem_reset_brk();
+    if (mm_init() < 0) {
+        fprintf(stderr, "compact: mm_init failed\n");
+        exit(1);
+    }
+    *moved = 0;
+    start = now();
+    for (i = 0; i < n; i++) {
+        slot = ops[i].slot;
+        if (ops[i].size > 0) {
+            if ((h[slot] = mm_halloc(ops[i].size)) == 0) {
+                fprintf(stderr, "compact: mm_halloc failed\n");
+                exit(1);
+            }
+            bytes += ops[i].size;
+            p = (unsigned long *)mm_hpin(h[slot]);
+            p[0] = i;
+            memset(p + 1, i & 0xFF, ops[i].size - sizeof(*p));
+            pinned[slot] = (i % CP_PINNED == 0);
+            if (!pinned[slot])
+                mm_hunpin(h[slot]);
+        } else {
+            if (pinned[slot])
+                mm_hunpin(h[slot]);
+            p = (unsigned long *)mm_hpin(h[slot]);
+            if (p[0] >= (unsigned long)i || ops[p[0]].slot != slot ||
+                verify_fill(p + 1, p[0] & 0xFF, 
+                            ops[p[0]].size - sizeof(*p)) >= 0)
+                bad++;
+            else
+                bytes -= ops[p[0]].size;
+            mm_hunpin(h[slot]);
+            mm_hfree(h[slot]);
+            if (compact)
+                *moved += mm_compact(CP_STEP);
+        }
+        if ((i + 1) % (n / CP_SAMPLES) == 0 && (i + 1) / (n / CP_SAMPLES) <= 
+            CP_SAMPLES) {
+            heap[(i + 1) / (n / CP_SAMPLES) - 1] = mem_heapsize();
+            live[(i + 1) / (n / CP_SAMPLES) - 1] = bytes;
+        }
+    }
+    secs = now() - start;
+    if (bad > 0) {
+        fprintf(stderr, "compact: %ld payloads changed\n", bad);
+        exit(1);
+    }
+    free(h);
+    free(pinned);
+    return secs;
+}
+
+/*
+ * bench_compact - play a generated churn of handle blocks twice, without
+ *     and with incremental compaction, and print the live payload bytes
+ *     and heap size after each sixteenth of it, and the cost per op of
+ *     each run. One block in CP_PINNED stays pinned from allocation to
+ *     free, so compaction has to work around it.
+ */
+static void bench_compact(long ops)
+{
+    long n = ops / CP_DIV, k;
+    unsigned long state = 88172645463325252UL;
+    size_t heap[2][CP_SAMPLES], live[CP_SAMPLES], moved[2];
+    double secs[2];
+    cp_op_t *churn;
+    int compact;
+
+    if (n < CP_PHASES * CP_SAMPLES * 4) {
+        fprintf(stderr, "compact: too few ops\n");
+        return;
+    }
+    churn = cp_generate(n, &state);
+    mem_init();
+    for (compact = 0; compact < 2; compact++)
+        secs[compact] = cp_run(churn, n, compact, heap[compact], live,
+                               &moved[compact]);
+    mem_deinit();
+
+    printf("  %8s %12s %12s %12s\n", "ops", "live KB", "heap KB", 
+           "compacted");
+    for (k = 0; k < CP_SAMPLES; k++)
+        printf("  %8ld %12.1f %12.1f %12.1f\n", (k + 1) * (n / CP_SAMPLES), 
+               live[k] / 1024.0, heap[0][k] / 1024.0, heap[1][k] / 1024.0);
+    printf("  %8s %12s %12.1f %12.1f ns/op, %.1f MB moved\n", "", "", 
+           secs[0] / n * 1e9, secs[1] / n * 1e9, moved[1] / 1048576.0);
+    free(churn);
+}
+
+/*****************
+ * Helper routines
+ *****************/
+
+/*
+ * now - seconds on the monotonic clock
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * xorshift - a fast pseudo-random sequence, the same on every run
+ */
+static unsigned long xorshift(unsigned long *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(const char *msg)
+{
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    int i;
+
+    fprintf(stderr, "Usage: mbench [-h] [-n <ops>] [<benchmark>...]\n");
+    fprintf(stderr, "Runs the named microbenchmarks, or all of them.\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-n <ops>   Operations per benchmark (default %d).\n",
+            DEFAULT_OPS);
+    fprintf(stderr, "Benchmarks\n");
+    for (i = 0; benches[i].name != NULL; i++)
+        fprintf(stderr, "\t%-10s %s\n", benches[i].name, benches[i].what);
+}
@@ -15,10 +15,22 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <malloc.h>
+#include <sys/wait.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
+#include "locality.h"
+#include "trace.h"
+#include "stream.h"
+#include "idmap.h"
+#include "replay.h"
+#include "mt.h"
+#include "allocator.h"
+#include "memstat.h"
+#include "verify.h"
 #include "config.h"
 
 /**********************
@@ -27,12 +39,25 @@
 
 /* Misc */
 #define MAXLINE     1024 /* max string size */
+#define MAXALLOCS     16 /* max number of packages compared by -A */
+#define LIBC_UTIL_ARG "--libc-util" /* child mode used by eval_libc_util */
+#define WARM_CHECK_ARG "--warm-check" /* child mode used by eval_mm_warm */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
+/* Op latency histogram (-H) */
+#define LAT_BUCKETS   32 /* log2 buckets of cycles: [2^k, 2^(k+1)) */
+#define LAT_RUNS       3 /* each op's latency is its fastest of this many runs */
+
+/* Memory budget (-B) */
+#define BUDGET_SOFT    8 /* soft limit is 1/BUDGET_SOFT of the budget below it */
+
+/* Application touch simulation (-T and -P) */
+#define TOUCH_WINDOW   8 /* number of recent blocks re-read by "recent" */
+
 /****************************** 
  * The key compound data types 
  *****************************/
@@ -44,24 +69,36 @@ typedef struct range_t {
     struct range_t *next;  /* next list element */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef enum {ALLOC, FREE, REALLOC} RequestType;
+/* The latency of single malloc/free/realloc calls on a trace, in cycles */
 typedef struct {
-    RequestType type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
+    double mean;              /* mean over all ops */
+    double p50, p99;          /* median and 99th percentile */
+    double max;               /* slowest op */
+    long hist[LAT_BUCKETS];   /* ops per log2 bucket */
+} latency_t;
 
-/* Holds the information for one trace file*/
+/* How a replay of a trace fared under a memory budget (-B) */
+typedef struct {
+    double ops;      /* number of ops in the trace */
+    long fail_op;    /* first op the allocator couldn't serve, -1 if none */
+    long pressure_op; /* first op the pressure callback ran in, -1 if none */
+    int callbacks;   /* number of calls of the pressure callback */
+    size_t peak;     /* largest heap size (bytes) */
+    size_t trimmed;  /* bytes trimmed off the end of the heap */
+} budget_t;
+
+/* How a trace's state at its peak came back from a heap file (-W) */
 typedef struct {
-    int sugg_heapsize;   /* suggested heap size (unused) */
-    int num_ids;         /* number of alloc/realloc ids */
-    int num_ops;         /* number of distinct requests */
-    int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
-    char **blocks;       /* array of ptrs returned by malloc/realloc... */
-    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
-} trace_t;
+    double ops;      /* ops replayed to build the state */
+    int live;        /* live blocks in it */
+    size_t heap;     /* heap bytes holding it */
+    double rebuild_secs; /* secs to build it by replaying the ops */
+    double reopen_secs;  /* ... and to reopen the heap file holding it */
+    int valid;       /* did it come back intact, and the trace run on? */
+} warm_t;
+
+/* How the simulated application re-reads live payloads after each op */
+typedef enum {TOUCH_NONE, TOUCH_RECENT, TOUCH_RANDOM} TouchPattern;
 
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
@@ -69,8 +106,12 @@ typedef struct {
  * as input.
  */
 typedef struct {
+    allocator_t *alloc; /* package being timed */
     trace_t *trace;  
     range_t *ranges;
+    int touch_bytes;            /* payload bytes written/read per op (0 = off) */
+    TouchPattern touch_pattern; /* re-touch pattern for live payloads */
+    double touch_secs;          /* secs the last run spent touching them */
 } speed_t;
 
 /* Summarizes the important stats for some malloc function on some trace */
@@ -81,7 +122,13 @@ typedef struct {
     double secs;     /* number of secs needed to run the trace */
 
     /* defined only for the student malloc package */
-    double util;     /* space utilization for this trace (always 0 for libc) */
+    double util;     /* space utilization for this trace */
+    double app_secs; /* secs spent touching payloads (only with -T) */
+    locality_t loc;  /* placement locality in the validity pass (only with -L) */
+    memstat_t valid_mem; /* faults and RSS of the validity pass (only with -R) */
+    memstat_t util_mem;  /* ... of the util pass */
+    memstat_t speed_mem; /* ... and of one speed pass */
+    latency_t lat;   /* per-op latency (only with -H) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
@@ -96,41 +143,95 @@ char msg[MAXLINE];      /* for whenever we need to compose an error message */
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
+/* Calls of the pressure callback in the current budget replay */
+static int pressure_calls;
+
+/* Sink for the payload bytes read by the touch simulation */
+volatile uint64_t touch_sink;
+
 /* The filenames of the default tracefiles */
 static const char *default_tracefiles[] = {  
     DEFAULT_TRACEFILES, NULL
 };
 
+/* The filenames of the default tracefiles for the threaded replay */
+static const char *default_mt_tracefiles[] = {  
+    DEFAULT_MT_TRACEFILES, NULL
+};
+
 
 /********************* 
  * Function prototypes 
  *********************/
 
 /* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
-		     int tracenum, int opnum);
+static int add_range(allocator_t *alloc, range_t **ranges, char *lo, 
+		     int size, int tracenum, long opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
 
-/* These functions read, allocate, and free storage for traces */
-static trace_t *read_trace(char *tracedir, char *filename);
-static void free_trace(trace_t *trace);
-
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
 static void eval_libc_speed(void *ptr);
+static double eval_libc_util(char *filename, int tracenum);
+static double libc_util(trace_t *trace);
+static size_t libc_footprint(void);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
-   of the student's malloc package in mm.c */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+   of the student's malloc package in mm.c, or any other allocator_t */
+static int eval_mm_valid(allocator_t *alloc, trace_t *trace, int tracenum, 
+			 range_t **ranges, locality_t *loc);
+static double eval_mm_util(allocator_t *alloc, trace_t *trace, int tracenum, 
+			   range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(allocator_t *alloc, trace_t *trace, 
+			    latency_t *lat);
+static int cmp_double(const void *a, const void *b);
+static int eval_mm_budget(trace_t *trace, int tracenum, size_t soft, 
+			  budget_t *b);
+static void on_pressure(size_t heapsize);
+static int eval_mm_warm(trace_t *trace, char *filename, int tracenum, 
+			char *heapfile, warm_t *w);
+static int warm_child(char *filename, char *heapfile, long peak);
+static int warm_check(trace_t *trace, char *heapfile, long peak);
+static int replay_op(trace_t *trace, long i, char **blocks);
+static double wall_secs(void);
+
+/* Streaming versions of the mm routines, for traces too big for memory */
+static int eval_mm_valid_stream(allocator_t *alloc, char *tracedir, 
+				char *filename, int tracenum,
+				range_t **ranges, locality_t *loc, 
+				trace_t *header);
+static double eval_mm_util_stream(allocator_t *alloc, char *tracedir, 
+				  char *filename);
+static double eval_mm_speed_stream(allocator_t *alloc, char *tracedir, 
+				   char *filename);
+
+/* Routines that simulate the application touching its payloads */
+static void touch_payload(char *p, int size, int bytes);
+static void retouch_payloads(speed_t *params, unsigned *seed, 
+			     int *recent, int nrecent);
 
 /* Various helper routines */
-static void printresults(int n, stats_t *stats);
+static void printresults(int n, stats_t *stats, int show_app);
+static void printlocality(int n, stats_t *stats);
+static void start_memstat(memsnap_t *snap);
+static void printmemstat(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printreplay(int n, replay_stats_t *stats);
+static void printcached(int n, replay_stats_t *stats);
+static void printlocks(int n, replay_stats_t *stats);
+static void printlines(int n, replay_stats_t *stats);
+static void printreplaylat(int n, replay_stats_t *stats);
+static void printfreeq(int n, replay_stats_t *stats);
+static void printzero(int n, replay_stats_t *stats);
+static void printbudget(int n, budget_t *plain, budget_t *tight);
+static void printwarm(int n, warm_t *warm);
+static void printcompare(int n, int nalloc, allocator_t **allocs, 
+			 stats_t *stats);
 static void usage(void);
 static void unix_error(const char *msg);
-static void malloc_error(int tracenum, int opnum, const char *msg);
+static void malloc_error(int tracenum, long opnum, const char *msg);
 static void app_error(const char *msg);
 
 /**************
@@ -151,6 +252,33 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int touch_bytes = 0; /* Payload bytes touched per op (set by -T) */
+    TouchPattern touch_pattern = TOUCH_NONE; /* Re-touch pattern (-P) */
+    int locality = 0;    /* If set, measure placement locality (-L) */
+    int memstats = 0;    /* If set, count page faults and RSS (-R) */
+    int latency = 0;     /* If set, histogram the latency of each op (-H) */
+    memsnap_t snap;      /* process counters at the start of a pass */
+    int streaming = 0;   /* If set, stream traces instead of loading them (-s) */
+    trace_t header;      /* header of a streamed trace */
+    int threaded = 0;    /* If set, replay traces on many threads (-x) */
+    int timed = 0;       /* If set, the threaded replay honors timestamps */
+    int lockstats = 0;   /* If set, count heap lock contention (-k) */
+    int runs = 0;        /* If set, small blocks come from owned runs (-r) */
+    int sharing = 0;     /* If set, count cache lines threads share (-F) */
+    int offload = 0;     /* If set, a thread does the frees in -x (-O) */
+    int prezero = 0;     /* If set, a thread zeroes free blocks in -x (-Z) */
+    LockKind lockkind = LOCK_MUTEX; /* kind of heap lock (-M) */
+    replay_stats_t *replay_stats = NULL; /* threaded replay stats per trace */
+    size_t budget = 0;   /* If set, replay traces under this many bytes (-B) */
+    budget_t *plain_budget = NULL; /* budget replay with no soft limit */
+    budget_t *tight_budget = NULL; /* ... and with one, per trace */
+    char *heapfile = NULL; /* If set, restart traces from this file (-W) */
+    warm_t *warm = NULL;   /* warm restart stats per trace */
+    allocator_t *allocs[MAXALLOCS]; /* packages to compare (set by -A) */
+    int nalloc = 0;      /* number of packages to compare */
+    stats_t *cmp_stats = NULL; /* stats per package, then per trace */
+    char *name;
+    int a;
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -159,7 +287,26 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    /* 
+     * In the child started by eval_libc_util, just measure libc's
+     * utilization on the one trace and print it
+     */
+    if (argc == 3 && !strcmp(argv[1], LIBC_UTIL_ARG)) {
+	trace = read_trace("", argv[2]);
+	printf("%.17g\n", libc_util(trace));
+	exit(0);
+    }
+
+    /*
+     * In the child started by eval_mm_warm, just reopen the heap file
+     * and count the live payloads that came back intact
+     */
+    if (argc == 5 && !strcmp(argv[1], WARM_CHECK_ARG)) {
+	trace = read_trace("", argv[3]);
+	exit(warm_check(trace, argv[2], atol(argv[4])));
+    }
+
+    while ((c = getopt(argc, argv, "f:t:hvVgaklrFOZLRHsT:P:x:A:B:C:S:M:W:")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -183,9 +330,119 @@ int main(int argc, char **argv)
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
+        case 'k': /* Count heap lock contention in the threaded replay */
+            lockstats = 1;
+            mt_set_lockstat(1);
+            break;
+        case 'r': /* Serve small blocks from thread-owned runs in -x */
+            runs = 1;
+            mt_set_runs(1);
+            break;
+        case 'F': /* Count cache lines shared between threads in -x */
+            sharing = 1;
+            break;
+        case 'O': /* Offload frees to a background thread in -x */
+            offload = 1;
+            mt_set_offload(1);
+            break;
+        case 'Z': /* Zero free blocks ahead in a background thread in -x */
+            prezero = 1;
+            mt_set_prezero(1);
+            break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 's': /* Stream the mm traces in chunks */
+            streaming = 1;
+            break;
+        case 'A': /* Compare the named packages */
+            for (name = strtok(optarg, ","); name != NULL; 
+                 name = strtok(NULL, ",")) {
+                if (nalloc == MAXALLOCS || 
+                    (allocs[nalloc++] = find_allocator(name)) == NULL) {
+                    fprintf(stderr, "Unknown or too many packages: %s\n", name);
+                    usage();
+                    exit(1);
+                }
+            }
+            break;
+        case 'x': /* Replay each trace with one thread per thread id */
+            threaded = 1;
+            if (!strcmp(optarg, "fast"))
+                timed = 0;
+            else if (!strcmp(optarg, "timed"))
+                timed = 1;
+            else {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'B': /* Replay each trace under a memory budget */
+            if (atoi(optarg) <= 0) {
+                usage();
+                exit(1);
+            }
+            budget = (size_t)atoi(optarg) * 1024;
+            break;
+        case 'W': /* Restart each trace at its peak from a heap file */
+            heapfile = optarg;
+            break;
+        case 'C': /* Cache small free blocks in the threaded replay */
+            if (!strcmp(optarg, "none"))
+                mt_set_cache(CACHE_NONE);
+            else if (!strcmp(optarg, "thread"))
+                mt_set_cache(CACHE_THREAD);
+            else if (!strcmp(optarg, "cpu"))
+                mt_set_cache(CACHE_CPU);
+            else {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'M': /* Kind of heap lock in the threaded replay */
+            if (!strcmp(optarg, "mutex"))
+                lockkind = LOCK_MUTEX;
+            else if (!strcmp(optarg, "adaptive"))
+                lockkind = LOCK_ADAPTIVE;
+            else if (!strcmp(optarg, "ticket"))
+                lockkind = LOCK_TICKET;
+            else {
+                usage();
+                exit(1);
+            }
+            mt_set_lock(lockkind);
+            break;
+        case 'S': /* Scavenge idle thread caches in the threaded replay */
+            mt_set_scavenge(atoi(optarg));
+            break;
+        case 'L': /* Measure the locality of block placement */
+            locality = 1;
+            break;
+        case 'H': /* Histogram the latency of single ops */
+            latency = 1;
+            break;
+        case 'R': /* Count page faults and RSS in the util and speed passes */
+            memstats = 1;
+            break;
+        case 'T': /* Touch this many payload bytes per op in the speed pass */
+            touch_bytes = atoi(optarg);
+            if (touch_bytes < 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'P': /* Re-touch pattern for live payloads */
+            if (!strcmp(optarg, "none"))
+                touch_pattern = TOUCH_NONE;
+            else if (!strcmp(optarg, "recent"))
+                touch_pattern = TOUCH_RECENT;
+            else if (!strcmp(optarg, "random"))
+                touch_pattern = TOUCH_RANDOM;
+            else {
+                usage();
+                exit(1);
+            }
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -200,6 +457,13 @@ int main(int argc, char **argv)
             exit(1);
         }
     }
+
+    /* Streamed traces are not held in memory, so -s has no payloads to touch */
+    if (streaming && touch_bytes > 0) {
+	fprintf(stderr, "-T can't be used with -s\n");
+	usage();
+	exit(1);
+    }
 	
     /* 
      * Check and print team info 
@@ -231,6 +495,11 @@ int main(int argc, char **argv)
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
      */
+    if (tracefiles == NULL && threaded) {
+        tracefiles = (char **) default_mt_tracefiles;
+        num_tracefiles = sizeof(default_mt_tracefiles) / sizeof(char *) - 1;
+	printf("Using default threaded tracefiles in %s\n", tracedir);
+    }
     if (tracefiles == NULL) {
       tracefiles = (char **) default_tracefiles;
         num_tracefiles = sizeof(default_tracefiles) / sizeof(char *) - 1;
@@ -240,6 +509,198 @@ int main(int argc, char **argv)
     /* Initialize the timing package */
     init_fsecs();
 
+    /*
+     * With -B, replaying each trace under the budget, first with no
+     * soft limit and then with one, takes the place of the usual
+     * evaluation of the mm package
+     */
+    if (budget > 0) {
+	plain_budget = (budget_t *)calloc(num_tracefiles, sizeof(budget_t));
+	tight_budget = (budget_t *)calloc(num_tracefiles, sizeof(budget_t));
+	if (plain_budget == NULL || tight_budget == NULL)
+	    unix_error("budget_t calloc in main failed");
+	mem_init();
+	mem_set_limit(budget);
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    if (!eval_mm_budget(trace, i, 0, &plain_budget[i]))
+		errors++;
+	    if (!eval_mm_budget(trace, i, budget - budget / BUDGET_SOFT, 
+				&tight_budget[i]))
+		errors++;
+	    free_trace(trace);
+	}
+	mem_set_limit(0);
+	printf("\nResults under a budget of %lu KB, without and with a soft "
+	       "limit of %lu KB:\n", (unsigned long)budget / 1024, 
+	       (unsigned long)(budget - budget / BUDGET_SOFT) / 1024);
+	printbudget(num_tracefiles, plain_budget, tight_budget);
+	if (errors)
+	    printf("Terminated with %d errors\n", errors);
+	exit(errors != 0);
+    }
+
+    /*
+     * With -W, restarting each trace from a heap file takes the place
+     * of the usual evaluation of the mm package
+     */
+    if (heapfile != NULL) {
+	if ((warm = (warm_t *)calloc(num_tracefiles, sizeof(warm_t))) == NULL)
+	    unix_error("warm_t calloc in main failed");
+	mem_init_file(heapfile);
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    if (!eval_mm_warm(trace, tracefiles[i], i, heapfile, &warm[i]))
+		errors++;
+	    free_trace(trace);
+	}
+	mem_deinit();
+	printf("\nResults for restarts at each trace's peak from %s:\n", 
+	       heapfile);
+	printwarm(num_tracefiles, warm);
+	if (errors)
+	    printf("Terminated with %d errors\n", errors);
+	exit(errors != 0);
+    }
+
+    /*
+     * With -x, the threaded replay takes the place of the usual
+     * evaluation of the mm package
+     */
+    if (threaded) {
+	replay_stats = (replay_stats_t *)calloc(num_tracefiles, 
+						 sizeof(replay_stats_t));
+	if (replay_stats == NULL)
+	    unix_error("replay_stats calloc in main failed");
+	mem_init();
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    if (verbose > 1)
+		printf("Replaying on %d threads.\n", trace->num_threads);
+	    mem_reset_brk();
+	    if (!replay_trace(trace, i, timed, sharing, latency,
+			      &replay_stats[i]))
+		errors++;
+	    free_trace(trace);
+	}
+	printf("\nResults for threaded mm replay (%s, %s caches, %s lock%s%s%s):\n", 
+	       timed ? "timed" : "fast", 
+	       cache_mode() == CACHE_NONE ? "no" : cache_mode_name(cache_mode()),
+	       lock_kind_name(lockkind), runs ? ", owned runs" : "",
+	       offload ? ", offloaded frees" : "",
+	       prezero ? ", pre-zeroing" : "");
+	printreplay(num_tracefiles, replay_stats);
+	if (lockstats) {
+	    printf("\nHeap lock contention per arena (cycles):\n");
+	    printlocks(num_tracefiles, replay_stats);
+	}
+	if (cache_mode() != CACHE_NONE) {
+	    printf("\nBytes held in caches over the replay (KB):\n");
+	    printcached(num_tracefiles, replay_stats);
+	}
+	if (sharing) {
+	    printf("\nCache lines shared between threads:\n");
+	    printlines(num_tracefiles, replay_stats);
+	}
+	if (latency) {
+	    printf("\nLatency of the mt_ calls of each op (cycles):\n");
+	    printreplaylat(num_tracefiles, replay_stats);
+	}
+	if (offload) {
+	    printf("\nBlocks through the free queue:\n");
+	    printfreeq(num_tracefiles, replay_stats);
+	}
+	if (prezero) {
+	    printf("\nBytes zeroed for calloc (KB):\n");
+	    printzero(num_tracefiles, replay_stats);
+	}
+	if (errors)
+	    printf("Terminated with %d errors\n", errors);
+	exit(errors != 0);
+    }
+
+    /*
+     * With -A, evaluate each of the named packages on every trace in
+     * exactly the same way, and print them side by side
+     */
+    if (nalloc > 0) {
+	cmp_stats = (stats_t *)calloc(nalloc * num_tracefiles, sizeof(stats_t));
+	if (cmp_stats == NULL)
+	    unix_error("cmp_stats calloc in main failed");
+	mem_init();
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    for (a = 0; a < nalloc; a++) {
+		stats_t *st = &cmp_stats[a * num_tracefiles + i];
+
+		if (verbose > 1)
+		    printf("Checking %s for correctness, ", allocs[a]->name);
+		st->ops = trace->num_ops;
+		if (memstats)
+		    start_memstat(&snap);
+		st->valid = eval_mm_valid(allocs[a], trace, i, &ranges, 
+					  locality ? &st->loc : NULL);
+		if (memstats)
+		    memstat_stop(&snap, &st->valid_mem);
+		if (st->valid) {
+		    if (verbose > 1)
+			printf("efficiency, and performance.\n");
+		    if (memstats)
+			start_memstat(&snap);
+		    if (allocs[a] == &libc_allocator)
+			st->util = eval_libc_util(tracefiles[i], i);
+		    else
+			st->util = eval_mm_util(allocs[a], trace, i, &ranges);
+		    if (memstats)
+			memstat_stop(&snap, &st->util_mem);
+		    speed_params.alloc = allocs[a];
+		    speed_params.trace = trace;
+		    speed_params.ranges = ranges;
+		    speed_params.touch_bytes = 0;
+		    speed_params.touch_pattern = TOUCH_NONE;
+		    st->secs = fsecs(eval_mm_speed, &speed_params);
+		    if (memstats) {
+			start_memstat(&snap);
+			eval_mm_speed(&speed_params);
+			memstat_stop(&snap, &st->speed_mem);
+		    }
+		    if (latency)
+			eval_mm_latency(allocs[a], trace, &st->lat);
+		    if (touch_bytes > 0) {
+			speed_params.touch_bytes = touch_bytes;
+			speed_params.touch_pattern = touch_pattern;
+			speed_params.touch_secs = 0;
+			fsecs(eval_mm_speed, &speed_params);
+			st->app_secs = speed_params.touch_secs;
+		    }
+		}
+	    }
+	    free_trace(trace);
+	}
+	printf("\nComparison of packages (util and Kops):\n");
+	printcompare(num_tracefiles, nalloc, allocs, cmp_stats);
+	for (a = 0; locality && a < nalloc; a++) {
+	    printf("\nLocality for %s:\n", allocs[a]->name);
+	    printlocality(num_tracefiles, &cmp_stats[a * num_tracefiles]);
+	}
+	for (a = 0; latency && a < nalloc; a++) {
+	    printf("\nOp latency for %s (cycles):\n", allocs[a]->name);
+	    printlatency(num_tracefiles, &cmp_stats[a * num_tracefiles]);
+	}
+	for (a = 0; touch_bytes > 0 && a < nalloc; a++) {
+	    printf("\nResults for %s with payload touches:\n", 
+		   allocs[a]->name);
+	    printresults(num_tracefiles, &cmp_stats[a * num_tracefiles], 1);
+	}
+	for (a = 0; memstats && a < nalloc; a++) {
+	    printf("\nPage faults and RSS for %s:\n", allocs[a]->name);
+	    printmemstat(num_tracefiles, &cmp_stats[a * num_tracefiles]);
+	}
+	if (errors)
+	    printf("Terminated with %d errors\n", errors);
+	exit(errors != 0);
+    }
+
     /*
      * Optionally run and evaluate the libc malloc package 
      */
@@ -260,9 +721,10 @@ int main(int argc, char **argv)
 		printf("Checking libc malloc for correctness, ");
 	    libc_stats[i].valid = eval_libc_valid(trace, i);
 	    if (libc_stats[i].valid) {
-		speed_params.trace = trace;
 		if (verbose > 1)
-		    printf("and performance.\n");
+		    printf("efficiency, and performance.\n");
+		libc_stats[i].util = eval_libc_util(tracefiles[i], i);
+		speed_params.trace = trace;
 		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
 	    }
 	    free_trace(trace);
@@ -271,7 +733,7 @@ int main(int argc, char **argv)
 	/* Display the libc results in a compact table */
 	if (verbose) {
 	    printf("\nResults for libc malloc:\n");
-	    printresults(num_tracefiles, libc_stats);
+	    printresults(num_tracefiles, libc_stats, 0);
 	}
     }
 
@@ -288,23 +750,94 @@ int main(int argc, char **argv)
     
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
+    if (verbose > 1)
+	printf("Checking realloc'd data with %s compares\n", verify_impl());
 
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
+    for (i=0; i < num_tracefiles && streaming; i++) {
+	if (verbose > 1)
+	    printf("Streaming mm_malloc for correctness, ");
+	if (memstats)
+	    start_memstat(&snap);
+	mm_stats[i].valid = eval_mm_valid_stream(&mm_allocator, tracedir, 
+						 tracefiles[i], i, 
+						 &ranges, locality ? 
+						 &mm_stats[i].loc : NULL, 
+						 &header);
+	if (memstats)
+	    memstat_stop(&snap, &mm_stats[i].valid_mem);
+	mm_stats[i].ops = header.num_ops;
+	if (mm_stats[i].valid) {
+	    if (verbose > 1)
+		printf("efficiency, ");
+	    if (memstats)
+		start_memstat(&snap);
+	    mm_stats[i].util = eval_mm_util_stream(&mm_allocator, tracedir, 
+						   tracefiles[i]);
+	    if (memstats)
+		memstat_stop(&snap, &mm_stats[i].util_mem);
+	    if (verbose > 1)
+		printf("and performance.\n");
+	    if (memstats)
+		start_memstat(&snap);
+	    mm_stats[i].secs = eval_mm_speed_stream(&mm_allocator, tracedir, 
+						    tracefiles[i]);
+	    if (memstats)
+		memstat_stop(&snap, &mm_stats[i].speed_mem);
+	}
+    }
+    for (i=0; i < num_tracefiles && !streaming; i++) {
 	trace = read_trace(tracedir, tracefiles[i]);
 	mm_stats[i].ops = trace->num_ops;
 	if (verbose > 1)
 	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
+	if (memstats)
+	    start_memstat(&snap);
+	mm_stats[i].valid = eval_mm_valid(&mm_allocator, trace, i, &ranges, 
+					  locality ? &mm_stats[i].loc : NULL);
+	if (memstats)
+	    memstat_stop(&snap, &mm_stats[i].valid_mem);
 	if (mm_stats[i].valid) {
 	    if (verbose > 1)
 		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+	    if (memstats)
+		start_memstat(&snap);
+	    mm_stats[i].util = eval_mm_util(&mm_allocator, trace, i, &ranges);
+	    if (memstats)
+		memstat_stop(&snap, &mm_stats[i].util_mem);
+	    speed_params.alloc = &mm_allocator;
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
+	    speed_params.touch_bytes = 0;
+	    speed_params.touch_pattern = TOUCH_NONE;
 	    if (verbose > 1)
 		printf("and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+
+	    /* 
+	     * fsecs runs the trace an unknown number of times, so with
+	     * -R the faults and RSS come from one more, untimed run
+	     */
+	    if (memstats) {
+		start_memstat(&snap);
+		eval_mm_speed(&speed_params);
+		memstat_stop(&snap, &mm_stats[i].speed_mem);
+	    }
+	    if (latency)
+		eval_mm_latency(&mm_allocator, trace, &mm_stats[i].lat);
+
+	    /* 
+	     * With -T, replay again while touching the payloads. The 
+	     * application's share is the time the last of those runs
+	     * spent in its touch loops.
+	     */
+	    if (touch_bytes > 0) {
+		speed_params.touch_bytes = touch_bytes;
+		speed_params.touch_pattern = touch_pattern;
+		speed_params.touch_secs = 0;
+		fsecs(eval_mm_speed, &speed_params);
+		mm_stats[i].app_secs = speed_params.touch_secs;
+	    }
 	}
 	free_trace(trace);
     }
@@ -312,7 +845,28 @@ int main(int argc, char **argv)
     /* Display the mm results in a compact table */
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
-	printresults(num_tracefiles, mm_stats);
+	printresults(num_tracefiles, mm_stats, touch_bytes > 0);
+	printf("\n");
+    }
+
+    /* Display the locality metrics, which -L asks for explicitly */
+    if (locality) {
+	printf("Locality for mm malloc:\n");
+	printlocality(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the op latencies, which -H asks for */
+    if (latency && !streaming) {
+	printf("Op latency for mm malloc (cycles):\n");
+	printlatency(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the page faults and RSS growth, which -R asks for */
+    if (memstats) {
+	printf("Page faults and RSS for mm malloc:\n");
+	printmemstat(num_tracefiles, mm_stats);
 	printf("\n");
     }
 
@@ -380,8 +934,8 @@ int main(int argc, char **argv)
  *     size bytes at addr lo. After checking the block for correctness,
  *     we create a range struct for this block and add it to the range list. 
  */
-static int add_range(range_t **ranges, char *lo, int size, 
-		     int tracenum, int opnum)
+static int add_range(allocator_t *alloc, range_t **ranges, char *lo, 
+		     int size, int tracenum, long opnum)
 {
     char *hi = lo + size - 1;
     range_t *p;
@@ -397,9 +951,10 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, if we know it */
+    if (alloc->in_memlib && 
+	((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi()))) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
@@ -465,149 +1020,40 @@ static void clear_ranges(range_t **ranges)
 }
 
 
-/**********************************************
- * The following routines manipulate tracefiles
- *********************************************/
-
-/*
- * read_trace - read a trace file and store it in memory
- */
-static trace_t *read_trace(char *tracedir, char *filename)
-{
-    FILE *tracefile;
-    trace_t *trace;
-    char type[MAXLINE];
-    char path[MAXLINE];
-    int index, size;
-    int max_index = 0;
-    int op_index;
-
-    if (verbose > 1)
-	printf("Reading tracefile: %s\n", filename);
-
-    /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-	unix_error("malloc 1 failed in read_trance");
-	
-    /* Read the trace file header */
-    strcpy(path, tracedir);
-    strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
-    }
-    if (1 != fscanf(tracefile, "%d", &(trace->sugg_heapsize)) ) {
-      unix_error("fscanf of heapsize\n");
-    }
-    if (1 != fscanf(tracefile, "%d", &(trace->num_ids)) ) {
-      unix_error("fscanf of num_ids");
-    }
-    if (1 != fscanf(tracefile, "%d", &(trace->num_ops)) ) {
-      unix_error("fscanf of num_ops");
-    }
-    if (1 != fscanf(tracefile, "%d", &(trace->weight)) ) {
-      unix_error("fscan of weight");
-    }
-    
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
-
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
-    
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	  if ( 2 != fscanf(tracefile, "%u %u", &index, &size) ) {
-	    unix_error("fscanf of allocation");
-	  } 
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'r':
-	  if ( 2 != fscanf(tracefile, "%u %u", &index, &size) ) {
-	    unix_error("fscanf of relloc");
-	  } 
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'f':
-	  if ( 1 != fscanf(tracefile, "%ud", &index) ) {
-	    unix_error("fscanf of free\n");
-	  }
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
-	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
-	    exit(1);
-	}
-	op_index++;
-	
-    }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-    
-    return trace;
-}
-
-/*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
- */
-void free_trace(trace_t *trace)
-{
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);      
-    free(trace->block_sizes);
-    free(trace);              /* and the trace record itself... */
-}
-
 /**********************************************************************
  * The following functions evaluate the correctness, space utilization,
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
 /*
- * eval_mm_valid - Check the mm malloc package for correctness
+ * eval_mm_valid - Check the mm malloc package for correctness. If loc
+ *     is not NULL, also measure the locality of the blocks' placement.
  */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
+static int eval_mm_valid(allocator_t *alloc, trace_t *trace, int tracenum, 
+			 range_t **ranges, locality_t *loc) 
 {
-    int i, j;
+    long i;
     int index;
     int size;
     int oldsize;
+    long bad;     /* offset of the first byte realloc lost */
     char *newp;
     char *oldp;
     char *p;
     
     /* Reset the heap and free any records in the range list */
-    mem_reset_brk();
+    alloc->reset();
     clear_ranges(ranges);
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (alloc->init() < 0) {
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
+    if (!alloc->in_memlib)
+	loc = NULL;
+    if (loc)
+	loc_reset(mem_heap_lo(), MAX_HEAP, trace->num_ops);
 
     /* Interpret each operation in the trace in order */
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -619,7 +1065,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	  if ((p = (char*) mm_malloc(size)) == NULL) {
+	  if ((p = (char*) alloc->malloc(size)) == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
@@ -629,8 +1075,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	     * to the range list if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
-	    if (add_range(ranges, p, size, tracenum, i) == 0)
+	    if (add_range(alloc, ranges, p, size, tracenum, i) == 0)
 		return 0;
+	    if (loc)
+		loc_alloc(p, size);
 	    
 	    /* ADDED: cgw
 	     * fill range with low byte of index.  This will be used later
@@ -648,7 +1096,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
-	    if ((newp = (char *) mm_realloc(oldp, size)) == NULL) {
+	    if ((newp = (char *) alloc->realloc(oldp, size)) == NULL) {
 		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
@@ -657,8 +1105,12 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    remove_range(ranges, oldp);
 	    
 	    /* Check new block for correctness and add it to range list */
-	    if (add_range(ranges, newp, size, tracenum, i) == 0)
+	    if (add_range(alloc, ranges, newp, size, tracenum, i) == 0)
 		return 0;
+	    if (loc) {
+		loc_free(oldp, trace->block_sizes[index]);
+		loc_alloc(newp, size);
+	    }
 	    
 	    /* ADDED: cgw
 	     * Make sure that the new block contains the data from the old 
@@ -667,12 +1119,12 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	     */
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
-	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
-		malloc_error(tracenum, i, "mm_realloc did not preserve the "
-			     "data from old block");
+	    if ((bad = verify_fill(newp, index & 0xFF, oldsize)) >= 0) {
+		sprintf(msg, "mm_realloc did not preserve the data from old "
+			"block (first bad byte at offset %ld of %d)", 
+			bad, oldsize);
+		malloc_error(tracenum, i, msg);
 		return 0;
-	      }
 	    }
 	    memset(newp, index & 0xFF, size);
 
@@ -686,16 +1138,22 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    if (loc)
+		loc_free(p, trace->block_sizes[index]);
+	    alloc->free(p);
 	    break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+	if (loc)
+	    loc_sample();
     }
 
     /* As far as we know, this is a valid malloc package */
+    if (loc)
+	loc_summary(loc);
     return 1;
 }
 
@@ -710,9 +1168,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   is always the high water mark of the heap. 
  *   
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(allocator_t *alloc, trace_t *trace, int tracenum, 
+			   range_t **ranges)
 {   
-    int i;
+    long i;
     int index;
     int size, newsize, oldsize;
     int max_total_size = 0;
@@ -721,8 +1180,8 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     char *newp, *oldp;
 
     /* initialize the heap and the mm malloc package */
-    mem_reset_brk();
-    if (mm_init() < 0)
+    alloc->reset();
+    if (alloc->init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -732,7 +1191,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = (char *) mm_malloc(size)) == NULL) 
+	    if ((p = (char *) alloc->malloc(size)) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -754,7 +1213,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = (char *) mm_realloc(oldp,newsize)) == NULL)
+	    if ((newp = (char *) alloc->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
 	    /* Remember region and size */
@@ -775,7 +1234,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    alloc->free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -789,140 +1248,1048 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    if (alloc->heapsize() == 0)
+	return 0;
+    return ((double)max_total_size / (double)alloc->heapsize());
 }
 
 
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
- *    to measure the running time of the mm malloc package.
+ *    to measure the running time of the mm malloc package. If
+ *    touch_bytes is set, it also plays the part of the application,
+ *    writing and reading each new payload and re-reading live ones.
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
+    long i;
+    int index, size, newsize;
     char *p, *newp, *oldp, *block;
-    trace_t *trace = ((speed_t *)ptr)->trace;
+    speed_t *params = (speed_t *)ptr;
+    allocator_t *alloc = params->alloc;
+    trace_t *trace = params->trace;
+    int touch = params->touch_bytes > 0;
+    int recent[TOUCH_WINDOW];   /* ring of recently allocated ids */
+    int nrecent = 0;
+    unsigned seed = 1;          /* same random re-touches on every run */
+    unsigned long long c0 = 0, c, touch_cycles = 0;
+    double w0 = 0;
 
     /* Reset the heap and initialize the mm package */
-    mem_reset_brk();
-    if (mm_init() < 0) 
+    alloc->reset();
+    if (alloc->init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
+    /* 
+     * Count the cycles in the touch loops, and turn them into secs
+     * by the run's cycles per sec of wall time
+     */
+    if (touch) {
+	w0 = wall_secs();
+	c0 = read_counter();
+    }
+
+    /* Forget the blocks of earlier runs so only live ids get re-touched */
+    if (touch)
+	memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
+    for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = (char *) mm_malloc(size)) == NULL)
+            if ((p = (char *) alloc->malloc(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
+	    if (touch) {
+		trace->block_sizes[index] = size;
+		c = read_counter();
+		touch_payload(p, size, params->touch_bytes);
+		touch_cycles += read_counter() - c;
+		recent[nrecent++ % TOUCH_WINDOW] = index;
+	    }
             break;
 
 	case REALLOC: /* mm_realloc */
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = (char *) mm_realloc(oldp,newsize)) == NULL)
+            if ((newp = (char *) alloc->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
+	    if (touch) {
+		trace->block_sizes[index] = newsize;
+		c = read_counter();
+		touch_payload(newp, newsize, params->touch_bytes);
+		touch_cycles += read_counter() - c;
+		recent[nrecent++ % TOUCH_WINDOW] = index;
+	    }
             break;
 
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            alloc->free(block);
+	    if (touch)
+		trace->blocks[index] = NULL;
             break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
+
+	if (touch && params->touch_pattern != TOUCH_NONE) {
+	    c = read_counter();
+	    retouch_payloads(params, &seed, recent, 
+			     nrecent < TOUCH_WINDOW ? nrecent : TOUCH_WINDOW);
+	    touch_cycles += read_counter() - c;
+	}
+    }
+    if (touch && (c = read_counter() - c0) > 0)
+	params->touch_secs = (wall_secs() - w0) * touch_cycles / c;
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * eval_mm_latency - Time each malloc, free and realloc of a trace on its
+ *    own with the cycle counter. The trace is replayed LAT_RUNS times
+ *    and each op keeps its fastest time, so that a timer interrupt or
+ *    a cold cache during one op doesn't pass for the allocator's worst
+ *    case. The times include the counter's own overhead.
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static void eval_mm_latency(allocator_t *alloc, trace_t *trace, 
+			    latency_t *lat)
 {
-    int i, newsize;
-    char *p, *newp, *oldp;
+    long i;
+    int r, k, index;
+    double c, sum = 0;
+    double *best;
+    void *p;
+
+    if ((best = (double *)malloc(trace->num_ops * sizeof(double))) == NULL)
+	unix_error("malloc failed in eval_mm_latency");
+    for (i = 0; i < trace->num_ops; i++)
+	best[i] = DBL_MAX;
+
+    for (r = 0; r < LAT_RUNS; r++) {
+	alloc->reset();
+	if (alloc->init() < 0)
+	    app_error("mm_init failed in eval_mm_latency");
+	for (i = 0; i < trace->num_ops; i++) {
+	    index = trace->ops[i].index;
+	    switch (trace->ops[i].type) {
+	    case ALLOC:
+		start_counter();
+		p = alloc->malloc(trace->ops[i].size);
+		c = get_counter();
+		if (p == NULL)
+		    app_error("mm_malloc error in eval_mm_latency");
+		trace->blocks[index] = p;
+		break;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+	    case REALLOC:
+		start_counter();
+		p = alloc->realloc(trace->blocks[index], trace->ops[i].size);
+		c = get_counter();
+		if (p == NULL)
+		    app_error("mm_realloc error in eval_mm_latency");
+		trace->blocks[index] = p;
+		break;
 
-        case ALLOC: /* malloc */
-	  if ((p = (char *) malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
-		unix_error("System message");
-	    }
-	    trace->blocks[trace->ops[i].index] = p;
-	    break;
+	    case FREE:
+		p = trace->blocks[index];
+		start_counter();
+		alloc->free(p);
+		c = get_counter();
+		break;
 
-	case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[trace->ops[i].index];
-	    if ((newp = (char *) realloc(oldp, newsize)) == NULL) {
-		malloc_error(tracenum, i, "libc realloc failed");
-		unix_error("System message");
+	    default:
+		app_error("Nonexistent request type in eval_mm_latency");
+		c = 0;
 	    }
-	    trace->blocks[trace->ops[i].index] = newp;
-	    break;
-	    
-        case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
-	    break;
-
-	default:
-	    app_error("invalid operation type  in eval_libc_valid");
+	    if (c < best[i])
+		best[i] = c;
 	}
     }
 
-    return 1;
+    memset(lat, 0, sizeof(*lat));
+    for (i = 0; i < trace->num_ops; i++) {
+	sum += best[i];
+	for (k = 0; k < LAT_BUCKETS - 1 && best[i] >= (2UL << k); k++)
+	    ;
+	lat->hist[k]++;
+    }
+    qsort(best, trace->num_ops, sizeof(double), cmp_double);
+    if (trace->num_ops > 0) {
+	lat->mean = sum / trace->num_ops;
+	lat->p50 = best[trace->num_ops / 2];
+	lat->p99 = best[(long)(trace->num_ops * 0.99)];
+	lat->max = best[trace->num_ops - 1];
+    }
+    free(best);
 }
 
-/* 
- * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
- *    of traces.
+/*
+ * eval_mm_budget - Replay a trace on mm.c under the memlib budget until
+ *    an op fails, with the heap put under pressure past soft bytes if
+ *    soft is nonzero, and record when it failed and how the heap fared.
+ *    Zero-byte requests get no block, which isn't a failure. Payloads
+ *    are filled and checked as in eval_mm_valid, and the heap checked
+ *    at the end, since trimming mustn't cost any of them. Returns 0 if
+ *    a payload was lost.
  */
-static void eval_libc_speed(void *ptr)
+static int eval_mm_budget(trace_t *trace, int tracenum, size_t soft, 
+			  budget_t *b)
 {
-    int i;
-    int index, size, newsize;
-    char *p, *newp, *oldp, *block;
-    trace_t *trace = ((speed_t *)ptr)->trace;
+    long i;
+    int index;
+    int size;
+    int oldsize;
+    long bad;     /* offset of the first byte realloc lost */
+    char *p;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
-        case ALLOC: /* malloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-	    if ((p = (char *) malloc(size)) == NULL)
-		unix_error("malloc failed in eval_libc_speed");
-	    trace->blocks[index] = p;
+    memset(b, 0, sizeof(*b));
+    b->ops = trace->num_ops;
+    b->fail_op = b->pressure_op = -1;
+    pressure_calls = 0;
+    mem_reset_brk();
+    mm_set_soft_limit(soft, soft ? on_pressure : NULL);
+    if (mm_init() < 0) {
+	b->fail_op = 0;
+	mm_set_soft_limit(0, NULL);
+	return 1;
+    }
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    p = mm_malloc(size);
 	    break;
 
-	case REALLOC: /* realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
-	    oldp = trace->blocks[index];
-	    if ((newp = (char *) realloc(oldp, newsize)) == NULL)
-		unix_error("realloc failed in eval_libc_speed\n");
-	    
-	    trace->blocks[index] = newp;
+	case REALLOC:
+	    p = mm_realloc(trace->blocks[index], size);
+	    oldsize = trace->block_sizes[index];
+	    if (size < oldsize) oldsize = size;
+	    if (p != NULL && 
+		(bad = verify_fill(p, index & 0xFF, oldsize)) >= 0) {
+		sprintf(msg, "mm_realloc did not preserve the data from old "
+			"block (first bad byte at offset %ld of %d)", 
+			bad, oldsize);
+		malloc_error(tracenum, i, msg);
+		mm_set_soft_limit(0, NULL);
+		return 0;
+	    }
 	    break;
-	    
-        case FREE: /* free */
-	    index = trace->ops[i].index;
-	    block = trace->blocks[index];
-	    free(block);
+
+	case FREE:
+	    if (trace->blocks[index] != NULL)
+		mm_free(trace->blocks[index]);
+	    p = NULL;
+	    size = 0;
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_budget");
+	    p = NULL;
+	}
+	if (pressure_calls > 0 && b->pressure_op < 0)
+	    b->pressure_op = i;
+	if (mem_heapsize() > b->peak)
+	    b->peak = mem_heapsize();
+	if (p == NULL && size > 0) {
+	    b->fail_op = i;
 	    break;
 	}
+	if (p != NULL)
+	    memset(p, index & 0xFF, size);
+	trace->blocks[index] = p;
+	trace->block_sizes[index] = size;
     }
+    mm_checkheap(0);
+    b->callbacks = pressure_calls;
+    b->trimmed = mm_trimmed();
+    mm_set_soft_limit(0, NULL);
+    return 1;
+}
+
+/*
+ * on_pressure - The pressure callback of eval_mm_budget. A trace has no
+ *    caches to drop, so it only counts the calls.
+ */
+static void on_pressure(size_t heapsize)
+{
+    pressure_calls++;
+}
+
+/*
+ * eval_mm_warm - Build the state of a trace at its peak, the live
+ *    blocks after the op with the most payload bytes live, in the heap
+ *    file on mm.c, by replaying the ops up to it with the blocks in an
+ *    array in the root slot. Then unmap the file and have a fresh copy
+ *    of mdriver reopen it and check every live payload, before this
+ *    process reopens it too, checks them again, and runs the rest of
+ *    the trace on the reopened heap. Returns 0 on an error.
+ */
+static int eval_mm_warm(trace_t *trace, char *filename, int tracenum, 
+			char *heapfile, warm_t *w)
+{
+    long i, peak = 0;
+    int index;
+    long total = 0, max_total = -1;
+    char **root;
+    double start;
+    long bad;
+    int live;
+
+    /* Find the peak */
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    total += trace->ops[i].size;
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	case REALLOC:
+	    total += trace->ops[i].size - trace->block_sizes[index];
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	case FREE:
+	    total -= trace->block_sizes[index];
+	    break;
+	default:
+	    app_error("Nonexistent request type in eval_mm_warm");
+	}
+	if (total > max_total) {
+	    max_total = total;
+	    peak = i;
+	}
+    }
+    memset(w, 0, sizeof(*w));
+    w->ops = peak + 1;
+
+    /* Rebuild the state from an empty heap */
+    start = wall_secs();
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_warm");
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+    for (i = 0; i <= peak; i++)
+	if (!replay_op(trace, i, trace->blocks)) {
+	    malloc_error(tracenum, i, "mm_malloc failed.");
+	    return 0;
+	}
+    if ((root = (char **)mm_malloc(trace->num_ids * sizeof(char *))) == NULL) {
+	malloc_error(tracenum, peak, "mm_malloc failed for the root array.");
+	return 0;
+    }
+    memcpy(root, trace->blocks, trace->num_ids * sizeof(char *));
+    mm_set_root(root);
+    w->rebuild_secs = wall_secs() - start;
+    w->heap = mem_heapsize();
+
+    /* Another process must find the same state in the file */
+    mem_deinit();
+    if ((live = warm_child(filename, heapfile, peak)) < 0) {
+	malloc_error(tracenum, peak, "the heap file didn't reopen in a "
+		     "second process.");
+	return 0;
+    }
+
+    /* Restart from the heap file */
+    start = wall_secs();
+    if (mem_init_file(heapfile) != 1 || mm_reopen() < 0 || 
+	(root = (char **)mm_root()) == NULL) {
+	malloc_error(tracenum, peak, "the heap file didn't reopen.");
+	return 0;
+    }
+    w->reopen_secs = wall_secs() - start;
+
+    /* Check the state, then run the rest of the trace on it */
+    for (index = 0; index < trace->num_ids; index++) {
+	if (root[index] == NULL)
+	    continue;
+	w->live++;
+	if ((bad = verify_fill(root[index], index & 0xFF, 
+			       trace->block_sizes[index])) >= 0) {
+	    sprintf(msg, "payload %d did not survive the reopen (first bad "
+		    "byte at offset %ld)", index, bad);
+	    malloc_error(tracenum, peak, msg);
+	    return 0;
+	}
+    }
+    if (w->live != live) {
+	sprintf(msg, "a second process found %d of the %d payloads intact", 
+		live, w->live);
+	malloc_error(tracenum, peak, msg);
+	return 0;
+    }
+    for (i = peak + 1; i < trace->num_ops; i++)
+	if (!replay_op(trace, i, root)) {
+	    malloc_error(tracenum, i, "mm_malloc failed after the reopen.");
+	    return 0;
+	}
+    mm_set_root(NULL);
+    mm_free(root);
+    w->valid = 1;
+    return 1;
+}
+
+/*
+ * warm_child - Have a fresh copy of mdriver reopen the heap file that
+ *    eval_mm_warm left the state of trace file filename at op peak in,
+ *    and count the live payloads that came back intact. The count comes
+ *    back on a pipe from the child's stdout. Returns -1 if the child
+ *    found a payload damaged or couldn't reopen the file.
+ */
+static int warm_child(char *filename, char *heapfile, long peak)
+{
+    int fd[2];
+    int status;
+    pid_t pid;
+    FILE *fp;
+    char path[MAXLINE], arg[32];
+    int live = -1;
+
+    snprintf(path, MAXLINE, "%s%s", tracedir, filename);
+    snprintf(arg, sizeof(arg), "%ld", peak);
+    fflush(stdout);
+    if (pipe(fd) < 0)
+	unix_error("pipe failed in warm_child");
+    if ((pid = fork()) < 0)
+	unix_error("fork failed in warm_child");
+
+    if (pid == 0) {
+	close(fd[0]);
+	if (dup2(fd[1], STDOUT_FILENO) < 0)
+	    _exit(1);
+	execl("/proc/self/exe", "mdriver", WARM_CHECK_ARG, heapfile, path, 
+	      arg, (char *)NULL);
+	_exit(1);
+    }
+
+    close(fd[1]);
+    if ((fp = fdopen(fd[0], "r")) == NULL)
+	unix_error("fdopen failed in warm_child");
+    if (fscanf(fp, "%d", &live) != 1)
+	live = -1;
+    fclose(fp);
+    if (waitpid(pid, &status, 0) < 0)
+	unix_error("waitpid failed in warm_child");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	return -1;
+    return live;
+}
+
+/*
+ * warm_check - In a fresh process, reopen the heap file holding the
+ *    state of trace at op peak, check every live payload through the
+ *    root array and the heap itself, and print how many there are.
+ *    Returns the exit status: 0 if all came back intact.
+ */
+static int warm_check(trace_t *trace, char *heapfile, long peak)
+{
+    long i;
+    int index, live = 0;
+    char **root;
+
+    /* The payload sizes at the peak */
+    for (i = 0; i <= peak && i < trace->num_ops; i++)
+	if (trace->ops[i].type != FREE)
+	    trace->block_sizes[trace->ops[i].index] = trace->ops[i].size;
+
+    if (mem_init_file(heapfile) != 1 || mm_reopen() < 0 || 
+	(root = (char **)mm_root()) == NULL)
+	return 1;
+    for (index = 0; index < trace->num_ids; index++) {
+	if (root[index] == NULL)
+	    continue;
+	if (verify_fill(root[index], index & 0xFF, 
+			trace->block_sizes[index]) >= 0)
+	    return 1;
+	live++;
+    }
+    mm_checkheap(0);
+    mem_deinit();
+    printf("%d\n", live);
+    return 0;
+}
+
+/*
+ * replay_op - Run op i of a trace on mm.c, keeping its block in blocks
+ *    and its size in the trace, and filling the payload with the low
+ *    byte of its index. Returns 0 if mm.c ran out of memory.
+ */
+static int replay_op(trace_t *trace, long i, char **blocks)
+{
+    int index = trace->ops[i].index;
+    int size = trace->ops[i].size;
+    char *p;
+
+    switch (trace->ops[i].type) {
+    case ALLOC:
+    case REALLOC:
+	if (trace->ops[i].type == ALLOC)
+	    p = mm_malloc(size);
+	else
+	    p = mm_realloc(blocks[index], size);
+	if (p == NULL)
+	    return 0;
+	memset(p, index & 0xFF, size);
+	blocks[index] = p;
+	trace->block_sizes[index] = size;
+	break;
+
+    case FREE:
+	mm_free(blocks[index]);
+	blocks[index] = NULL;
+	break;
+
+    default:
+	app_error("Nonexistent request type in replay_op");
+    }
+    return 1;
+}
+
+/*
+ * wall_secs - seconds on the monotonic clock
+ */
+static double wall_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * cmp_double - qsort comparison for doubles in increasing order
+ */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * eval_mm_valid_stream - eval_mm_valid for a trace that is streamed
+ *     rather than loaded. Live blocks are kept in an idmap instead of
+ *     the blocks and block_sizes arrays. Fills in *header.
+ */
+static int eval_mm_valid_stream(allocator_t *alloc, char *tracedir, 
+				char *filename, int tracenum,
+				range_t **ranges, locality_t *loc, 
+				trace_t *header)
+{
+    int i, n;
+    int index;
+    int size;
+    int oldsize;
+    long bad;     /* offset of the first byte realloc lost */
+    long first_op;
+    char *newp;
+    char *oldp;
+    char *p;
+    traceop_t *ops;
+    stream_t *stream;
+    idmap_t map;
+    idmap_entry_t *e;
+    int valid = 0;
+
+    /* Reset the heap and free any records in the range list */
+    alloc->reset();
+    clear_ranges(ranges);
+    stream = stream_open(tracedir, filename, header);
+    idmap_init(&map);
+
+    /* Call the mm package's init function */
+    if (alloc->init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	goto done;
+    }
+    if (!alloc->in_memlib)
+	loc = NULL;
+    if (loc)
+	loc_reset(mem_heap_lo(), MAX_HEAP, header->num_ops);
+
+    /* Interpret each operation in the trace in order */
+    while ((ops = stream_next(stream, &n, &first_op)) != NULL) {
+	for (i = 0; i < n; i++) {
+	    index = ops[i].index;
+	    size = ops[i].size;
+
+	    switch (ops[i].type) {
+
+	    case ALLOC: /* mm_malloc */
+		if ((p = (char *) alloc->malloc(size)) == NULL) {
+		    malloc_error(tracenum, first_op + i, "mm_malloc failed.");
+		    goto done;
+		}
+		if (add_range(alloc, ranges, p, size, tracenum, first_op + i) == 0)
+		    goto done;
+		if (loc)
+		    loc_alloc(p, size);
+		memset(p, index & 0xFF, size);
+
+		/* Remember region */
+		e = idmap_put(&map, index);
+		e->ptr = p;
+		e->size = size;
+		break;
+
+	    case REALLOC: /* mm_realloc */
+		if ((e = idmap_get(&map, index)) == NULL)
+		    app_error("realloc of a block that is not allocated");
+		oldp = e->ptr;
+		if ((newp = (char *) alloc->realloc(oldp, size)) == NULL) {
+		    malloc_error(tracenum, first_op + i, "mm_realloc failed.");
+		    goto done;
+		}
+		remove_range(ranges, oldp);
+		if (add_range(alloc, ranges, newp, size, tracenum, first_op + i) == 0)
+		    goto done;
+		if (loc) {
+		    loc_free(oldp, e->size);
+		    loc_alloc(newp, size);
+		}
+
+		/* The new block must hold the data from the old block */
+		oldsize = e->size;
+		if (size < oldsize) oldsize = size;
+		if ((bad = verify_fill(newp, index & 0xFF, oldsize)) >= 0) {
+		    sprintf(msg, "mm_realloc did not preserve the data from "
+			    "old block (first bad byte at offset %ld of %d)", 
+			    bad, oldsize);
+		    malloc_error(tracenum, first_op + i, msg);
+		    goto done;
+		}
+		memset(newp, index & 0xFF, size);
+
+		/* Remember region */
+		e->ptr = newp;
+		e->size = size;
+		break;
+
+	    case FREE: /* mm_free */
+		if ((e = idmap_get(&map, index)) == NULL)
+		    app_error("free of a block that is not allocated");
+		p = e->ptr;
+		remove_range(ranges, p);
+		if (loc)
+		    loc_free(p, e->size);
+		alloc->free(p);
+		idmap_remove(&map, index);
+		break;
+
+	    default:
+		app_error("Nonexistent request type in eval_mm_valid_stream");
+	    }
+
+	    if (loc)
+		loc_sample();
+	}
+    }
+
+    /* As far as we know, this is a valid malloc package */
+    if (loc)
+	loc_summary(loc);
+    valid = 1;
+
+ done:
+    stream_close(stream);
+    idmap_destroy(&map);
+    return valid;
+}
+
+/*
+ * eval_mm_util_stream - eval_mm_util for a trace that is streamed
+ */
+static double eval_mm_util_stream(allocator_t *alloc, char *tracedir, 
+				  char *filename)
+{
+    int i, n;
+    long first_op;
+    long max_total_size = 0;
+    long total_size = 0;
+    char *p;
+    traceop_t *ops;
+    trace_t header;
+    stream_t *stream;
+    idmap_t map;
+    idmap_entry_t *e;
+
+    /* initialize the heap and the mm malloc package */
+    alloc->reset();
+    if (alloc->init() < 0)
+	app_error("mm_init failed in eval_mm_util_stream");
+    stream = stream_open(tracedir, filename, &header);
+    idmap_init(&map);
+
+    while ((ops = stream_next(stream, &n, &first_op)) != NULL) {
+	for (i = 0; i < n; i++) {
+	    switch (ops[i].type) {
+
+	    case ALLOC: /* mm_alloc */
+		if ((p = (char *) alloc->malloc(ops[i].size)) == NULL) 
+		    app_error("mm_malloc failed in eval_mm_util_stream");
+		e = idmap_put(&map, ops[i].index);
+		e->ptr = p;
+		e->size = ops[i].size;
+		total_size += ops[i].size;
+		break;
+
+	    case REALLOC: /* mm_realloc */
+		e = idmap_get(&map, ops[i].index);
+		if ((p = (char *) alloc->realloc(e->ptr, ops[i].size)) == NULL)
+		    app_error("mm_realloc failed in eval_mm_util_stream");
+		total_size += ops[i].size - (long)e->size;
+		e->ptr = p;
+		e->size = ops[i].size;
+		break;
+
+	    case FREE: /* mm_free */
+		e = idmap_get(&map, ops[i].index);
+		alloc->free(e->ptr);
+		total_size -= e->size;
+		idmap_remove(&map, ops[i].index);
+		break;
+
+	    default:
+		app_error("Nonexistent request type in eval_mm_util_stream");
+	    }
+
+	    /* Update statistics */
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	}
+    }
+
+    stream_close(stream);
+    idmap_destroy(&map);
+    if (alloc->heapsize() == 0)
+	return 0;
+    return ((double)max_total_size / (double)alloc->heapsize());
+}
+
+/*
+ * eval_mm_speed_stream - time the mm malloc package on a streamed trace.
+ *    A trace that doesn't fit in memory can't be replayed over and over
+ *    like fsecs does, so this makes a single pass, and only the time
+ *    spent replaying each chunk is counted, not any time spent waiting
+ *    for the reader.
+ */
+static double eval_mm_speed_stream(allocator_t *alloc, char *tracedir, 
+				   char *filename)
+{
+    int i, n;
+    long first_op;
+    char *p;
+    traceop_t *ops;
+    trace_t header;
+    stream_t *stream;
+    idmap_t map;
+    idmap_entry_t *e;
+    struct timespec start, end;
+    double secs = 0;
+
+    /* Reset the heap and initialize the mm package */
+    alloc->reset();
+    if (alloc->init() < 0) 
+	app_error("mm_init failed in eval_mm_speed_stream");
+    stream = stream_open(tracedir, filename, &header);
+    idmap_init(&map);
+
+    while ((ops = stream_next(stream, &n, &first_op)) != NULL) {
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n; i++) {
+	    switch (ops[i].type) {
+
+	    case ALLOC: /* mm_malloc */
+		if ((p = (char *) alloc->malloc(ops[i].size)) == NULL)
+		    app_error("mm_malloc error in eval_mm_speed_stream");
+		idmap_put(&map, ops[i].index)->ptr = p;
+		break;
+
+	    case REALLOC: /* mm_realloc */
+		e = idmap_get(&map, ops[i].index);
+		if ((p = (char *) alloc->realloc(e->ptr, ops[i].size)) == NULL)
+		    app_error("mm_realloc error in eval_mm_speed_stream");
+		e->ptr = p;
+		break;
+
+	    case FREE: /* mm_free */
+		alloc->free(idmap_get(&map, ops[i].index)->ptr);
+		idmap_remove(&map, ops[i].index);
+		break;
+
+	    default:
+		app_error("Nonexistent request type in eval_mm_speed_stream");
+	    }
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	secs += (end.tv_sec - start.tv_sec) + 1e-9 * (end.tv_nsec - start.tv_nsec);
+    }
+
+    stream_close(stream);
+    idmap_destroy(&map);
+    return secs;
+}
+
+/*
+ * touch_payload - Simulate the application initializing a new payload
+ *    by writing its first bytes and then reading them back.
+ */
+static void touch_payload(char *p, int size, int bytes)
+{
+    int j;
+    uint64_t sum = 0;
+
+    if (bytes > size)
+	bytes = size;
+    memset(p, 0x5a, bytes);
+    for (j = 0; j < bytes; j++)
+	sum += (unsigned char)p[j];
+    touch_sink += sum;
+}
+
+/*
+ * retouch_payloads - Simulate the application going back to live
+ *    payloads between allocator calls: either the most recently
+ *    allocated blocks or one block id chosen at random. Ids that
+ *    are not live in this run are skipped.
+ */
+static void retouch_payloads(speed_t *params, unsigned *seed, 
+			     int *recent, int nrecent)
+{
+    trace_t *trace = params->trace;
+    int i, j, bytes, index;
+    char *p;
+    uint64_t sum = 0;
+
+    if (params->touch_pattern == TOUCH_RANDOM) {
+	*seed = *seed * 1103515245 + 12345;
+	recent = &index;
+	index = (*seed >> 8) % trace->num_ids;
+	nrecent = 1;
+    }
+
+    for (i = 0; i < nrecent; i++) {
+	if ((p = trace->blocks[recent[i]]) == NULL)
+	    continue;
+	bytes = params->touch_bytes;
+	if (bytes > (int)trace->block_sizes[recent[i]])
+	    bytes = trace->block_sizes[recent[i]];
+	for (j = 0; j < bytes; j++)
+	    sum += (unsigned char)p[j];
+    }
+    touch_sink += sum;
+}
+
+/*
+ * eval_libc_valid - We run this function to make sure that the
+ *    libc malloc can run to completion on the set of traces.
+ *    We'll be conservative and terminate if any libc malloc call fails.
+ *
+ */
+static int eval_libc_valid(trace_t *trace, int tracenum)
+{
+    long i;
+    int newsize;
+    char *p, *newp, *oldp;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* malloc */
+	  if ((p = (char *) malloc(trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc malloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case REALLOC: /* realloc */
+            newsize = trace->ops[i].size;
+	    oldp = trace->blocks[trace->ops[i].index];
+	    if ((newp = (char *) realloc(oldp, newsize)) == NULL) {
+		malloc_error(tracenum, i, "libc realloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = newp;
+	    break;
+	    
+        case FREE: /* free */
+	    free(trace->blocks[trace->ops[i].index]);
+	    break;
+
+	default:
+	    app_error("invalid operation type  in eval_libc_valid");
+	}
+    }
+
+    return 1;
+}
+
+/* 
+ * eval_libc_speed - This is the function that is used by fcyc() to
+ *    measure the running time of the libc malloc package on the set
+ *    of traces.
+ */
+static void eval_libc_speed(void *ptr)
+{
+    long i;
+    int index, size, newsize;
+    char *p, *newp, *oldp, *block;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+        case ALLOC: /* malloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = (char *) malloc(size)) == NULL)
+		unix_error("malloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+	case REALLOC: /* realloc */
+	    index = trace->ops[i].index;
+	    newsize = trace->ops[i].size;
+	    oldp = trace->blocks[index];
+	    if ((newp = (char *) realloc(oldp, newsize)) == NULL)
+		unix_error("realloc failed in eval_libc_speed\n");
+	    
+	    trace->blocks[index] = newp;
+	    break;
+	    
+        case FREE: /* free */
+	    index = trace->ops[i].index;
+	    block = trace->blocks[index];
+	    free(block);
+	    break;
+	}
+    }
+}
+
+/*
+ * eval_libc_util - Evaluate the space utilization of libc malloc.
+ *    libc's heap is shared with the driver, which leaves it fragmented
+ *    and larger than any one trace needs, so the trace is replayed by
+ *    libc_util in a fresh copy of mdriver instead. The child prints the
+ *    utilization on its stdout, which is a pipe back to us.
+ */
+static double eval_libc_util(char *filename, int tracenum)
+{
+    int fd[2];
+    int status;
+    pid_t pid;
+    FILE *fp;
+    char path[MAXLINE];
+    double util = 0;
+
+    snprintf(path, MAXLINE, "%s%s", tracedir, filename);
+    fflush(stdout);
+    if (pipe(fd) < 0)
+	unix_error("pipe failed in eval_libc_util");
+    if ((pid = fork()) < 0)
+	unix_error("fork failed in eval_libc_util");
+
+    if (pid == 0) {
+	close(fd[0]);
+	if (dup2(fd[1], STDOUT_FILENO) < 0)
+	    _exit(1);
+	execl("/proc/self/exe", "mdriver", LIBC_UTIL_ARG, path, (char *)NULL);
+	_exit(1);
+    }
+
+    close(fd[1]);
+    if ((fp = fdopen(fd[0], "r")) == NULL)
+	unix_error("fdopen failed in eval_libc_util");
+    if (fscanf(fp, "%lf", &util) != 1)
+	util = 0;
+    fclose(fp);
+    if (waitpid(pid, &status, 0) < 0)
+	unix_error("waitpid failed in eval_libc_util");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+	malloc_error(tracenum, 0, "libc malloc failed in eval_libc_util");
+	return 0;
+    }
+    return util;
+}
+
+/*
+ * libc_util - Replay a trace on libc malloc in this (fresh) process, 
+ *    sampling the libc footprint after every request that can grow it.
+ *    As in eval_mm_util, utilization is the high water mark of the live
+ *    payload over the peak footprint, where the footprint is taken net
+ *    of what was already in use when the replay started (the trace
+ *    itself, stdio buffers). glibc normally pads each extension of its
+ *    heap by M_TOP_PAD bytes it has not touched yet; the pad is turned
+ *    off so the footprint, like mm's, only grows as requests need it.
+ */
+static double libc_util(trace_t *trace)
+{
+    long i;
+    int index;
+    long total_size = 0, max_total_size = 0;
+    size_t base, footprint, peak = 0;
+    struct mallinfo2 mi;
+    char *p;
+
+    mallopt(M_TOP_PAD, 0);
+    malloc_trim(0);
+    mi = mallinfo2();
+    base = mi.uordblks + mi.hblkhd;
+
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = malloc(trace->ops[i].size)) == NULL)
+		unix_error("libc malloc failed in libc_util");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    total_size += trace->ops[i].size;
+	    break;
+
+	case REALLOC:
+	    if ((p = realloc(trace->blocks[index], trace->ops[i].size)) == NULL)
+		unix_error("libc realloc failed in libc_util");
+	    trace->blocks[index] = p;
+	    total_size += trace->ops[i].size - (long)trace->block_sizes[index];
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+
+	case FREE:
+	    free(trace->blocks[index]);
+	    total_size -= trace->block_sizes[index];
+	    continue;
+	}
+	if (total_size > max_total_size)
+	    max_total_size = total_size;
+	footprint = libc_footprint();
+	if (footprint > peak)
+	    peak = footprint;
+    }
+
+    if (peak <= base)
+	return 0;
+    return (double)max_total_size / (double)(peak - base);
+}
+
+/*
+ * libc_footprint - the bytes libc malloc holds from the system: its
+ *    arenas plus the chunks it mmapped directly
+ */
+static size_t libc_footprint(void)
+{
+    struct mallinfo2 mi = mallinfo2();
+
+    return mi.arena + mi.hblkhd;
 }
 
 /*************************************
@@ -931,62 +2298,476 @@ static void eval_libc_speed(void *ptr)
 
 
 /*
- * printresults - prints a performance summary for some malloc package
+ * printresults - prints a performance summary for some malloc package.
+ *    If show_app is set, also prints the secs the simulated application
+ *    spent touching payloads (-T).
  */
-static void printresults(int n, stats_t *stats) 
+static void printresults(int n, stats_t *stats, int show_app) 
 {
     int i;
     double secs = 0;
     double ops = 0;
     double util = 0;
+    double app_secs = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
+    printf("%5s%7s %5s%8s%10s%6s", 
 	   "trace", " valid", "util", "ops", "secs", "Kops");
+    if (show_app)
+	printf("%10s", "app secs");
+    printf("\n");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
 		   (stats[i].ops/1e3)/stats[i].secs);
+	    if (show_app)
+		printf("%10.6f", stats[i].app_secs);
+	    printf("\n");
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
+	    app_secs += stats[i].app_secs;
 	}
 	else {
-	    printf("%2d%10s%6s%8s%10s%6s\n", 
+	    printf("%2d%10s%6s%8s%10s%6s", 
 		   i,
 		   "no",
 		   "-",
 		   "-",
 		   "-",
 		   "-");
+	    if (show_app)
+		printf("%10s", "-");
+	    printf("\n");
 	}
     }
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	printf("%12s%5.0f%%%8.0f%10.6f%6.0f", 
 	       "Total       ",
 	       (util/n)*100.0,
 	       ops, 
 	       secs,
 	       (ops/1e3)/secs);
+	if (show_app)
+	    printf("%10.6f", app_secs);
+	printf("\n");
     }
     else {
-	printf("%12s%6s%8s%10s%6s\n", 
+	printf("%12s%6s%8s%10s%6s", 
 	       "Total       ",
 	       "-", 
 	       "-", 
 	       "-", 
 	       "-");
+	if (show_app)
+	    printf("%10s", "-");
+	printf("\n");
     }
 
 }
 
+/*
+ * printlocality - prints the placement locality metrics for each trace.
+ *    "dist" is the mean distance between successive allocations; the
+ *    line and page columns give the mean span of the live set next to
+ *    the fewest lines or pages that could hold it. With -V, also shows
+ *    how pages spanned vs. needed evolve over each trace.
+ */
+static void printlocality(int n, stats_t *stats)
+{
+    int i, k;
+
+    printf("%5s%12s%10s%10s%9s%9s%7s%10s\n", 
+	   "trace", "dist", "lines", "minlines", "pages", "minpages", 
+	   "ratio", "peakpages");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%15s%10s%10s%9s%9s%7s%10s\n", 
+		   i, "-", "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%15.0f%10.1f%10.1f%9.1f%9.1f%7.2f%10lu\n", 
+	       i,
+	       stats[i].loc.avg_distance,
+	       stats[i].loc.avg_lines,
+	       stats[i].loc.avg_min_lines,
+	       stats[i].loc.avg_pages,
+	       stats[i].loc.avg_min_pages,
+	       (stats[i].loc.avg_min_pages > 0) ? 
+	       stats[i].loc.avg_pages / stats[i].loc.avg_min_pages : 0,
+	       (unsigned long)stats[i].loc.peak_pages);
+	if (verbose > 1) {
+	    printf("%17s", "pages/min:");
+	    for (k = 0; k < LOC_CHECKPOINTS; k++)
+		printf(" %lu/%lu", 
+		       (unsigned long)stats[i].loc.ckpt_pages[k],
+		       (unsigned long)stats[i].loc.ckpt_min_pages[k]);
+	    printf("\n");
+	}
+    }
+}
+
+/*
+ * start_memstat - with -R, start counting the faults and RSS of a pass.
+ *    The heap's pages go back to the kernel first; otherwise they stay
+ *    resident from one pass to the next, and only the first pass over a
+ *    trace would fault them in.
+ */
+static void start_memstat(memsnap_t *snap)
+{
+    mem_release();
+    memstat_start(snap);
+}
+
+/*
+ * printmemstat - prints the page faults and RSS growth of the validity,
+ *    util and one speed pass over each trace, next to util and Kops.
+ *    "rss" is the RSS growth over the pass and "peak" the growth at its
+ *    high point, both in KB. Each pass starts with the heap's pages
+ *    released, so it shows the faults and RSS of the heap it builds.
+ */
+static void printmemstat(int n, stats_t *stats)
+{
+    int i, k;
+    memstat_t *m[3];
+
+    printf("%5s%6s%8s", "trace", "util", "Kops");
+    for (k = 0; k < 3; k++)
+	printf(" |%7s%7s%7s%7s", "minflt", "majflt", "rss", "peak");
+    printf("\n%19s |%28s |%28s |%28s\n", "", 
+	   "valid pass", "util pass", "speed pass");
+    for (i=0; i < n; i++) {
+	printf("%2d", i);
+	if (!stats[i].valid) {
+	    printf("%9s%8s", "-", "-");
+	    for (k = 0; k < 3; k++)
+		printf(" |%7s%7s%7s%7s", "-", "-", "-", "-");
+	    printf("\n");
+	    continue;
+	}
+	printf("%8.0f%%%8.0f", 
+	       stats[i].util*100.0, (stats[i].ops/1e3)/stats[i].secs);
+	m[0] = &stats[i].valid_mem;
+	m[1] = &stats[i].util_mem;
+	m[2] = &stats[i].speed_mem;
+	for (k = 0; k < 3; k++)
+	    printf(" |%7ld%7ld%7ld%7ld", m[k]->minflt, m[k]->majflt, 
+		   m[k]->rss_delta/1024, m[k]->peak_delta/1024);
+	printf("\n");
+    }
+}
+
+/*
+ * printlatency - prints the mean, median, 99th percentile and slowest
+ *    op latency on each trace, then a histogram of the op latencies
+ *    over all the traces the package handled correctly
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    int i, k, lo = LAT_BUCKETS, hi = -1;
+    long hist[LAT_BUCKETS], max = 0;
+
+    memset(hist, 0, sizeof(hist));
+    printf("%5s%10s%10s%10s%12s\n", "trace", "mean", "p50", "p99", "max");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%13s%10s%10s%12s\n", i, "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%13.0f%10.0f%10.0f%12.0f\n", i, stats[i].lat.mean, 
+	       stats[i].lat.p50, stats[i].lat.p99, stats[i].lat.max);
+	for (k = 0; k < LAT_BUCKETS; k++)
+	    hist[k] += stats[i].lat.hist[k];
+    }
+
+    for (k = 0; k < LAT_BUCKETS; k++) {
+	if (hist[k] == 0)
+	    continue;
+	lo = (k < lo) ? k : lo;
+	hi = k;
+	max = (hist[k] > max) ? hist[k] : max;
+    }
+    for (k = lo; k <= hi; k++)
+	printf("  %10lu-%-10lu %8ld %.*s\n", 1UL << k, (2UL << k) - 1, hist[k],
+	       (int)((hist[k] * 50 + max - 1) / max),
+	       "##################################################");
+}
+
+/*
+ * printreplay - prints a summary of the threaded replay of each trace
+ */
+static void printreplay(int n, replay_stats_t *stats)
+{
+    int i;
+    double secs = 0;
+    double ops = 0;
+
+    printf("%5s%8s%7s%8s%10s%6s%10s\n", 
+	   "trace", "threads", "valid", "ops", "secs", "Kops", "cachedKB");
+    for (i=0; i < n; i++) {
+	printf("%2d%11d%7s%8.0f%10.6f%6.0f%10.1f\n", 
+	       i,
+	       stats[i].threads,
+	       stats[i].valid ? "yes" : "no",
+	       stats[i].ops,
+	       stats[i].secs,
+	       (stats[i].ops/1e3)/stats[i].secs,
+	       stats[i].cached/1024.0);
+	secs += stats[i].secs;
+	ops += stats[i].ops;
+    }
+    printf("%20s%8.0f%10.6f%6.0f\n", 
+	   "Total", ops, secs, (ops/1e3)/secs);
+}
+
+/*
+ * printcached - prints the bytes held in the mt_ caches after each
+ *     tenth of each threaded replay, once its threads had exited, and
+ *     how many the scavenger took back
+ */
+static void printcached(int n, replay_stats_t *stats)
+{
+    int i, k;
+
+    printf("%5s", "trace");
+    for (k = 1; k <= REPLAY_SAMPLES; k++)
+	printf("%6d%%", k * 100 / REPLAY_SAMPLES);
+    printf("%8s%11s\n", "exited", "scavenged");
+    for (i=0; i < n; i++) {
+	printf("%2d   ", i);
+	for (k = 0; k < REPLAY_SAMPLES; k++)
+	    printf("%7.1f", stats[i].cached_at[k]/1024.0);
+	printf("%8.1f%11.1f\n", stats[i].cached/1024.0, 
+	       stats[i].scavenged/1024.0);
+    }
+}
+
+/*
+ * printlocks - prints how often each arena's lock was taken in each
+ *     threaded replay, how often it had to be waited for and how often
+ *     spinning got it, the mean cycles of a wait and of a hold, and the
+ *     spin budget an adaptive lock had learned
+ */
+static void printlocks(int n, replay_stats_t *stats)
+{
+    int i, a;
+    lockstat_t *l;
+
+    printf("%5s%6s%10s%11s%7s%10s%10s%12s%12s%7s\n", "trace", "arena", 
+	   "acquires", "contended", "spun", "wait", "hold", "wait total", 
+	   "hold total", "budget");
+    for (i=0; i < n; i++) {
+	for (a = 0; a < stats[i].arenas; a++) {
+	    l = &stats[i].locks[a];
+	    printf("%2d%9d%10ld%10.2f%%%6.0f%%%10.0f%10.0f%12llu%12llu%7d\n", 
+		   i, a, l->acquires,
+		   l->acquires ? 100.0 * l->contended / l->acquires : 0.0,
+		   l->contended ? 100.0 * l->spun / l->contended : 0.0,
+		   l->contended ? (double)l->wait_cycles / l->contended : 0.0,
+		   l->acquires ? (double)l->hold_cycles / l->acquires : 0.0,
+		   l->wait_cycles, l->hold_cycles, l->spin_budget);
+	}
+    }
+}
+
+/*
+ * printlines - prints how many cache lines held live payloads in each
+ *     threaded replay, how many of them ever held live payloads of two
+ *     threads at once, and the heap taken for thread-owned runs
+ */
+static void printlines(int n, replay_stats_t *stats)
+{
+    int i;
+    long lines = 0, shared = 0;
+
+    printf("%5s%10s%10s%8s%9s\n", "trace", "lines", "shared", "", "runsKB");
+    for (i=0; i < n; i++) {
+	printf("%2d%13ld%10ld%7.2f%%%9.1f\n", 
+	       i, stats[i].lines, stats[i].shared_lines,
+	       stats[i].lines ? 100.0 * stats[i].shared_lines / stats[i].lines : 0.0,
+	       stats[i].run_bytes / 1024.0);
+	lines += stats[i].lines;
+	shared += stats[i].shared_lines;
+    }
+    printf("%5s%10ld%10ld%7.2f%%\n", "Total", lines, shared,
+	   lines ? 100.0 * shared / lines : 0.0);
+}
+
+/*
+ * printreplaylat - prints the median, 99th percentile and slowest time
+ *     the threads spent in mt_ calls for an op, and for a free, in each
+ *     threaded replay
+ */
+static void printreplaylat(int n, replay_stats_t *stats)
+{
+    int i;
+
+    printf("%5s%10s%10s%12s%10s%10s%12s\n", "trace", 
+	   "op p50", "op p99", "op max", "free p50", "free p99", "free max");
+    for (i=0; i < n; i++)
+	printf("%2d%13.0f%10.0f%12.0f%10.0f%10.0f%12.0f\n", i,
+	       stats[i].op_cycles[0], stats[i].op_cycles[1], 
+	       stats[i].op_cycles[2], stats[i].free_cycles[0], 
+	       stats[i].free_cycles[1], stats[i].free_cycles[2]);
+}
+
+/*
+ * printfreeq - prints how many blocks each threaded replay queued to
+ *     be freed, how many the background thread freed and how many the
+ *     freeing threads had to, in how many batches, and the deepest the
+ *     queue got
+ */
+static void printfreeq(int n, replay_stats_t *stats)
+{
+    int i;
+    freeqstat_t *q;
+
+    printf("%5s%10s%10s%10s%10s%10s\n", "trace", 
+	   "queued", "drained", "helped", "batches", "deepest");
+    for (i=0; i < n; i++) {
+	q = &stats[i].freeq;
+	printf("%2d%13ld%10ld%10ld%10ld%10ld\n", i, 
+	       q->queued, q->drained, q->helped, q->batches, q->deepest);
+    }
+}
+
+/*
+ * printzero - prints how many calloc'd bytes each threaded replay
+ *     zeroed inline and how many it found zeroed already, and how many
+ *     bytes the background thread zeroed, in how many blocks
+ */
+static void printzero(int n, replay_stats_t *stats)
+{
+    int i;
+    zerostat_t *z;
+
+    printf("%5s%10s%10s%12s%10s\n", "trace", 
+	   "inline", "skipped", "background", "blocks");
+    for (i=0; i < n; i++) {
+	z = &stats[i].zero;
+	printf("%2d%13.1f%10.1f%12.1f%10ld\n", i, 
+	       z->inline_bytes / 1024.0, z->skipped / 1024.0, 
+	       z->background / 1024.0, z->blocks);
+    }
+}
+
+/*
+ * printbudget - prints the op at which each trace failed under the
+ *     budget, without the soft limit and with it, as a percentage of
+ *     the trace, and how the heap fared with it: the op at which it
+ *     came under pressure, the calls of the pressure callback, and the
+ *     peak heap size and bytes trimmed
+ */
+static void printbudget(int n, budget_t *plain, budget_t *tight)
+{
+    int i;
+    char failed[2][16], pressure[16];
+    budget_t *b[2];
+    int k;
+
+    printf("%5s%8s%10s%10s%10s%6s%9s%9s\n", "trace", "ops", "plain", 
+	   "tight", "pressure", "calls", "peakKB", "trimKB");
+    for (i=0; i < n; i++) {
+	b[0] = &plain[i];
+	b[1] = &tight[i];
+	for (k = 0; k < 2; k++) {
+	    if (b[k]->fail_op < 0)
+		strcpy(failed[k], "ok");
+	    else
+		snprintf(failed[k], sizeof(failed[k]), "%.0f%%", 
+			 100.0 * b[k]->fail_op / b[k]->ops);
+	}
+	if (tight[i].pressure_op < 0)
+	    strcpy(pressure, "-");
+	else
+	    snprintf(pressure, sizeof(pressure), "%.0f%%", 
+		     100.0 * tight[i].pressure_op / tight[i].ops);
+	printf("%2d%11.0f%10s%10s%10s%6d%9.1f%9.1f\n", i, tight[i].ops, 
+	       failed[0], failed[1], pressure, tight[i].callbacks, 
+	       tight[i].peak / 1024.0, tight[i].trimmed / 1024.0);
+    }
+}
+
+/*
+ * printwarm - prints the state each trace had at its peak, and how long
+ *     it took to build it by replaying the trace and to reopen the heap
+ *     file that held it
+ */
+static void printwarm(int n, warm_t *warm)
+{
+    int i;
+
+    printf("%5s%7s%8s%8s%10s%12s%12s%9s\n", "trace", "valid", "ops", 
+	   "live", "heapKB", "rebuild ms", "reopen ms", "speedup");
+    for (i=0; i < n; i++) {
+	if (!warm[i].valid) {
+	    printf("%2d%10s\n", i, "no");
+	    continue;
+	}
+	printf("%2d%10s%8.0f%8d%10.1f%12.3f%12.3f%9.0f\n", i, "yes", 
+	       warm[i].ops, warm[i].live, warm[i].heap / 1024.0,
+	       warm[i].rebuild_secs * 1e3, warm[i].reopen_secs * 1e3,
+	       warm[i].rebuild_secs / warm[i].reopen_secs);
+    }
+}
+
+/*
+ * printcompare - prints the util and throughput of each of nalloc 
+ *    packages on each trace, one column per package. The totals only
+ *    count the traces a package handled correctly.
+ */
+static void printcompare(int n, int nalloc, allocator_t **allocs, 
+			 stats_t *stats)
+{
+    int i, a;
+    stats_t *st;
+    double util, ops, secs;
+    int valid;
+
+    printf("%5s", "trace");
+    for (a = 0; a < nalloc; a++)
+	printf("%14s", allocs[a]->name);
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	printf("%2d   ", i);
+	for (a = 0; a < nalloc; a++) {
+	    st = &stats[a * n + i];
+	    if (st->valid)
+		printf("%5.0f%%%8.0f", st->util*100.0, (st->ops/1e3)/st->secs);
+	    else
+		printf("%6s%8s", "-", "-");
+	}
+	printf("\n");
+    }
+
+    printf("%5s", "Total");
+    for (a = 0; a < nalloc; a++) {
+	util = ops = secs = 0;
+	valid = 0;
+	for (i = 0; i < n; i++) {
+	    st = &stats[a * n + i];
+	    if (!st->valid)
+		continue;
+	    util += st->util;
+	    ops += st->ops;
+	    secs += st->secs;
+	    valid++;
+	}
+	if (valid)
+	    printf("%5.0f%%%8.0f", (util/valid)*100.0, (ops/1e3)/secs);
+	else
+	    printf("%6s%8s", "-", "-");
+    }
+    printf("\n");
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1008,10 +2789,10 @@ void unix_error(const char *msg)
 /*
  * malloc_error - Report an error returned by the mm_malloc package
  */
-void malloc_error(int tracenum, int opnum, const char *msg)
+void malloc_error(int tracenum, long opnum, const char *msg)
 {
     errors++;
-    printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
+    printf("ERROR [trace %d, line %ld]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
 /* 
@@ -1019,14 +2800,46 @@ void malloc_error(int tracenum, int opnum, const char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvVaklrFOZLRHs] [-f <file>] [-t <dir>] "
+	    "[-T <bytes>] [-P <pattern>] [-x <mode>] [-C <cache>] [-S <ms>]\n"
+	    "               [-M <lock>] [-A <list>] [-B <KB>] [-W <file>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-A <list>  Compare the comma-separated packages instead of\n");
+    fprintf(stderr, "\t           grading mm.c (mm, libc, bump, buddy).\n");
+    fprintf(stderr, "\t-B <KB>    Replay each trace under a heap budget of <KB>, without\n");
+    fprintf(stderr, "\t           and with a soft limit, and report when it fails.\n");
+    fprintf(stderr, "\t-C <cache> With -x, cache small free blocks per thread (thread),\n");
+    fprintf(stderr, "\t           per CPU with rseq (cpu), or not at all (none).\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F         With -x, count cache lines that held live payloads of\n");
+    fprintf(stderr, "\t           two threads at once (slows the replay).\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Print a histogram of single-op latencies (not with -s);\n");
+    fprintf(stderr, "\t           with -x, percentiles of each op's mt_ call latency.\n");
+    fprintf(stderr, "\t-k         With -x, count heap lock contention per arena.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Print placement locality metrics.\n");
+    fprintf(stderr, "\t-r         With -x, serve small blocks from page runs owned by the\n");
+    fprintf(stderr, "\t           allocating thread.\n");
+    fprintf(stderr, "\t-R         Print page faults and RSS growth of each pass per trace.\n");
+    fprintf(stderr, "\t-s         Stream mm traces in chunks instead of loading them.\n");
+    fprintf(stderr, "\t-S <ms>    With -C thread, scavenge idle thread caches every <ms>\n");
+    fprintf(stderr, "\t           milliseconds and as the heap grows (0: only as it grows).\n");
+    fprintf(stderr, "\t-M <lock>  With -x, the heap lock: mutex, adaptive (spin, then\n");
+    fprintf(stderr, "\t           park on a futex) or ticket.\n");
+    fprintf(stderr, "\t-O         With -x, queue frees for a background thread to do.\n");
+    fprintf(stderr, "\t-P <pat>   Re-touch pattern for -T: none, recent, random.\n");
+    fprintf(stderr, "\t-T <bytes> Touch up to <bytes> of each payload when timing (not with -s).\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-Z         With -x, zero large free blocks in a background thread,\n");
+    fprintf(stderr, "\t           so callocs served from them skip the memset.\n");
+    fprintf(stderr, "\t-W <file>  Build each trace's state at its peak in the heap file\n");
+    fprintf(stderr, "\t           <file>, check it from a second process, then time\n");
+    fprintf(stderr, "\t           reopening it against the rebuild.\n");
+    fprintf(stderr, "\t-x <mode>  Replay on one thread per trace thread id, either\n");
+    fprintf(stderr, "\t           as fast as possible (fast) or at the trace's pace (timed).\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
@@ -2,6 +2,12 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ * The heap is either private memory or, with mem_init_file, a file
+ * mapped shared at MEM_FILE_BASE. The file starts with a page that
+ * records the brk, so that a later process mapping the same file at the
+ * same address finds the heap, and the pointers stored in it, as the
+ * last one left them.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,6 +16,8 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 
 #include "memlib.h"
 #include "config.h"
@@ -18,28 +26,127 @@
 char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static size_t mem_limit = MAX_HEAP; /* most bytes the heap may grow to */
+static int mem_quiet;        /* refuse to grow without a message? */
+
+#define MEM_MAGIC 0x6d656d6c69626870UL /* marks a heap file */
+#define MEM_HDR   4096                 /* file bytes ahead of the heap */
+
+/* The first page of a heap file */
+typedef struct {
+    uint64_t magic;   /* MEM_MAGIC once the file holds a heap */
+    char *base;       /* address the file was mapped at */
+    size_t brk;       /* heap bytes in use */
+} mem_file_t;
+
+static mem_file_t *mem_file; /* header of a file-backed heap, or NULL */
+static int mem_fd = -1;      /* ... and the file */
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
+    /* 
+     * allocate the storage we will use to model the available VM, on a
+     * page boundary so that the heap's pages and cache lines are the
+     * machine's
+     */
+    if ((mem_start_brk = (char *)aligned_alloc(4096, MAX_HEAP)) == NULL) {
 	fprintf(stderr, "mem_init_vm: malloc error\n");
 	exit(1);
     }
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
+    mem_max_addr = mem_start_brk + mem_limit; /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
 }
 
+/*
+ * mem_init_file - initialize the memory system model over the file at
+ *    path, created if need be and mapped shared at MEM_FILE_BASE.
+ *    Returns 1 if the file held a heap, which comes back with its brk
+ *    where it was, or 0 if the heap starts out empty.
+ */
+int mem_init_file(const char *path)
+{
+    char *base;
+
+    if ((mem_fd = open(path, O_RDWR | O_CREAT, 0644)) < 0 ||
+	ftruncate(mem_fd, MEM_HDR + MAX_HEAP) < 0) {
+	fprintf(stderr, "mem_init_file: %s: %s\n", path, strerror(errno));
+	exit(1);
+    }
+    base = mmap(MEM_FILE_BASE, MEM_HDR + MAX_HEAP, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_FIXED_NOREPLACE, mem_fd, 0);
+    if (base != MEM_FILE_BASE) {
+	fprintf(stderr, "mem_init_file: can't map %s at %p\n", path, 
+		MEM_FILE_BASE);
+	exit(1);
+    }
+
+    mem_file = (mem_file_t *)base;
+    mem_start_brk = base + MEM_HDR;
+    mem_max_addr = mem_start_brk + mem_limit;
+    if (mem_file->magic == MEM_MAGIC && mem_file->base == base &&
+	mem_file->brk <= MAX_HEAP) {
+	mem_brk = mem_start_brk + mem_file->brk;
+	return 1;
+    }
+    mem_file->magic = MEM_MAGIC;
+    mem_file->base = base;
+    mem_file->brk = 0;
+    mem_brk = mem_start_brk;
+    return 0;
+}
+
+/*
+ * mem_set_limit - let the heap grow to at most bytes, a budget below
+ *    MAX_HEAP; 0 lifts it
+ */
+void mem_set_limit(size_t bytes)
+{
+    mem_limit = (bytes == 0 || bytes > MAX_HEAP) ? MAX_HEAP : bytes;
+    if (mem_start_brk != NULL)
+	mem_max_addr = mem_start_brk + mem_limit;
+}
+
+/*
+ * mem_sync - write the dirty pages of a file-backed heap, and its brk,
+ *    back to the file, and wait until they are there; nothing to do for
+ *    a heap in memory
+ */
+void mem_sync(void)
+{
+    if (mem_file != NULL && 
+	msync(mem_file, MEM_HDR + (mem_brk - mem_start_brk), MS_SYNC) < 0) {
+	fprintf(stderr, "mem_sync: %s\n", strerror(errno));
+	exit(1);
+    }
+}
+
+/*
+ * mem_set_quiet - refuse to grow the heap silently, for a caller that
+ *    expects refusals and handles them, or not
+ */
+void mem_set_quiet(int quiet)
+{
+    mem_quiet = quiet;
+}
+
 /* 
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    if (mem_file != NULL) {
+	/* the kernel writes the dirty pages back to the file */
+	munmap(mem_file, MEM_HDR + MAX_HEAP);
+	close(mem_fd);
+	mem_file = NULL;
+	mem_fd = -1;
+    } else
+	free(mem_start_brk);
+    mem_start_brk = NULL;
 }
 
 /*
@@ -48,23 +155,39 @@ void mem_deinit(void)
 void mem_reset_brk()
 {
     mem_brk = mem_start_brk;
+    if (mem_file != NULL)
+	mem_file->brk = 0;
+}
+
+/*
+ * mem_release - give the pages of a heap in memory back to the kernel,
+ *    so that the next pass over an empty heap faults in afresh whatever
+ *    it touches; a file-backed heap keeps its pages
+ */
+void mem_release(void)
+{
+    if (mem_file == NULL && mem_start_brk != NULL)
+	madvise(mem_start_brk, MAX_HEAP, MADV_DONTNEED);
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area, or
+ *    with a negative incr, shrinks it by -incr bytes.
  */
 void *mem_sbrk(int incr) 
 {
     char *old_brk = mem_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ( (mem_brk + incr < mem_start_brk) || ((mem_brk + incr) > mem_max_addr)) {
 	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	if (!mem_quiet)
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
     mem_brk += incr;
+    if (mem_file != NULL)
+	mem_file->brk = mem_brk - mem_start_brk;
     return (void *)old_brk;
 }
 
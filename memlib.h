@@ -1,9 +1,14 @@
 #include <unistd.h>
 
 void mem_init(void);               
+int mem_init_file(const char *path);
 void mem_deinit(void);
+void mem_sync(void);
+void mem_set_limit(size_t bytes);
+void mem_set_quiet(int quiet);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
+void mem_release(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
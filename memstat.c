@@ -0,0 +1,100 @@
+/*
+ * memstat.c - page fault and RSS accounting for one pass of a trace.
+ *
+ * Faults come from getrusage and the current RSS from /proc/self/statm.
+ * For the peak, memstat_start resets the kernel's RSS high water mark
+ * through /proc/self/clear_refs, and memstat_stop reads it back as
+ * VmHWM from /proc/self/status. Where clear_refs can't be written, the
+ * peak is the larger of the RSS at the start and the end.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "memstat.h"
+
+/*
+ * current_rss - resident bytes, from the second field of statm
+ */
+static long current_rss(void)
+{
+    FILE *fp;
+    long size, resident = 0;
+
+    if ((fp = fopen("/proc/self/statm", "r")) == NULL)
+	return 0;
+    if (fscanf(fp, "%ld %ld", &size, &resident) != 2)
+	resident = 0;
+    fclose(fp);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * peak_rss - the RSS high water mark in bytes, or -1 if unknown
+ */
+static long peak_rss(void)
+{
+    FILE *fp;
+    char line[256];
+    long kb = -1;
+
+    if ((fp = fopen("/proc/self/status", "r")) == NULL)
+	return -1;
+    while (fgets(line, sizeof(line), fp) != NULL)
+	if (sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+	    break;
+    fclose(fp);
+    return (kb < 0) ? -1 : kb * 1024;
+}
+
+/*
+ * reset_peak_rss - restart the high water mark from the current RSS
+ */
+static int reset_peak_rss(void)
+{
+    FILE *fp;
+    int ok;
+
+    if ((fp = fopen("/proc/self/clear_refs", "w")) == NULL)
+	return 0;
+    ok = (fputs("5", fp) >= 0);
+    return (fclose(fp) == 0) && ok;
+}
+
+/* Was the high water mark reset by the last memstat_start? */
+static int peak_was_reset;
+
+/*
+ * memstat_start - take the counters at the start of a pass
+ */
+void memstat_start(memsnap_t *snap)
+{
+    struct rusage ru;
+
+    peak_was_reset = reset_peak_rss();
+    getrusage(RUSAGE_SELF, &ru);
+    snap->minflt = ru.ru_minflt;
+    snap->majflt = ru.ru_majflt;
+    snap->rss = current_rss();
+}
+
+/*
+ * memstat_stop - work out what the pass since memstat_start cost
+ */
+void memstat_stop(memsnap_t *snap, memstat_t *st)
+{
+    struct rusage ru;
+    long rss, peak;
+
+    getrusage(RUSAGE_SELF, &ru);
+    rss = current_rss();
+    peak = peak_was_reset ? peak_rss() : -1;
+    if (peak < rss)
+	peak = (rss > snap->rss) ? rss : snap->rss;
+
+    st->minflt = ru.ru_minflt - snap->minflt;
+    st->majflt = ru.ru_majflt - snap->majflt;
+    st->rss_delta = rss - snap->rss;
+    st->peak_delta = peak - snap->rss;
+}
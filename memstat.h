@@ -0,0 +1,28 @@
+/*
+ * memstat.h - page faults and resident set size of the mdriver process
+ *             over one pass of a trace, as the OS sees them
+ */
+#ifndef __MEMSTAT_H_
+#define __MEMSTAT_H_
+
+#include <stddef.h>
+
+/* The process counters at the start of a pass */
+typedef struct {
+    long minflt;       /* minor page faults so far */
+    long majflt;       /* major page faults so far */
+    long rss;          /* resident bytes */
+} memsnap_t;
+
+/* What a pass cost */
+typedef struct {
+    long minflt;       /* minor page faults during the pass */
+    long majflt;       /* major page faults during the pass */
+    long rss_delta;    /* resident bytes at the end minus at the start */
+    long peak_delta;   /* peak resident bytes minus those at the start */
+} memstat_t;
+
+void memstat_start(memsnap_t *snap);
+void memstat_stop(memsnap_t *snap, memstat_t *st);
+
+#endif /* __MEMSTAT_H_ */
@@ -0,0 +1,462 @@
+/*
+ * mm-aofit.c - Allocator based on address-ordered first fit, with the
+ *              free blocks indexed by a search tree, and boundary tag
+ *              coalescing.
+ *
+ * Blocks have the same header and footer as in mm.c, and the heap the
+ * same prologue and epilogue. The free blocks also form a binary search
+ * tree keyed by address, where each node records the largest block in
+ * its subtree:
+ *
+ *      ----------------------------------------------------------
+ *     | hdr(s:f) | left | right | max | ...            | ftr(s:f) |
+ *      ----------------------------------------------------------
+ *                ^ bp
+ *
+ * The lowest-addressed block that fits is then found by walking down
+ * from the root: go left while the left subtree has a big enough block,
+ * else take this block if it fits, else go right. The tree is a treap
+ * whose priorities are a hash of each block's address, so it is
+ * balanced in expectation and no priority has to be stored. Links are
+ * 32-bit offsets from mem_heap_lo(), as in mm-explicit.c, and the three
+ * tree words put the minimum block at 24 bytes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "allocator.h"
+#include "memlib.h"
+
+#define WSIZE 4             /* word size (bytes) */
+#define DSIZE 8             /* doubleword size (bytes) */
+#define CHUNKSIZE (1 << 12) /* initial heap size (bytes) */
+#define OVERHEAD 8          /* overhead of header and footer (bytes) */
+#define MINBLOCK 24         /* hdr + left + right + max + ftr, aligned */
+
+static inline uint32_t MAX(uint32_t x, uint32_t y)
+{
+  return x > y ? x : y;
+}
+
+//
+// Boundary tags, as in mm.c
+//
+static inline uint32_t PACK(uint32_t size, int alloc)
+{
+  return ((size) | (alloc & 0x1));
+}
+
+static inline uint32_t GET(void *p) { return *(uint32_t *)p; }
+static inline void PUT(void *p, uint32_t val)
+{
+  *((uint32_t *)p) = val;
+}
+
+static inline uint32_t GET_SIZE(void *p)
+{
+  return GET(p) & ~0x7;
+}
+
+static inline int GET_ALLOC(void *p)
+{
+  return GET(p) & 0x1;
+}
+
+static inline void *HEADER(void *bp)
+{
+  return ((char *)bp) - WSIZE;
+}
+static inline void *FOOTER(void *bp)
+{
+  return ((char *)(bp) + GET_SIZE(HEADER(bp)) - DSIZE);
+}
+
+static inline void SET_BLOCK_DATA(void *bp, uint32_t size, int alloc)
+{
+  uint32_t boundaryData = PACK(size, alloc);
+  PUT(HEADER(bp), boundaryData);
+  PUT(FOOTER(bp), boundaryData);
+}
+
+static inline void *NEXT_BLOCK(void *bp)
+{
+  return ((char *)(bp) + GET_SIZE(((char *)(bp)-WSIZE)));
+}
+
+static inline void *PREVIOUS_BLOCK(void *bp)
+{
+  return ((char *)(bp)-GET_SIZE(((char *)(bp)-DSIZE)));
+}
+
+//
+// Tree nodes. A node is named by its offset from mem_heap_lo(), and 0
+// is the empty tree.
+//
+static inline char *NODE(uint32_t t) { return (char *)mem_heap_lo() + t; }
+static inline uint32_t OFFSET(void *bp)
+{
+  return (uint32_t)((char *)bp - (char *)mem_heap_lo());
+}
+static inline uint32_t LEFT(uint32_t t) { return GET(NODE(t)); }
+static inline uint32_t RIGHT(uint32_t t) { return GET(NODE(t) + WSIZE); }
+static inline uint32_t MAXSIZE(uint32_t t)
+{
+  return t ? GET(NODE(t) + DSIZE) : 0;
+}
+static inline uint32_t SIZE(uint32_t t) { return GET_SIZE(HEADER(NODE(t))); }
+static inline void SET_LEFT(uint32_t t, uint32_t l) { PUT(NODE(t), l); }
+static inline void SET_RIGHT(uint32_t t, uint32_t r) { PUT(NODE(t) + WSIZE, r); }
+
+//
+// PRIORITY - the treap priority of node t, a hash of its offset. Block
+// offsets fall in regular patterns, so the hash must mix all the bits.
+//
+static inline uint32_t PRIORITY(uint32_t t)
+{
+  uint32_t h = t;
+
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  return h ^ (h >> 16);
+}
+
+//
+// Global Variables
+//
+static char *heap_listp; /* pointer to first block */
+static uint32_t root;    /* root of the free block tree */
+
+//
+// function prototypes for internal helper routines
+//
+static void *extend_heap(uint32_t words);
+static void place(void *bp, uint32_t asize);
+static void *find_fit(uint32_t asize);
+static void *coalesce(void *bp);
+static uint32_t tree_insert(uint32_t t, uint32_t x);
+static uint32_t tree_remove(uint32_t t, uint32_t x);
+static void *aofit_malloc(uint32_t size);
+static void aofit_free(void *bp);
+
+//
+// update - recompute the largest block under t from its children
+//
+static inline void update(uint32_t t)
+{
+  PUT(NODE(t) + DSIZE, MAX(SIZE(t), MAX(MAXSIZE(LEFT(t)), MAXSIZE(RIGHT(t)))));
+}
+
+static uint32_t rotate_right(uint32_t t)
+{
+  uint32_t l = LEFT(t);
+
+  SET_LEFT(t, RIGHT(l));
+  SET_RIGHT(l, t);
+  update(t);
+  update(l);
+  return l;
+}
+
+static uint32_t rotate_left(uint32_t t)
+{
+  uint32_t r = RIGHT(t);
+
+  SET_RIGHT(t, LEFT(r));
+  SET_LEFT(r, t);
+  update(t);
+  update(r);
+  return r;
+}
+
+//
+// tree_insert - insert free block x into the treap rooted at t and
+//               return the new root
+//
+static uint32_t tree_insert(uint32_t t, uint32_t x)
+{
+  if (t == 0)
+  {
+    SET_LEFT(x, 0);
+    SET_RIGHT(x, 0);
+    update(x);
+    return x;
+  }
+  if (x < t)
+  {
+    SET_LEFT(t, tree_insert(LEFT(t), x));
+    if (PRIORITY(LEFT(t)) > PRIORITY(t))
+      return rotate_right(t);
+  }
+  else
+  {
+    SET_RIGHT(t, tree_insert(RIGHT(t), x));
+    if (PRIORITY(RIGHT(t)) > PRIORITY(t))
+      return rotate_left(t);
+  }
+  update(t);
+  return t;
+}
+
+//
+// tree_remove - remove free block x from the treap rooted at t and
+//               return the new root. x is rotated down until it has at
+//               most one child, which then takes its place.
+//
+static uint32_t tree_remove(uint32_t t, uint32_t x)
+{
+  if (t == x)
+  {
+    if (LEFT(t) == 0)
+      return RIGHT(t);
+    if (RIGHT(t) == 0)
+      return LEFT(t);
+    if (PRIORITY(LEFT(t)) > PRIORITY(RIGHT(t)))
+    {
+      t = rotate_right(t);
+      SET_RIGHT(t, tree_remove(RIGHT(t), x));
+    }
+    else
+    {
+      t = rotate_left(t);
+      SET_LEFT(t, tree_remove(LEFT(t), x));
+    }
+  }
+  else if (x < t)
+    SET_LEFT(t, tree_remove(LEFT(t), x));
+  else
+    SET_RIGHT(t, tree_remove(RIGHT(t), x));
+  update(t);
+  return t;
+}
+
+static inline void index_insert(void *bp) { root = tree_insert(root, OFFSET(bp)); }
+static inline void index_remove(void *bp) { root = tree_remove(root, OFFSET(bp)); }
+
+//
+// adjust - the block size needed for size bytes of payload
+//
+static inline uint32_t adjust(uint32_t size)
+{
+  return MAX(MINBLOCK, DSIZE * ((size + (OVERHEAD) + (DSIZE - 1)) / DSIZE));
+}
+
+//
+// aofit_init - Initialize the memory manager
+//
+static int aofit_init(void)
+{
+  // Create the initial empty heap
+  if ((heap_listp = mem_sbrk(4 * WSIZE)) == (void *)-1)
+    return -1;
+  PUT(heap_listp, 0);                          // alignment padding
+  PUT(heap_listp + WSIZE, PACK(OVERHEAD, 1));  // prologue header
+  PUT(heap_listp + DSIZE, PACK(OVERHEAD, 1));  // prologue footer
+  PUT(heap_listp + WSIZE + DSIZE, PACK(0, 1)); // epilogue header
+  heap_listp += DSIZE;
+  root = 0;
+
+  // Extend the empty heap with a free block of CHUNKSIZE bytes
+  if (extend_heap(CHUNKSIZE / WSIZE) == NULL)
+    return -1;
+  return 0;
+}
+
+//
+// extend_heap - Extend heap with free block and return its block pointer
+//
+static void *extend_heap(uint32_t words)
+{
+  char *bp;
+  size_t size;
+
+  // Allocate an even number of words to maintain alignment
+  size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
+  if ((long)(bp = mem_sbrk(size)) == -1)
+    return NULL;
+
+  // Initialize free block header/footer and the epilogue header
+  SET_BLOCK_DATA(bp, size, 0);
+  PUT(HEADER(NEXT_BLOCK(bp)), PACK(0, 1)); // new epilogue header
+
+  // coalesce if the previous block was free
+  return coalesce(bp);
+}
+
+//
+// find_fit - the lowest-addressed free block of at least asize bytes
+//
+static void *find_fit(uint32_t asize)
+{
+  uint32_t t = root;
+
+  if (MAXSIZE(t) < asize)
+    return NULL; // no fit
+  for (;;)
+  {
+    if (MAXSIZE(LEFT(t)) >= asize)
+      t = LEFT(t);
+    else if (SIZE(t) >= asize)
+      return NODE(t);
+    else
+      t = RIGHT(t);
+  }
+}
+
+//
+// aofit_free - Free a block
+//
+static void aofit_free(void *bp)
+{
+  size_t size = GET_SIZE(HEADER(bp));
+
+  SET_BLOCK_DATA(bp, size, 0);
+  coalesce(bp);
+}
+
+//
+// coalesce - boundary tag coalescing of a block that is not in the tree
+//            yet. Puts the coalesced block in the tree and returns it.
+//
+static void *coalesce(void *bp)
+{
+  size_t previousAllocation = GET_ALLOC(FOOTER(PREVIOUS_BLOCK(bp)));
+  size_t nextAllocation = GET_ALLOC(HEADER(NEXT_BLOCK(bp)));
+  size_t size = GET_SIZE(HEADER(bp));
+
+  if (!nextAllocation)
+  {
+    index_remove(NEXT_BLOCK(bp));
+    size += GET_SIZE(HEADER(NEXT_BLOCK(bp)));
+    SET_BLOCK_DATA(bp, size, 0);
+  }
+  if (!previousAllocation)
+  {
+    bp = PREVIOUS_BLOCK(bp);
+    index_remove(bp);
+    size += GET_SIZE(HEADER(bp));
+    SET_BLOCK_DATA(bp, size, 0);
+  }
+  index_insert(bp);
+  return bp;
+}
+
+//
+// aofit_malloc - Allocate a block with at least size bytes of payload
+//
+static void *aofit_malloc(uint32_t size)
+{
+  uint32_t asize;      /* adjusted block size */
+  uint32_t extendsize; /* amount to extend heap if no fit */
+  char *bp;
+
+  /* Ignore spurious requests */
+  if (size <= 0)
+    return NULL;
+
+  asize = adjust(size);
+
+  /* Search the tree for a fit */
+  if ((bp = find_fit(asize)) != NULL)
+  {
+    place(bp, asize);
+    return bp;
+  }
+
+  /* No fit found. Get more memory and place the block */
+  extendsize = MAX(asize, CHUNKSIZE);
+  if ((bp = extend_heap(extendsize / WSIZE)) == NULL)
+    return NULL;
+  place(bp, asize);
+  return bp;
+}
+
+//
+// place - Place block of asize bytes at start of free block bp
+//         and split if remainder would be at least minimum block size
+//
+static void place(void *bp, uint32_t asize)
+{
+  size_t csize = GET_SIZE(HEADER(bp));
+
+  index_remove(bp);
+  if ((csize - asize) >= MINBLOCK)
+  {
+    SET_BLOCK_DATA(bp, asize, 1);
+    bp = NEXT_BLOCK(bp);
+    SET_BLOCK_DATA(bp, csize - asize, 0);
+    coalesce(bp);
+  }
+  else
+  {
+    SET_BLOCK_DATA(bp, csize, 1);
+  }
+}
+
+//
+// aofit_realloc - Resize a block, in place when it shrinks or when the
+//                 next block is free and big enough to grow into
+//
+static void *aofit_realloc(void *ptr, uint32_t size)
+{
+  void *newp;
+  void *next;
+  uint32_t oldsize, asize, csize, copySize;
+
+  if (ptr == NULL)
+    return aofit_malloc(size);
+  if (size == 0)
+  {
+    aofit_free(ptr);
+    return NULL;
+  }
+
+  oldsize = GET_SIZE(HEADER(ptr));
+  asize = adjust(size);
+
+  // shrink in place, giving back the tail if it can stand as a block
+  if (asize <= oldsize)
+  {
+    if ((oldsize - asize) >= MINBLOCK)
+    {
+      SET_BLOCK_DATA(ptr, asize, 1);
+      SET_BLOCK_DATA(NEXT_BLOCK(ptr), oldsize - asize, 0);
+      coalesce(NEXT_BLOCK(ptr));
+    }
+    return ptr;
+  }
+
+  // grow in place by absorbing the next block
+  next = NEXT_BLOCK(ptr);
+  csize = oldsize + GET_SIZE(HEADER(next));
+  if (!GET_ALLOC(HEADER(next)) && csize >= asize)
+  {
+    index_remove(next);
+    if ((csize - asize) >= MINBLOCK)
+    {
+      SET_BLOCK_DATA(ptr, asize, 1);
+      SET_BLOCK_DATA(NEXT_BLOCK(ptr), csize - asize, 0);
+      coalesce(NEXT_BLOCK(ptr));
+    }
+    else
+    {
+      SET_BLOCK_DATA(ptr, csize, 1);
+    }
+    return ptr;
+  }
+
+  if ((newp = aofit_malloc(size)) == NULL)
+    return NULL;
+  copySize = oldsize - OVERHEAD;
+  if (size < copySize)
+    copySize = size;
+  memcpy(newp, ptr, copySize);
+  aofit_free(ptr);
+  return newp;
+}
+
+allocator_t aofit_allocator = {
+  "aofit", aofit_init, aofit_malloc, aofit_free, aofit_realloc,
+  mem_reset_brk, mem_heapsize, 1
+};
@@ -0,0 +1,179 @@
+/*
+ * mm-buddy.c - Binary buddy allocator on top of memlib.
+ *
+ * Every block is 2^k bytes for some order k and starts at a multiple
+ * of 2^k from the start of the heap, so the buddy of the block at
+ * offset off is the one at off ^ 2^k. Each block begins with a
+ * doubleword header:
+ *
+ *      31             9  8  7            0
+ *      ---------------------------------
+ *     | 0  0  ...  0  0 | a | order k    |
+ *      ---------------------------------
+ *
+ * Free blocks also hold the next and previous links of the free list
+ * for their order, which puts the smallest block at 32 bytes.
+ *
+ * The heap only grows as far as it has to. To add a block of order k
+ * at the end of the heap, the end is first padded out to a multiple
+ * of 2^k with the largest aligned free blocks that fit.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "memlib.h"
+
+#define DSIZE     8   /* doubleword size (bytes) */
+#define MINORDER  5   /* smallest block is 32 bytes */
+#define MAXORDER  30  /* largest block is 1GB */
+
+/* A free block: header, then the free list links */
+typedef struct free_block {
+    uint32_t hdr;
+    uint32_t pad;
+    struct free_block *next;
+    struct free_block *prev;
+} free_block_t;
+
+/* Free lists, one per order */
+static free_block_t *free_lists[MAXORDER + 1];
+
+static inline uint32_t PACK(int order, int alloc)
+{
+    return order | (alloc << 8);
+}
+static inline int GET_ORDER(void *bp) { return *(uint32_t *)bp & 0xff; }
+static inline int GET_ALLOC(void *bp) { return (*(uint32_t *)bp >> 8) & 1; }
+
+static inline size_t OFFSET(void *bp)
+{
+    return (char *)bp - (char *)mem_heap_lo();
+}
+
+static void list_insert(free_block_t *bp, int order)
+{
+    bp->hdr = PACK(order, 0);
+    bp->prev = NULL;
+    bp->next = free_lists[order];
+    if (bp->next != NULL)
+	bp->next->prev = bp;
+    free_lists[order] = bp;
+}
+
+static void list_remove(free_block_t *bp)
+{
+    if (bp->prev != NULL)
+	bp->prev->next = bp->next;
+    else
+	free_lists[GET_ORDER(bp)] = bp->next;
+    if (bp->next != NULL)
+	bp->next->prev = bp->prev;
+}
+
+/*
+ * release - free the block at bp, merging it with its buddy for as
+ *     long as the buddy is free and whole
+ */
+static void release(char *bp, int order)
+{
+    size_t off = OFFSET(bp);
+    char *buddy;
+
+    while (order < MAXORDER) {
+	if ((off ^ ((size_t)1 << order)) + ((size_t)1 << order) > mem_heapsize())
+	    break;
+	buddy = (char *)mem_heap_lo() + (off ^ ((size_t)1 << order));
+	if (GET_ALLOC(buddy) || GET_ORDER(buddy) != order)
+	    break;
+	list_remove((free_block_t *)buddy);
+	off &= ~((size_t)1 << order);
+	order++;
+    }
+    list_insert((free_block_t *)((char *)mem_heap_lo() + off), order);
+}
+
+/*
+ * grow - add free space at the end of the heap, either padding to
+ *     align it for a block of the given order or that block itself
+ */
+static int grow(int order)
+{
+    size_t off = mem_heapsize();
+    int k = order;
+    char *bp;
+
+    /* Pad with the largest block the current end is aligned for */
+    if (off & (((size_t)1 << order) - 1))
+	for (k = MINORDER; !(off & ((size_t)1 << k)); k++)
+	    ;
+    if ((bp = mem_sbrk(1 << k)) == (void *)-1)
+	return -1;
+    *(uint32_t *)bp = PACK(k, 1);
+    release(bp, k);
+    return 0;
+}
+
+static int buddy_init(void)
+{
+    memset(free_lists, 0, sizeof(free_lists));
+    return 0;
+}
+
+static void *buddy_malloc(uint32_t size)
+{
+    int order = MINORDER;
+    int k;
+    free_block_t *bp;
+
+    while (((size_t)1 << order) < (size_t)size + DSIZE)
+	order++;
+    if (order > MAXORDER)
+	return NULL;
+
+    for (;;) {
+	for (k = order; k <= MAXORDER && free_lists[k] == NULL; k++)
+	    ;
+	if (k <= MAXORDER)
+	    break;
+	if (grow(order) < 0)
+	    return NULL;
+    }
+
+    /* Split down to the order we need, freeing the upper halves */
+    bp = free_lists[k];
+    list_remove(bp);
+    while (k > order) {
+	k--;
+	list_insert((free_block_t *)((char *)bp + ((size_t)1 << k)), k);
+    }
+    bp->hdr = PACK(order, 1);
+    return (char *)bp + DSIZE;
+}
+
+static void buddy_free(void *ptr)
+{
+    char *bp = (char *)ptr - DSIZE;
+
+    release(bp, GET_ORDER(bp));
+}
+
+static void *buddy_realloc(void *ptr, uint32_t size)
+{
+    char *bp = (char *)ptr - DSIZE;
+    size_t oldsize = ((size_t)1 << GET_ORDER(bp)) - DSIZE;
+    void *newp;
+
+    if (size <= oldsize)
+	return ptr;
+    if ((newp = buddy_malloc(size)) == NULL)
+	return NULL;
+    memcpy(newp, ptr, oldsize);
+    buddy_free(ptr);
+    return newp;
+}
+
+allocator_t buddy_allocator = {
+    "buddy", buddy_init, buddy_malloc, buddy_free, buddy_realloc,
+    mem_reset_brk, mem_heapsize, 1
+};
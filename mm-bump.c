@@ -0,0 +1,51 @@
+/*
+ * mm-bump.c - The simplest possible allocator: every request is carved
+ *             off the end of the heap and nothing is ever reused.
+ *
+ * Each payload is preceded by a doubleword holding its size, which is
+ * all realloc needs to copy the old data. It gives the upper bound on
+ * throughput and the lower bound on utilization for the other packages.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "memlib.h"
+
+#define DSIZE 8  /* doubleword size (bytes) */
+
+static int bump_init(void)
+{
+    return 0;
+}
+
+static void *bump_malloc(uint32_t size)
+{
+    char *bp;
+    uint32_t asize = DSIZE * ((size + DSIZE + (DSIZE - 1)) / DSIZE);
+
+    if ((bp = mem_sbrk(asize)) == (void *)-1)
+	return NULL;
+    *(uint32_t *)bp = size;
+    return bp + DSIZE;
+}
+
+static void bump_free(void *ptr)
+{
+}
+
+static void *bump_realloc(void *ptr, uint32_t size)
+{
+    void *newp;
+    uint32_t oldsize = *(uint32_t *)((char *)ptr - DSIZE);
+
+    if ((newp = bump_malloc(size)) == NULL)
+	return NULL;
+    memcpy(newp, ptr, oldsize < size ? oldsize : size);
+    return newp;
+}
+
+allocator_t bump_allocator = {
+    "bump", bump_init, bump_malloc, bump_free, bump_realloc, 
+    mem_reset_brk, mem_heapsize, 1
+};
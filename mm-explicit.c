@@ -0,0 +1,404 @@
+/*
+ * mm-explicit.c - Allocator based on an explicit free list, first fit
+ *                 placement, and boundary tag coalescing.
+ *
+ * Blocks have the same header and footer as in mm.c, and the heap the
+ * same prologue and epilogue. Free blocks are also linked into a
+ * doubly linked LIFO free list, so a search only visits free blocks and
+ * unlinking a block on coalescing is O(1):
+ *
+ *      ---------------------------------------------------
+ *     | hdr(s:f) | next | prev | ...             | ftr(s:f) |
+ *      ---------------------------------------------------
+ *                ^ bp
+ *
+ * The links are 32-bit offsets from mem_heap_lo(), with 0 standing for
+ * NULL (offset 0 is the alignment pad, never a block). A free block
+ * then needs 4 + 4 + 4 + 4 bytes, so the minimum block stays at 16 bytes
+ * (DSIZE + OVERHEAD) as in mm.c. Built with -DFULL_POINTERS the links are
+ * ordinary 8-byte pointers instead, which puts the minimum block at 24
+ * bytes; that build is registered as "explicit-ptr" for comparison.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "allocator.h"
+#include "memlib.h"
+
+#define WSIZE 4             /* word size (bytes) */
+#define DSIZE 8             /* doubleword size (bytes) */
+#define CHUNKSIZE (1 << 12) /* initial heap size (bytes) */
+#define OVERHEAD 8          /* overhead of header and footer (bytes) */
+
+#ifdef FULL_POINTERS
+#define MINBLOCK 24         /* hdr + two 8-byte links + ftr */
+#define ALLOCATOR explicit_ptr_allocator
+#define NAME "explicit-ptr"
+#else
+#define MINBLOCK 16         /* hdr + two 4-byte links + ftr */
+#define ALLOCATOR explicit_allocator
+#define NAME "explicit"
+#endif
+
+static inline uint32_t MAX(uint32_t x, uint32_t y)
+{
+  return x > y ? x : y;
+}
+
+//
+// Boundary tags, as in mm.c
+//
+static inline uint32_t PACK(uint32_t size, int alloc)
+{
+  return ((size) | (alloc & 0x1));
+}
+
+static inline uint32_t GET(void *p) { return *(uint32_t *)p; }
+static inline void PUT(void *p, uint32_t val)
+{
+  *((uint32_t *)p) = val;
+}
+
+static inline uint32_t GET_SIZE(void *p)
+{
+  return GET(p) & ~0x7;
+}
+
+static inline int GET_ALLOC(void *p)
+{
+  return GET(p) & 0x1;
+}
+
+static inline void *HEADER(void *bp)
+{
+  return ((char *)bp) - WSIZE;
+}
+static inline void *FOOTER(void *bp)
+{
+  return ((char *)(bp) + GET_SIZE(HEADER(bp)) - DSIZE);
+}
+
+static inline void SET_BLOCK_DATA(void *bp, uint32_t size, int alloc)
+{
+  uint32_t boundaryData = PACK(size, alloc);
+  PUT(HEADER(bp), boundaryData);
+  PUT(FOOTER(bp), boundaryData);
+}
+
+static inline void *NEXT_BLOCK(void *bp)
+{
+  return ((char *)(bp) + GET_SIZE(((char *)(bp)-WSIZE)));
+}
+
+static inline void *PREVIOUS_BLOCK(void *bp)
+{
+  return ((char *)(bp)-GET_SIZE(((char *)(bp)-DSIZE)));
+}
+
+//
+// Free list links. Only these four functions know how a link is
+// stored in a free block.
+//
+#ifdef FULL_POINTERS
+static inline void *NEXT_FREE(void *bp) { return *(void **)bp; }
+static inline void *PREV_FREE(void *bp) { return *((void **)bp + 1); }
+static inline void SET_NEXT_FREE(void *bp, void *p) { *(void **)bp = p; }
+static inline void SET_PREV_FREE(void *bp, void *p) { *((void **)bp + 1) = p; }
+#else
+static inline void *FROM_OFFSET(uint32_t off)
+{
+  return off ? (char *)mem_heap_lo() + off : NULL;
+}
+static inline uint32_t TO_OFFSET(void *p)
+{
+  return p ? (uint32_t)((char *)p - (char *)mem_heap_lo()) : 0;
+}
+static inline void *NEXT_FREE(void *bp) { return FROM_OFFSET(GET(bp)); }
+static inline void *PREV_FREE(void *bp)
+{
+  return FROM_OFFSET(GET((char *)bp + WSIZE));
+}
+static inline void SET_NEXT_FREE(void *bp, void *p) { PUT(bp, TO_OFFSET(p)); }
+static inline void SET_PREV_FREE(void *bp, void *p)
+{
+  PUT((char *)bp + WSIZE, TO_OFFSET(p));
+}
+#endif
+
+//
+// Global Variables
+//
+static char *heap_listp; /* pointer to first block */
+static void *free_listp; /* first block on the free list */
+
+//
+// function prototypes for internal helper routines
+//
+static void *extend_heap(uint32_t words);
+static void place(void *bp, uint32_t asize);
+static void *find_fit(uint32_t asize);
+static void *coalesce(void *bp);
+static void list_insert(void *bp);
+static void list_remove(void *bp);
+static void *explicit_malloc(uint32_t size);
+static void explicit_free(void *bp);
+
+//
+// list_insert - push a free block on the front of the free list
+//
+static void list_insert(void *bp)
+{
+  SET_NEXT_FREE(bp, free_listp);
+  SET_PREV_FREE(bp, NULL);
+  if (free_listp != NULL)
+    SET_PREV_FREE(free_listp, bp);
+  free_listp = bp;
+}
+
+//
+// list_remove - unlink a free block from the free list
+//
+static void list_remove(void *bp)
+{
+  void *prev = PREV_FREE(bp);
+  void *next = NEXT_FREE(bp);
+
+  if (prev != NULL)
+    SET_NEXT_FREE(prev, next);
+  else
+    free_listp = next;
+  if (next != NULL)
+    SET_PREV_FREE(next, prev);
+}
+
+//
+// adjust - the block size needed for size bytes of payload
+//
+static inline uint32_t adjust(uint32_t size)
+{
+  return MAX(MINBLOCK, DSIZE * ((size + (OVERHEAD) + (DSIZE - 1)) / DSIZE));
+}
+
+//
+// explicit_init - Initialize the memory manager
+//
+static int explicit_init(void)
+{
+  // Create the initial empty heap
+  if ((heap_listp = mem_sbrk(4 * WSIZE)) == (void *)-1)
+    return -1;
+  PUT(heap_listp, 0);                          // alignment padding
+  PUT(heap_listp + WSIZE, PACK(OVERHEAD, 1));  // prologue header
+  PUT(heap_listp + DSIZE, PACK(OVERHEAD, 1));  // prologue footer
+  PUT(heap_listp + WSIZE + DSIZE, PACK(0, 1)); // epilogue header
+  heap_listp += DSIZE;
+  free_listp = NULL;
+
+  // Extend the empty heap with a free block of CHUNKSIZE bytes
+  if (extend_heap(CHUNKSIZE / WSIZE) == NULL)
+    return -1;
+  return 0;
+}
+
+//
+// extend_heap - Extend heap with free block and return its block pointer
+//
+static void *extend_heap(uint32_t words)
+{
+  char *bp;
+  size_t size;
+
+  // Allocate an even number of words to maintain alignment
+  size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
+  if ((long)(bp = mem_sbrk(size)) == -1)
+    return NULL;
+
+  // Initialize free block header/footer and the epilogue header
+  SET_BLOCK_DATA(bp, size, 0);
+  PUT(HEADER(NEXT_BLOCK(bp)), PACK(0, 1)); // new epilogue header
+
+  // coalesce if the previous block was free
+  return coalesce(bp);
+}
+
+//
+// find_fit - first fit on the free list
+//
+static void *find_fit(uint32_t asize)
+{
+  void *bp;
+
+  for (bp = free_listp; bp != NULL; bp = NEXT_FREE(bp))
+  {
+    if (asize <= GET_SIZE(HEADER(bp)))
+      return bp;
+  }
+  return NULL; // no fit
+}
+
+//
+// explicit_free - Free a block
+//
+static void explicit_free(void *bp)
+{
+  size_t size = GET_SIZE(HEADER(bp));
+
+  SET_BLOCK_DATA(bp, size, 0);
+  coalesce(bp);
+}
+
+//
+// coalesce - boundary tag coalescing of a block that is not on the free
+//            list yet. Puts the coalesced block on the list and returns it.
+//
+static void *coalesce(void *bp)
+{
+  size_t previousAllocation = GET_ALLOC(FOOTER(PREVIOUS_BLOCK(bp)));
+  size_t nextAllocation = GET_ALLOC(HEADER(NEXT_BLOCK(bp)));
+  size_t size = GET_SIZE(HEADER(bp));
+
+  if (previousAllocation && !nextAllocation)
+  {
+    list_remove(NEXT_BLOCK(bp));
+    size += GET_SIZE(HEADER(NEXT_BLOCK(bp)));
+    SET_BLOCK_DATA(bp, size, 0);
+  }
+  else if (!previousAllocation && nextAllocation)
+  {
+    bp = PREVIOUS_BLOCK(bp);
+    list_remove(bp);
+    size += GET_SIZE(HEADER(bp));
+    SET_BLOCK_DATA(bp, size, 0);
+  }
+  else if (!previousAllocation && !nextAllocation)
+  {
+    list_remove(NEXT_BLOCK(bp));
+    size += GET_SIZE(HEADER(NEXT_BLOCK(bp)));
+    bp = PREVIOUS_BLOCK(bp);
+    list_remove(bp);
+    size += GET_SIZE(HEADER(bp));
+    SET_BLOCK_DATA(bp, size, 0);
+  }
+  list_insert(bp);
+  return bp;
+}
+
+//
+// explicit_malloc - Allocate a block with at least size bytes of payload
+//
+static void *explicit_malloc(uint32_t size)
+{
+  uint32_t asize;    /* adjusted block size */
+  uint32_t extendsize; /* amount to extend heap if no fit */
+  char *bp;
+
+  /* Ignore spurious requests */
+  if (size <= 0)
+    return NULL;
+
+  asize = adjust(size);
+
+  /* Search the free list for a fit */
+  if ((bp = find_fit(asize)) != NULL)
+  {
+    place(bp, asize);
+    return bp;
+  }
+
+  /* No fit found. Get more memory and place the block */
+  extendsize = MAX(asize, CHUNKSIZE);
+  if ((bp = extend_heap(extendsize / WSIZE)) == NULL)
+    return NULL;
+  place(bp, asize);
+  return bp;
+}
+
+//
+// place - Place block of asize bytes at start of free block bp
+//         and split if remainder would be at least minimum block size
+//
+static void place(void *bp, uint32_t asize)
+{
+  size_t csize = GET_SIZE(HEADER(bp));
+
+  list_remove(bp);
+  if ((csize - asize) >= MINBLOCK)
+  {
+    SET_BLOCK_DATA(bp, asize, 1);
+    bp = NEXT_BLOCK(bp);
+    SET_BLOCK_DATA(bp, csize - asize, 0);
+    coalesce(bp);
+  }
+  else
+  {
+    SET_BLOCK_DATA(bp, csize, 1);
+  }
+}
+
+//
+// explicit_realloc - Resize a block, in place when it shrinks or when
+//                    the next block is free and big enough to grow into
+//
+static void *explicit_realloc(void *ptr, uint32_t size)
+{
+  void *newp;
+  void *next;
+  uint32_t oldsize, asize, csize, copySize;
+
+  if (ptr == NULL)
+    return explicit_malloc(size);
+  if (size == 0)
+  {
+    explicit_free(ptr);
+    return NULL;
+  }
+
+  oldsize = GET_SIZE(HEADER(ptr));
+  asize = adjust(size);
+
+  // shrink in place, giving back the tail if it can stand as a block
+  if (asize <= oldsize)
+  {
+    if ((oldsize - asize) >= MINBLOCK)
+    {
+      SET_BLOCK_DATA(ptr, asize, 1);
+      SET_BLOCK_DATA(NEXT_BLOCK(ptr), oldsize - asize, 0);
+      coalesce(NEXT_BLOCK(ptr));
+    }
+    return ptr;
+  }
+
+  // grow in place by absorbing the next block. ptr never goes on the
+  // free list, as the links would overwrite its payload.
+  next = NEXT_BLOCK(ptr);
+  csize = oldsize + GET_SIZE(HEADER(next));
+  if (!GET_ALLOC(HEADER(next)) && csize >= asize)
+  {
+    list_remove(next);
+    if ((csize - asize) >= MINBLOCK)
+    {
+      SET_BLOCK_DATA(ptr, asize, 1);
+      SET_BLOCK_DATA(NEXT_BLOCK(ptr), csize - asize, 0);
+      coalesce(NEXT_BLOCK(ptr));
+    }
+    else
+    {
+      SET_BLOCK_DATA(ptr, csize, 1);
+    }
+    return ptr;
+  }
+
+  if ((newp = explicit_malloc(size)) == NULL)
+    return NULL;
+  copySize = oldsize - OVERHEAD;
+  if (size < copySize)
+    copySize = size;
+  memcpy(newp, ptr, copySize);
+  explicit_free(ptr);
+  return newp;
+}
+
+allocator_t ALLOCATOR = {
+  NAME, explicit_init, explicit_malloc, explicit_free, explicit_realloc,
+  mem_reset_brk, mem_heapsize, 1
+};
@@ -0,0 +1,351 @@
+/*
+ * mm-tlsf.c - Two-level segregated fit (TLSF) allocator on top of memlib.
+ *
+ * Free blocks are kept on segregated lists indexed by two levels: the
+ * first level is floor(log2(size)), and the second splits each power of
+ * two range into SL_COUNT equal classes. A bitmap at each level marks
+ * the nonempty lists, so finding a list whose blocks all fit takes a
+ * couple of find-first-set instructions, and no list is ever searched.
+ * Free blocks are coalesced with both neighbors right away, which takes
+ * at most two unlinks. Apart from growing the heap, malloc and free do
+ * a bounded amount of work whatever the state of the heap.
+ *
+ * Each block starts with a one-word header. Free blocks also hold their
+ * list links, as 32-bit offsets from mem_heap_lo() as in mm-explicit.c,
+ * and a footer with their size:
+ *
+ *      31                     3  2  1  0
+ *      -----------------------------------
+ *     | s  s  s  s  ... s  s  s  0  pf  a |   header
+ *      -----------------------------------
+ *
+ *      --------------------------------------------------
+ *     | hdr | next | prev |   ...           | size      |   free block
+ *      --------------------------------------------------
+ *           ^ bp
+ *
+ * where a is set iff the block is allocated and pf is set iff the block
+ * before it is free. Allocated blocks need no footer, since only a free
+ * block's size is ever needed to find the block before another. The heap
+ * starts with a word of padding and ends with an allocated header of
+ * size 0 (the epilogue); the first block's pf bit is always clear.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "memlib.h"
+
+#define WSIZE       4             /* word size (bytes) */
+#define DSIZE       8             /* doubleword size (bytes) */
+#define CHUNKSIZE   (1 << 12)     /* least the heap grows by (bytes) */
+#define MINBLOCK    16            /* hdr + two links + footer */
+
+#define ALIGN_LOG2  3             /* blocks are multiples of 8 bytes */
+#define SL_LOG2     4             /* log2 of the second-level classes */
+#define SL_COUNT    (1 << SL_LOG2)
+#define FL_SHIFT    (SL_LOG2 + ALIGN_LOG2)
+#define SMALL_BLOCK (1 << FL_SHIFT) /* sizes below this share first level 0 */
+#define FL_COUNT    (32 - FL_SHIFT + 1)
+
+#define ALLOC_BIT     0x1
+#define PREV_FREE_BIT 0x2
+
+/* The head of each list, and the bitmaps of the nonempty ones */
+static char *heads[FL_COUNT][SL_COUNT];
+static uint32_t fl_bitmap;
+static uint32_t sl_bitmap[FL_COUNT];
+
+/* Headers, footers and links */
+static inline uint32_t GET(void *p) { return *(uint32_t *)p; }
+static inline void PUT(void *p, uint32_t val) { *(uint32_t *)p = val; }
+
+static inline uint32_t *HEADER(char *bp) { return (uint32_t *)(bp - WSIZE); }
+static inline uint32_t SIZE(char *bp) { return *HEADER(bp) & ~0x7; }
+static inline int IS_ALLOC(char *bp) { return *HEADER(bp) & ALLOC_BIT; }
+static inline int IS_PREV_FREE(char *bp) { return *HEADER(bp) & PREV_FREE_BIT; }
+static inline char *NEXT_BLOCK(char *bp) { return bp + SIZE(bp); }
+static inline char *PREV_BLOCK(char *bp)
+{
+    return bp - GET(bp - DSIZE);
+}
+
+static inline void SET_PREV_FREE(char *bp, int prev_free)
+{
+    if (prev_free)
+	*HEADER(bp) |= PREV_FREE_BIT;
+    else
+	*HEADER(bp) &= ~PREV_FREE_BIT;
+}
+
+static inline char *FROM_OFFSET(uint32_t off)
+{
+    return off ? (char *)mem_heap_lo() + off : NULL;
+}
+static inline uint32_t TO_OFFSET(char *p)
+{
+    return p ? (uint32_t)(p - (char *)mem_heap_lo()) : 0;
+}
+static inline char *NEXT_FREE(char *bp) { return FROM_OFFSET(GET(bp)); }
+static inline char *PREV_FREE(char *bp) { return FROM_OFFSET(GET(bp + WSIZE)); }
+
+/* fls - index of the most significant set bit of x > 0 */
+static inline int fls(uint32_t x)
+{
+    return 31 - __builtin_clz(x);
+}
+
+/*
+ * mapping_insert - the list a free block of the given size goes on
+ */
+static inline void mapping_insert(uint32_t size, int *fl, int *sl)
+{
+    if (size < SMALL_BLOCK) {
+	*fl = 0;
+	*sl = size >> ALIGN_LOG2;
+    }
+    else {
+	*fl = fls(size) - FL_SHIFT + 1;
+	*sl = (size >> (fls(size) - SL_LOG2)) ^ SL_COUNT;
+    }
+}
+
+/*
+ * mapping_search - the first list whose blocks all hold size bytes:
+ *     round size up to the next class boundary, then map it
+ */
+static inline void mapping_search(uint32_t size, int *fl, int *sl)
+{
+    if (size >= SMALL_BLOCK)
+	size += (1 << (fls(size) - SL_LOG2)) - 1;
+    mapping_insert(size, fl, sl);
+}
+
+/*
+ * find_suitable - the first nonempty list at or above (fl, sl), using
+ *     only the bitmaps; NULL if there is none
+ */
+static char *find_suitable(int fl, int sl)
+{
+    uint32_t sl_map, fl_map;
+
+    if (fl >= FL_COUNT)
+	return NULL;
+    sl_map = sl_bitmap[fl] & (~0U << sl);
+    if (!sl_map) {
+	fl_map = (fl + 1 < 32) ? fl_bitmap & (~0U << (fl + 1)) : 0;
+	if (!fl_map)
+	    return NULL;
+	fl = __builtin_ctz(fl_map);
+	sl_map = sl_bitmap[fl];
+    }
+    return heads[fl][__builtin_ctz(sl_map)];
+}
+
+static void list_insert(char *bp)
+{
+    int fl, sl;
+    char *head;
+
+    mapping_insert(SIZE(bp), &fl, &sl);
+    head = heads[fl][sl];
+    PUT(bp, TO_OFFSET(head));
+    PUT(bp + WSIZE, 0);
+    if (head != NULL)
+	PUT(head + WSIZE, TO_OFFSET(bp));
+    heads[fl][sl] = bp;
+    fl_bitmap |= 1U << fl;
+    sl_bitmap[fl] |= 1U << sl;
+}
+
+static void list_remove(char *bp)
+{
+    int fl, sl;
+    char *next = NEXT_FREE(bp);
+    char *prev = PREV_FREE(bp);
+
+    mapping_insert(SIZE(bp), &fl, &sl);
+    if (prev != NULL)
+	PUT(prev, TO_OFFSET(next));
+    else
+	heads[fl][sl] = next;
+    if (next != NULL)
+	PUT(next + WSIZE, TO_OFFSET(prev));
+    if (heads[fl][sl] == NULL) {
+	sl_bitmap[fl] &= ~(1U << sl);
+	if (!sl_bitmap[fl])
+	    fl_bitmap &= ~(1U << fl);
+    }
+}
+
+/*
+ * make_free - write the header and footer of a free block of the given
+ *     size at bp, tell the next block, and put it on its list
+ */
+static void make_free(char *bp, uint32_t size)
+{
+    PUT(HEADER(bp), size | (*HEADER(bp) & PREV_FREE_BIT));
+    PUT(bp + size - DSIZE, size);
+    SET_PREV_FREE(NEXT_BLOCK(bp), 1);
+    list_insert(bp);
+}
+
+/*
+ * release - free the size bytes at bp (not on any list), merging them
+ *     with the free blocks on either side; returns the merged block
+ */
+static char *release(char *bp, uint32_t size)
+{
+    char *next = bp + size;
+
+    if (!IS_ALLOC(next)) {
+	list_remove(next);
+	size += SIZE(next);
+    }
+    if (IS_PREV_FREE(bp)) {
+	bp = PREV_BLOCK(bp);
+	list_remove(bp);
+	size += SIZE(bp);
+    }
+    make_free(bp, size);
+    return bp;
+}
+
+/*
+ * grow - extend the heap by at least size bytes; returns the free block
+ *     at the end of the heap that now holds them
+ */
+static char *grow(uint32_t size)
+{
+    char *bp;
+
+    if (size < CHUNKSIZE)
+	size = CHUNKSIZE;
+    if ((bp = mem_sbrk(size)) == (void *)-1)
+	return NULL;
+
+    /* The old epilogue becomes the new block's header */
+    PUT(HEADER(bp), size | (*HEADER(bp) & PREV_FREE_BIT));
+    PUT(HEADER(bp + size), 0 | ALLOC_BIT);
+    return release(bp, size);
+}
+
+/*
+ * use - allocate asize bytes at the start of free block bp, which is
+ *     on no list, and free the rest if it can stand as a block
+ */
+static void use(char *bp, uint32_t asize)
+{
+    uint32_t size = SIZE(bp);
+    uint32_t prev_free = *HEADER(bp) & PREV_FREE_BIT;
+
+    if (size - asize >= MINBLOCK) {
+	PUT(HEADER(bp), asize | prev_free | ALLOC_BIT);
+	PUT(HEADER(bp + asize), 0);
+	make_free(bp + asize, size - asize);
+    }
+    else {
+	PUT(HEADER(bp), size | prev_free | ALLOC_BIT);
+	SET_PREV_FREE(NEXT_BLOCK(bp), 0);
+    }
+}
+
+/* adjust - the block size needed for size bytes of payload */
+static inline uint32_t adjust(uint32_t size)
+{
+    uint32_t asize = (size + WSIZE + DSIZE - 1) & ~(DSIZE - 1);
+
+    return (asize < MINBLOCK) ? MINBLOCK : asize;
+}
+
+static int tlsf_init(void)
+{
+    char *p;
+
+    memset(heads, 0, sizeof(heads));
+    memset(sl_bitmap, 0, sizeof(sl_bitmap));
+    fl_bitmap = 0;
+
+    /* Padding, so payloads are aligned, then the epilogue */
+    if ((p = mem_sbrk(DSIZE)) == (void *)-1)
+	return -1;
+    PUT(p, 0);
+    PUT(p + WSIZE, 0 | ALLOC_BIT);
+    return 0;
+}
+
+static void *tlsf_malloc(uint32_t size)
+{
+    uint32_t asize;
+    int fl, sl;
+    char *bp;
+
+    if (size == 0)
+	return NULL;
+    asize = adjust(size);
+    mapping_search(asize, &fl, &sl);
+    if ((bp = find_suitable(fl, sl)) == NULL) {
+	if ((bp = grow(asize)) == NULL)
+	    return NULL;
+    }
+    list_remove(bp);
+    use(bp, asize);
+    return bp;
+}
+
+static void tlsf_free(void *ptr)
+{
+    char *bp = ptr;
+
+    if (bp == NULL)
+	return;
+    release(bp, SIZE(bp));
+}
+
+static void *tlsf_realloc(void *ptr, uint32_t size)
+{
+    char *bp = ptr;
+    char *next;
+    uint32_t oldsize, asize;
+    void *newp;
+
+    if (ptr == NULL)
+	return tlsf_malloc(size);
+    if (size == 0) {
+	tlsf_free(ptr);
+	return NULL;
+    }
+
+    oldsize = SIZE(bp);
+    asize = adjust(size);
+
+    /* Shrink in place, freeing the tail if it can stand as a block */
+    if (asize <= oldsize) {
+	if (oldsize - asize >= MINBLOCK) {
+	    PUT(HEADER(bp), asize | (*HEADER(bp) & PREV_FREE_BIT) | ALLOC_BIT);
+	    PUT(HEADER(bp + asize), 0);
+	    release(bp + asize, oldsize - asize);
+	}
+	return ptr;
+    }
+
+    /* Grow in place into a free next block */
+    next = NEXT_BLOCK(bp);
+    if (!IS_ALLOC(next) && oldsize + SIZE(next) >= asize) {
+	list_remove(next);
+	PUT(HEADER(bp), (oldsize + SIZE(next)) | (*HEADER(bp) & PREV_FREE_BIT));
+	use(bp, asize);
+	return ptr;
+    }
+
+    if ((newp = tlsf_malloc(size)) == NULL)
+	return NULL;
+    memcpy(newp, ptr, (size < oldsize - WSIZE) ? size : oldsize - WSIZE);
+    tlsf_free(ptr);
+    return newp;
+}
+
+allocator_t tlsf_allocator = {
+    "tlsf", tlsf_init, tlsf_malloc, tlsf_free, tlsf_realloc,
+    mem_reset_brk, mem_heapsize, 1
+};
@@ -6,22 +6,33 @@
  *
  *      31                     3  2  1  0
  *      -----------------------------------
- *     | s  s  s  s  ... s  s  s  0  0  a/f
+ *     | s  s  s  s  ... s  s  s  m  c  a/f
  *      -----------------------------------
  *
  * where s are the meaningful size bits and a/f is set
- * iff the block is allocated. The list has the following form:
+ * iff the block is allocated. c is set on a free block whose
+ * payload is known to be all zero, and on an allocated block
+ * that was placed in one. m is set on an allocated block behind
+ * a handle, which mm_compact may move; its first payload word is
+ * the handle. The list has the following form:
  *
- * begin                                                          end
- * heap                                                           heap
- *  -----------------------------------------------------------------
- * |  pad   | hdr(8:a) | ftr(8:a) | zero or more usr blks | hdr(8:a) |
- *  -----------------------------------------------------------------
- *          |       prologue      |                       | epilogue |
- *          |         block       |                       | block    |
+ * begin                                                                   end
+ * heap                                                                    heap
+ *  --------------------------------------------------------------------------
+ * | root | handled | hdr(8:a) | ftr(8:a) | zero or more usr blks | hdr(8:a) |
+ *  --------------------------------------------------------------------------
+ *                  |       prologue      |                       | epilogue |
+ *                  |         block       |                       | block    |
  *
  * The allocated prologue and epilogue blocks are overhead that
- * eliminate edge conditions during coalescing.
+ * eliminate edge conditions during coalescing. Ahead of them, the
+ * doubleword root slot holds a pointer the application can find the
+ * rest of its data through, and the handled word counts the blocks
+ * behind handles; with the rest of the heap they survive in a heap
+ * file that mm_reopen takes up again. The file is only sure to be
+ * whole as of a clean shutdown, when mem_deinit unmaps it: pages
+ * written since the last mm_set_root reach it in no set order, so a
+ * crash can leave the tags of blocks changed since then torn.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -29,6 +40,7 @@
 #include <memory.h>
 #include "mm.h"
 #include "memlib.h"
+#include "pagemap.h"
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -58,6 +70,11 @@ team_t team = {
 #define DSIZE 8             /* doubleword size (bytes) */
 #define CHUNKSIZE (1 << 12) /* initial heap size (bytes) */
 #define OVERHEAD 8          /* overhead of header and footer (bytes) */
+#define CLEAN 0x2           /* payload is known to be zero */
+#define SCRUB_MAX 2048      /* dirty payload zeroed to merge with a clean one */
+#define MOVABLE 0x4         /* allocated block is behind a handle */
+#define HSLOTS_MIN 64       /* handle slots first allocated */
+#define ZERO_SCAN 256       /* blocks looked at per clean or dirty search */
 void mm_checkheap(int);
 
 static inline int MAX(int x, int y)
@@ -97,6 +114,16 @@ static inline int GET_ALLOC(void *p)
   return GET(p) & 0x1;
 }
 
+static inline int GET_CLEAN(void *p)
+{
+  return (GET(p) & CLEAN) != 0;
+}
+
+static inline int GET_MOVABLE(void *p)
+{
+  return (GET(p) & MOVABLE) != 0;
+}
+
 //
 // Given block ptr bp, compute address of its header and footer
 //
@@ -117,6 +144,24 @@ static inline void SET_BLOCK_DATA(void *bp, uint32_t size, int alloc)
   PUT(FOOTER(bp), boundaryData);
 }
 
+//
+// Mark block bp's payload as known to be zero; SET_BLOCK_DATA unmarks it
+//
+static inline void SET_CLEAN(void *bp)
+{
+  PUT(HEADER(bp), GET(HEADER(bp)) | CLEAN);
+  PUT(FOOTER(bp), GET(FOOTER(bp)) | CLEAN);
+}
+
+//
+// Mark allocated block bp as behind a handle; SET_BLOCK_DATA unmarks it
+//
+static inline void SET_MOVABLE(void *bp)
+{
+  PUT(HEADER(bp), GET(HEADER(bp)) | MOVABLE);
+  PUT(FOOTER(bp), GET(FOOTER(bp)) | MOVABLE);
+}
+
 //
 // Given block ptr bp, compute address of next and previous blocks
 //
@@ -139,12 +184,59 @@ static char *heap_listp; /* pointer to first block */
 
 static char *next_fit_pointer;
 
+// the one span the implicit list's pages belong to
+static span_t heap_span;
+
+// past soft_limit heap bytes (0 for none) the heap is under pressure:
+// best fit, merging regardless of clean marks, growing by no more than
+// a request lacks, and trimming a free tail. It stays so until trimming
+// takes it an eighth below.
+static size_t soft_limit;
+static void (*pressure_fn)(size_t heapsize);
+static int pressure;
+static size_t trimmed; // bytes given back to memlib since mm_init
+
+// handle slots: the block behind each live handle and how many times
+// it is pinned. Free slots chain through next_free; slot 0 is never
+// handed out, so that 0 can mean no handle.
+typedef struct
+{
+  char *bp;
+  int pins;
+  uint32_t next_free;
+} hslot_t;
+static hslot_t *hslots;
+static uint32_t nhslots, maxhslots, free_hslot;
+
+// where the next mm_compact picks up, NULL to start a pass
+static char *compact_cursor;
+
+// where the next mm_malloc_clean and mm_claim_dirty look first, so
+// neither walks the whole heap under the heap lock
+static char *clean_cursor, *dirty_cursor;
+
+//
+// The root slot and the count of handle blocks, ahead of the prologue
+//
+static inline void **ROOT_SLOT(void)
+{
+  return (void **)mem_heap_lo();
+}
+static inline void *HANDLED(void)
+{
+  return (char *)mem_heap_lo() + DSIZE;
+}
+
 //
 // function prototypes for internal helper routines
 //
 static void *extend_heap(uint32_t words);
 static void place(void *bp, uint32_t asize);
 static void *find_fit(uint32_t asize);
+static void *best_fit(uint32_t asize);
+static void enter_pressure(void);
+static void trim(void *bp);
+static int mergeable(void *a, void *b);
 static void *coalesce(void *bp);
 static void printblock(void *bp);
 static void checkblock(void *bp);
@@ -155,15 +247,29 @@ static void checkblock(void *bp);
 int mm_init(void)
 {
   // Create the initial empty heap
-  if ((heap_listp = mem_sbrk(4 * WSIZE)) == (void *)-1)
+  if ((heap_listp = mem_sbrk(6 * WSIZE)) == (void *)-1)
     return -1;
-  PUT(heap_listp, 0);                          // alignment padding
-  PUT(heap_listp + WSIZE, PACK(OVERHEAD, 1));  // prologue header
-  PUT(heap_listp + DSIZE, PACK(OVERHEAD, 1));  // prologue footer
-  PUT(heap_listp + WSIZE + DSIZE, PACK(0, 1)); // epilogue header
-  heap_listp += DSIZE;
+  *ROOT_SLOT() = NULL;                         // root slot
+  PUT(HANDLED(), 0);                           // no handle blocks
+  heap_listp += 2 * DSIZE;
+  PUT(HEADER(heap_listp), PACK(OVERHEAD, 1));  // prologue header
+  PUT(heap_listp, PACK(OVERHEAD, 1));          // prologue footer
+  PUT(heap_listp + WSIZE, PACK(0, 1));         // epilogue header
 
   next_fit_pointer = heap_listp;
+  pressure = 0;
+  trimmed = 0;
+  nhslots = 1;
+  free_hslot = 0;
+  compact_cursor = NULL;
+  clean_cursor = dirty_cursor = NULL;
+
+  // Start a page map over the heap, with the pages so far in heap_span
+  pagemap_init(mem_heap_lo());
+  heap_span.start = mem_heap_lo();
+  heap_span.npages = 0;
+  heap_span.kind = SPAN_HEAP;
+  pagemap_set(mem_heap_lo(), 6 * WSIZE, &heap_span);
 
   // Extend the empty heap with a free block of CHUNKSIZE bytes
   if (extend_heap(CHUNKSIZE / WSIZE) == NULL)
@@ -183,6 +289,8 @@ static void *extend_heap(uint32_t words)
   size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
   if ((long)(bp = mem_sbrk(size)) == -1)
     return NULL;
+  pagemap_set(bp, size, &heap_span);
+  heap_span.npages = (mem_heapsize() + (1 << PM_PAGE_SHIFT) - 1) >> PM_PAGE_SHIFT;
 
   // Initialize free block header/footer and the epilogue header
   SET_BLOCK_DATA(bp, size, 0);
@@ -199,8 +307,10 @@ static void *extend_heap(uint32_t words)
 //
 static void *find_fit(uint32_t asize)
 {
-  // next fit
+  // next fit, or best fit under pressure
   void *bp = next_fit_pointer;
+  if (pressure)
+    return best_fit(asize);
   do
   {
     if (!GET_ALLOC(HEADER(bp)) && (asize <= GET_SIZE(HEADER(bp))))
@@ -217,6 +327,28 @@ static void *find_fit(uint32_t asize)
   return NULL; // no fit
 }
 
+//
+// best_fit - Find the smallest free block with at least asize bytes
+//
+static void *best_fit(uint32_t asize)
+{
+  void *bp, *best = NULL;
+
+  for (bp = heap_listp; GET_SIZE(HEADER(bp)) > 0; bp = NEXT_BLOCK(bp))
+  {
+    if (!GET_ALLOC(HEADER(bp)) && asize <= GET_SIZE(HEADER(bp)) &&
+        (best == NULL || GET_SIZE(HEADER(bp)) < GET_SIZE(HEADER(best))))
+    {
+      best = bp;
+      if (GET_SIZE(HEADER(bp)) == asize)
+        break;
+    }
+  }
+  if (best != NULL)
+    next_fit_pointer = best;
+  return best;
+}
+
 //
 // mm_free - Free a block
 //
@@ -225,7 +357,86 @@ void mm_free(void *bp)
   size_t size = GET_SIZE(HEADER(bp));
 
   SET_BLOCK_DATA(bp, size, 0);
-  coalesce(bp);
+  bp = coalesce(bp);
+  if (pressure)
+    trim(bp);
+}
+
+//
+// enter_pressure - The heap is about to pass its soft limit: merge all
+//                  the free blocks that were kept apart, and tell the
+//                  application, which may free blocks from its callback
+//
+static void enter_pressure(void)
+{
+  void *bp;
+
+  pressure = 1;
+  for (bp = heap_listp; GET_SIZE(HEADER(bp)) > 0; bp = NEXT_BLOCK(bp))
+    if (!GET_ALLOC(HEADER(bp)))
+      bp = coalesce(bp);
+  if (pressure_fn != NULL)
+    pressure_fn(mem_heapsize());
+}
+
+//
+// trim - Give the free block bp back to memlib if it ends the heap, and
+//        leave pressure once the heap is well under the soft limit
+//
+static void trim(void *bp)
+{
+  size_t size = GET_SIZE(HEADER(bp));
+  char *old_end = (char *)mem_heap_hi() + 1;
+  char *kept;
+
+  if (GET_SIZE(HEADER(NEXT_BLOCK(bp))) != 0)
+    return;
+  PUT(HEADER(bp), PACK(0, 1)); // new epilogue header
+  mem_sbrk(-(int)size);
+  heap_span.npages = (mem_heapsize() + (1 << PM_PAGE_SHIFT) - 1) >> PM_PAGE_SHIFT;
+  // the pages wholly past the new end no longer belong to the heap
+  kept = (char *)mem_heap_lo() + ((size_t)heap_span.npages << PM_PAGE_SHIFT);
+  if (kept < old_end)
+    pagemap_clear(kept, old_end - kept);
+  trimmed += size;
+  if ((char *)next_fit_pointer >= (char *)bp)
+    next_fit_pointer = heap_listp;
+  if (compact_cursor >= (char *)bp)
+    compact_cursor = NULL;
+  if (clean_cursor >= (char *)bp)
+    clean_cursor = NULL;
+  if (dirty_cursor >= (char *)bp)
+    dirty_cursor = NULL;
+  if (mem_heapsize() < soft_limit - soft_limit / 8)
+    pressure = 0;
+}
+
+//
+// mergeable - Can free blocks a and b merge without a clean block
+//             losing its mark? They can if both are clean or both
+//             dirty, or if the dirty one is small enough to zero here.
+//             A bigger one stays apart until it is zeroed in turn.
+//             Under pressure they always merge, and the clean one
+//             loses its mark.
+//
+static int mergeable(void *a, void *b)
+{
+  void *dirty;
+
+  if (GET_CLEAN(HEADER(a)) == GET_CLEAN(HEADER(b)))
+    return 1;
+  dirty = GET_CLEAN(HEADER(a)) ? b : a;
+  if (pressure)
+  {
+    void *clean = dirty == a ? b : a;
+    SET_BLOCK_DATA(clean, GET_SIZE(HEADER(clean)), 0);
+    return 1;
+  }
+  if (GET_SIZE(HEADER(dirty)) - OVERHEAD > SCRUB_MAX)
+    return 0;
+  memset(dirty, 0, GET_SIZE(HEADER(dirty)) - OVERHEAD);
+  SET_CLEAN(dirty);
+  return 1;
 }
 
 //
@@ -236,6 +447,24 @@ static void *coalesce(void *bp)
   size_t previousAllocation = GET_ALLOC(FOOTER(PREVIOUS_BLOCK(bp)));
   size_t nextAllocation = GET_ALLOC(HEADER(NEXT_BLOCK(bp)));
   size_t size = GET_SIZE(HEADER(bp));
+  char *next = NEXT_BLOCK(bp);
+  char *old = bp;
+  int clean;
+
+  if (previousAllocation && nextAllocation)
+  {
+    return bp;
+  }
+  // zeroing bp to merge with one neighbor means asking the other again
+  clean = GET_CLEAN(HEADER(bp));
+  if (!previousAllocation && !mergeable(PREVIOUS_BLOCK(bp), bp))
+    previousAllocation = 1;
+  if (!nextAllocation && !mergeable(bp, next))
+    nextAllocation = 1;
+  if (!previousAllocation && GET_CLEAN(HEADER(bp)) != clean &&
+      !mergeable(PREVIOUS_BLOCK(bp), bp))
+    previousAllocation = 1;
+  clean = GET_CLEAN(HEADER(bp));
 
   if (previousAllocation && nextAllocation)
   {
@@ -243,7 +472,7 @@ static void *coalesce(void *bp)
   }
   else if (previousAllocation && !nextAllocation)
   {
-    size += GET_SIZE(HEADER(NEXT_BLOCK(bp)));
+    size += GET_SIZE(HEADER(next));
     SET_BLOCK_DATA(bp, size, 0);
   }
   else if (!previousAllocation && nextAllocation)
@@ -254,15 +483,30 @@ static void *coalesce(void *bp)
   }
   else
   {
-    size += GET_SIZE(HEADER(NEXT_BLOCK(bp)));
+    size += GET_SIZE(HEADER(next));
     bp = PREVIOUS_BLOCK(bp);
     size += GET_SIZE(HEADER(bp));
     SET_BLOCK_DATA(bp, size, 0);
   }
+  // the merged block is clean once the tags between its parts are zeroed
+  if (clean)
+  {
+    if (!previousAllocation)
+      memset(old - DSIZE, 0, DSIZE);
+    if (!nextAllocation)
+      memset(next - DSIZE, 0, DSIZE);
+    SET_CLEAN(bp);
+  }
   // if next fit is pointing to middle of coalesced block change to point to
   // new block
   if (HEADER(bp) < next_fit_pointer && next_fit_pointer < FOOTER(bp))
     next_fit_pointer = bp;
+  if (HEADER(bp) < (void *)compact_cursor && (void *)compact_cursor < FOOTER(bp))
+    compact_cursor = bp;
+  if (HEADER(bp) < (void *)clean_cursor && (void *)clean_cursor < FOOTER(bp))
+    clean_cursor = bp;
+  if (HEADER(bp) < (void *)dirty_cursor && (void *)dirty_cursor < FOOTER(bp))
+    dirty_cursor = bp;
   return bp;
 }
 
@@ -294,8 +538,33 @@ void *mm_malloc(uint32_t size)
 
   /* No fit found. Get more memory and place the block */
   extendsize = MAX(asize, CHUNKSIZE);
+  if (!pressure && soft_limit > 0 && mem_heapsize() + extendsize > soft_limit)
+  {
+    // tighten up first, which may make room without growing
+    enter_pressure();
+    if ((bp = find_fit(asize)) != NULL)
+    {
+      place(bp, asize);
+      return bp;
+    }
+  }
+  if (pressure)
+  {
+    // grow by only what the free block ending the heap lacks
+    char *end = (char *)mem_heap_hi() + 1;
+    extendsize = asize;
+    if (!GET_ALLOC(end - DSIZE))
+      extendsize -= GET_SIZE(end - DSIZE);
+  }
   if ((bp = extend_heap(extendsize / WSIZE)) == NULL)
-    return NULL;
+  {
+    // out of memory; the application gets one last chance to free some
+    if (pressure_fn == NULL)
+      return NULL;
+    pressure_fn(mem_heapsize());
+    if ((bp = find_fit(asize)) == NULL)
+      return NULL;
+  }
   place(bp, asize);
   return bp;
 }
@@ -310,68 +579,421 @@ void *mm_malloc(uint32_t size)
 static void place(void *bp, uint32_t asize)
 {
   size_t csize = GET_SIZE(HEADER(bp));
+  int clean = GET_CLEAN(HEADER(bp));
   // minium block size is 16 bytes (DSIZE + OVERHEAD;)
   if ((csize - asize) >= (DSIZE + OVERHEAD))
   {
     SET_BLOCK_DATA(bp, asize, 1);
+    if (clean)
+      SET_CLEAN(bp);
     bp = NEXT_BLOCK(bp);
+    // the remainder's new header was payload, but its payload still is
     SET_BLOCK_DATA(bp, csize - asize, 0);
+    if (clean)
+      SET_CLEAN(bp);
     coalesce(bp);
   }
   else
   {
     SET_BLOCK_DATA(bp, csize, 1);
+    if (clean)
+      SET_CLEAN(bp);
   }
 }
 
 //
-// mm_realloc -- implemented for you
+// mm_realloc - Resize a block, in place when it shrinks or when the
+//              next block is free and big enough to grow into
 //
 void *mm_realloc(void *ptr, uint32_t size)
 {
   void *newp;
-  uint32_t copySize;
+  void *next;
+  uint32_t oldsize, asize, copySize;
 
-  copySize = GET_SIZE(HEADER(ptr));
-  if (size == copySize)
+  if (ptr == NULL)
+    return mm_malloc(size);
+  if (size == 0)
   {
-    return ptr;
+    mm_free(ptr);
+    return NULL;
   }
 
-  uint32_t asize;
+  oldsize = GET_SIZE(HEADER(ptr));
   if (size <= DSIZE)
     asize = DSIZE + OVERHEAD;
   else
     asize = DSIZE * ((size + (OVERHEAD) + (DSIZE - 1)) / DSIZE);
 
-  if (asize < copySize)
+  // shrink in place, giving back the tail if it can stand as a block
+  if (asize <= oldsize)
   {
-    SET_BLOCK_DATA(ptr, asize, 1);
-    SET_BLOCK_DATA(NEXT_BLOCK(ptr), copySize - asize, 0);
-    coalesce(NEXT_BLOCK(ptr));
+    if ((oldsize - asize) >= (DSIZE + OVERHEAD))
+    {
+      SET_BLOCK_DATA(ptr, asize, 1);
+      SET_BLOCK_DATA(NEXT_BLOCK(ptr), oldsize - asize, 0);
+      coalesce(NEXT_BLOCK(ptr));
+    }
     return ptr;
   }
-  else if (size < copySize)
-  {
-    copySize = size;
-  }
-  else if (GET_ALLOC(HEADER(NEXT_BLOCK(ptr))) == 0 && GET_SIZE(HEADER(NEXT_BLOCK(ptr))) + copySize >= asize)
+
+  // grow in place by absorbing the next block
+  next = NEXT_BLOCK(ptr);
+  if (!GET_ALLOC(HEADER(next)) && oldsize + GET_SIZE(HEADER(next)) >= asize)
   {
+    // next fit must not be left pointing into the grown block
+    if ((char *)next_fit_pointer == (char *)next)
+      next_fit_pointer = ptr;
+    if (compact_cursor == (char *)next)
+      compact_cursor = ptr;
+    if (clean_cursor == (char *)next)
+      clean_cursor = ptr;
+    if (dirty_cursor == (char *)next)
+      dirty_cursor = ptr;
+    SET_BLOCK_DATA(ptr, oldsize + GET_SIZE(HEADER(next)), 1);
     place(ptr, asize);
     return ptr;
   }
 
-  newp = mm_malloc(size);
-  if (newp == NULL)
-  {
-    printf("ERROR: mm_malloc failed in mm_realloc\n");
-    exit(1);
-  }
+  // out of memory leaves the old block as it was
+  if ((newp = mm_malloc(size)) == NULL)
+    return NULL;
+  copySize = oldsize - OVERHEAD;
+  if (size < copySize)
+    copySize = size;
   memcpy(newp, ptr, copySize);
   mm_free(ptr);
   return newp;
 }
 
+//
+// mm_usable_size - Payload bytes the allocated block at ptr can hold
+//
+uint32_t mm_usable_size(void *ptr)
+{
+  return GET_SIZE(HEADER(ptr)) - OVERHEAD;
+}
+
+//
+// mm_clean - Was the payload of the block mm_malloc just returned all
+//            zero? Only good until the block is written.
+//
+int mm_clean(void *ptr)
+{
+  return GET_CLEAN(HEADER(ptr));
+}
+
+//
+// mm_malloc_clean - mm_malloc, but from a free block known to be zero
+//                   if there is one big enough, so that mm_clean holds.
+//                   Looks at ZERO_SCAN blocks at most, going on from
+//                   where the last look stopped, before giving up.
+//
+void *mm_malloc_clean(uint32_t size)
+{
+  uint32_t asize;
+  void *bp;
+  int n;
+
+  if (size <= 0)
+    return NULL;
+  if (size <= DSIZE)
+    asize = DSIZE + OVERHEAD;
+  else
+    asize = DSIZE * ((size + (OVERHEAD) + (DSIZE - 1)) / DSIZE);
+
+  bp = clean_cursor != NULL ? clean_cursor : heap_listp;
+  for (n = 0; n < ZERO_SCAN; n++)
+  {
+    if (GET_SIZE(HEADER(bp)) == 0)
+      bp = heap_listp;
+    if (!GET_ALLOC(HEADER(bp)) && GET_CLEAN(HEADER(bp)) &&
+        asize <= GET_SIZE(HEADER(bp)))
+    {
+      place(bp, asize);
+      clean_cursor = bp;
+      return bp;
+    }
+    bp = NEXT_BLOCK(bp);
+  }
+  clean_cursor = bp;
+  return mm_malloc(size);
+}
+
+//
+// mm_claim_dirty - Take a free block of at least minsize payload bytes
+//                  that isn't known to be zero out of use, to zero it
+//                  and give it back with mm_free_clean. Looks at
+//                  ZERO_SCAN blocks at most, going on from where the
+//                  last look stopped; if it finds none there, returns
+//                  NULL and sets *more if the heap goes on past them.
+//
+void *mm_claim_dirty(uint32_t minsize, int *more)
+{
+  void *bp = dirty_cursor != NULL ? dirty_cursor : heap_listp;
+  int n;
+
+  for (n = 0; n < ZERO_SCAN && GET_SIZE(HEADER(bp)) > 0; n++)
+  {
+    if (!GET_ALLOC(HEADER(bp)) && !GET_CLEAN(HEADER(bp)) &&
+        GET_SIZE(HEADER(bp)) - OVERHEAD >= minsize)
+    {
+      SET_BLOCK_DATA(bp, GET_SIZE(HEADER(bp)), 1);
+      dirty_cursor = NEXT_BLOCK(bp);
+      *more = 1;
+      return bp;
+    }
+    bp = NEXT_BLOCK(bp);
+  }
+  *more = GET_SIZE(HEADER(bp)) > 0;
+  dirty_cursor = *more ? bp : NULL;
+  return NULL;
+}
+
+//
+// mm_free_clean - Free a block whose whole payload the caller has zeroed
+//
+void mm_free_clean(void *bp)
+{
+  SET_BLOCK_DATA(bp, GET_SIZE(HEADER(bp)), 0);
+  SET_CLEAN(bp);
+  coalesce(bp);
+}
+
+//
+// mm_halloc - Allocate a block with at least size bytes of payload that
+//             mm_compact may move, and return a handle to it; 0 if out
+//             of memory. The payload is only reachable through mm_hpin.
+//
+mm_handle_t mm_halloc(uint32_t size)
+{
+  hslot_t *grown;
+  uint32_t h;
+  char *bp;
+
+  if ((bp = mm_malloc(size + DSIZE)) == NULL)
+    return 0;
+  if (free_hslot != 0)
+  {
+    h = free_hslot;
+    free_hslot = hslots[h].next_free;
+  }
+  else
+  {
+    if (nhslots >= maxhslots)
+    {
+      maxhslots = maxhslots ? 2 * maxhslots : HSLOTS_MIN;
+      if ((grown = realloc(hslots, maxhslots * sizeof(hslot_t))) == NULL)
+      {
+        maxhslots = nhslots;
+        mm_free(bp);
+        return 0;
+      }
+      hslots = grown;
+    }
+    h = nhslots++;
+  }
+  hslots[h].bp = bp;
+  hslots[h].pins = 0;
+  PUT(bp, h); // the second word just keeps the payload aligned
+  SET_MOVABLE(bp);
+  PUT(HANDLED(), GET(HANDLED()) + 1);
+  return h;
+}
+
+//
+// mm_hfree - Free the block behind handle h, which must not be pinned
+//
+void mm_hfree(mm_handle_t h)
+{
+  mm_free(hslots[h].bp);
+  PUT(HANDLED(), GET(HANDLED()) - 1);
+  hslots[h].bp = NULL;
+  hslots[h].next_free = free_hslot;
+  free_hslot = h;
+}
+
+//
+// mm_hpin - Pointer to the payload behind handle h, which stays put
+//           until as many mm_hunpin calls as mm_hpin calls
+//
+void *mm_hpin(mm_handle_t h)
+{
+  hslots[h].pins++;
+  return hslots[h].bp + DSIZE;
+}
+
+//
+// mm_hunpin - Let mm_compact move the block behind h again
+//
+void mm_hunpin(mm_handle_t h)
+{
+  hslots[h].pins--;
+}
+
+//
+// mm_compact - Slide unpinned handle blocks down over the free blocks
+//              before them, so that the free space gathers at the end
+//              of the heap, and trim it off there. Moves about budget
+//              bytes at most, picking up where the last call left off,
+//              and returns the bytes moved.
+//
+size_t mm_compact(size_t budget)
+{
+  char *bp = compact_cursor != NULL ? compact_cursor : heap_listp;
+  char *next;
+  uint32_t hsize, asize;
+  size_t moved = 0;
+
+  while (moved < budget && GET_SIZE(HEADER(bp)) > 0)
+  {
+    next = NEXT_BLOCK(bp);
+    if (GET_ALLOC(HEADER(bp)))
+    {
+      bp = next;
+      continue;
+    }
+    hsize = GET_SIZE(HEADER(bp));
+    if (GET_SIZE(HEADER(next)) == 0)
+    {
+      trim(bp);
+      bp = NULL;
+      break;
+    }
+    if (!GET_ALLOC(HEADER(next)))
+    {
+      // a free neighbor kept apart by its clean mark joins the hole
+      SET_BLOCK_DATA(bp, hsize + GET_SIZE(HEADER(next)), 0);
+      continue;
+    }
+    if (!GET_MOVABLE(HEADER(next)) || hslots[GET(next)].pins > 0)
+    {
+      bp = next;
+      continue;
+    }
+    // the block after the hole moves down, and the hole up past it
+    asize = GET_SIZE(HEADER(next));
+    memmove(bp, next, asize - OVERHEAD);
+    SET_BLOCK_DATA(bp, asize, 1);
+    SET_MOVABLE(bp);
+    hslots[GET(bp)].bp = bp;
+    bp = NEXT_BLOCK(bp);
+    SET_BLOCK_DATA(bp, hsize, 0);
+    moved += asize;
+  }
+
+  // next fit must not be left pointing into a block that moved, nor
+  // the clean and dirty searches
+  clean_cursor = dirty_cursor = NULL;
+  if (bp != NULL && GET_SIZE(HEADER(bp)) > 0)
+  {
+    if (!GET_ALLOC(HEADER(bp)))
+      bp = coalesce(bp);
+    compact_cursor = bp;
+    next_fit_pointer = bp;
+  }
+  else
+  {
+    compact_cursor = NULL;
+    next_fit_pointer = heap_listp;
+  }
+  return moved;
+}
+
+//
+// mm_reopen - Take up the heap in a file memlib reopened, as the last
+//             process to use it left it, instead of starting one with
+//             mm_init; -1 if the file doesn't hold one. Handles don't
+//             survive, so blocks that were behind them become plain
+//             blocks, for mm_free.
+//
+int mm_reopen(void)
+{
+  char *end = (char *)mem_heap_hi() + 1;
+  void *bp;
+
+  heap_listp = (char *)mem_heap_lo() + 2 * DSIZE;
+  if (mem_heapsize() < 6 * WSIZE ||
+      GET(HEADER(heap_listp)) != PACK(OVERHEAD, 1) ||
+      GET(end - WSIZE) != PACK(0, 1))
+    return -1;
+
+  next_fit_pointer = heap_listp;
+  pressure = 0;
+  trimmed = 0;
+  nhslots = 1;
+  free_hslot = 0;
+  compact_cursor = NULL;
+  clean_cursor = dirty_cursor = NULL;
+
+  pagemap_init(mem_heap_lo());
+  heap_span.start = mem_heap_lo();
+  heap_span.kind = SPAN_HEAP;
+  pagemap_set(mem_heap_lo(), mem_heapsize(), &heap_span);
+  heap_span.npages = (mem_heapsize() + (1 << PM_PAGE_SHIFT) - 1) >> PM_PAGE_SHIFT;
+
+  // only a heap that had handle blocks needs walking
+  if (GET(HANDLED()) > 0)
+  {
+    for (bp = heap_listp; GET_SIZE(HEADER(bp)) > 0; bp = NEXT_BLOCK(bp))
+      if (GET_ALLOC(HEADER(bp)) && GET_MOVABLE(HEADER(bp)))
+        SET_BLOCK_DATA(bp, GET_SIZE(HEADER(bp)), 1);
+    PUT(HANDLED(), 0);
+  }
+  return 0;
+}
+
+//
+// mm_set_root - Keep p in the heap's root slot. In a heap file, what p
+//               leads to is flushed before the slot is written and the
+//               slot after, so the file never has a root that points at
+//               blocks it doesn't hold yet.
+//
+void mm_set_root(void *p)
+{
+  mem_sync();
+  *ROOT_SLOT() = p;
+  mem_sync();
+}
+
+//
+// mm_root - The pointer in the heap's root slot, NULL if none was set
+//
+void *mm_root(void)
+{
+  return *ROOT_SLOT();
+}
+
+//
+// mm_set_soft_limit - Put the heap under pressure as it grows past bytes,
+//                     calling fn when it does and when memlib refuses to
+//                     grow it further; 0 for no limit. fn runs inside
+//                     mm_malloc, and may only free blocks. Under a limit
+//                     memlib's refusals are expected, so it keeps quiet.
+//
+void mm_set_soft_limit(size_t bytes, void (*fn)(size_t heapsize))
+{
+  soft_limit = bytes;
+  pressure_fn = fn;
+  mem_set_quiet(bytes > 0);
+}
+
+//
+// mm_pressure - Is the heap under pressure?
+//
+int mm_pressure(void)
+{
+  return pressure;
+}
+
+//
+// mm_trimmed - Bytes trimmed off the end of the heap since mm_init
+//
+size_t mm_trimmed(void)
+{
+  return trimmed;
+}
+
 //
 // mm_checkheap - Check the heap for consistency
 //
@@ -442,8 +1064,27 @@ static void checkblock(void *bp)
   {
     printf("Error: %p is not doubleword aligned\n", bp);
   }
+  if (pagemap_lookup(bp) != &heap_span)
+  {
+    printf("Error: %p is not on a heap page in the page map\n", bp);
+  }
   if (GET(HEADER(bp)) != GET(FOOTER(bp)))
   {
     printf("Error: header does not match footer\n");
   }
+  if (GET_ALLOC(HEADER(bp)) && GET_MOVABLE(HEADER(bp)) &&
+      (GET(bp) == 0 || GET(bp) >= nhslots || hslots[GET(bp)].bp != bp))
+  {
+    printf("Error: movable block %p is not behind its handle\n", bp);
+  }
+  if (!GET_ALLOC(HEADER(bp)) && GET_CLEAN(HEADER(bp)))
+  {
+    char *p;
+    for (p = bp; p < (char *)FOOTER(bp); p++)
+      if (*p != 0)
+      {
+        printf("Error: clean block %p has a nonzero byte at %p\n", bp, p);
+        break;
+      }
+  }
 }
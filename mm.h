@@ -2,9 +2,29 @@
 #include <stdint.h>
 
 extern int mm_init (void);
+extern int mm_reopen(void);
+extern void mm_set_root(void *p);
+extern void *mm_root(void);
 extern void *mm_malloc (uint32_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, uint32_t size);
+extern uint32_t mm_usable_size(void *ptr);
+extern int mm_clean(void *ptr);
+extern void *mm_malloc_clean(uint32_t size);
+extern void *mm_claim_dirty(uint32_t minsize, int *more);
+extern void mm_free_clean(void *ptr);
+
+typedef uint32_t mm_handle_t;
+extern mm_handle_t mm_halloc(uint32_t size);
+extern void mm_hfree(mm_handle_t h);
+extern void *mm_hpin(mm_handle_t h);
+extern void mm_hunpin(mm_handle_t h);
+extern size_t mm_compact(size_t budget);
+
+extern void mm_set_soft_limit(size_t bytes, void (*fn)(size_t heapsize));
+extern int mm_pressure(void);
+extern size_t mm_trimmed(void);
+extern void mm_checkheap(int verbose);
 
 
 /* 
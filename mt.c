@@ -0,0 +1,513 @@
+/*
+ * mt.c - thread-safe front end to the mm malloc package.
+ *
+ * mm.c keeps a single heap in static variables and knows nothing about
+ * threads, so every call into it goes through the shared heap lock.
+ * Work that doesn't need the heap, like zeroing a calloc'd payload,
+ * happens outside the lock. The lock is a pthread mutex, or one of the
+ * other kinds in lock.c. If asked to, it counts how often it is
+ * contended and for how long it is waited for and held, and
+ * mt_arena_stats reports those counts for each heap, or arena; for now
+ * there is one.
+ *
+ * Optionally, small blocks are kept in per-thread or per-CPU caches
+ * (cache.c) when they are freed. Small mallocs are rounded up to a
+ * cache class and served from the caller's cache when it can; otherwise
+ * a batch of blocks is allocated under one acquisition of the heap lock
+ * and the rest go into the cache. When a cache's stack is full, a batch
+ * goes back to the heap the same way.
+ *
+ * Thread caches of idle threads can be scavenged: by a background
+ * thread every so many milliseconds, and whenever the heap has grown by
+ * SCAVENGE_GROWTH bytes since the last scavenge.
+ *
+ * Optionally, frees are offloaded (freeq.c): mt_free queues the block
+ * and returns, and a background thread frees queued blocks in batches.
+ *
+ * Optionally, small blocks come from runs owned by the allocating
+ * thread instead (runs.c), so that no cache line holds blocks of two
+ * threads. Runs come before the caches: with both on, the caches only
+ * see blocks too big for a run.
+ *
+ * Callers with lock-free readers of their own structures free unlinked
+ * blocks with mt_free_deferred, and the blocks go back to the heap once
+ * no reader inside an mt_read_enter/mt_read_exit section can hold them
+ * (epoch.c).
+ *
+ * Optionally, a background thread zeroes large free blocks ahead of
+ * time (prezero.c), and a calloc the heap serves from one of them skips
+ * the memset.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "mt.h"
+#include "memlib.h"
+#include "lock.h"
+#include "runs.h"
+#include "freeq.h"
+#include "epoch.h"
+#include "prezero.h"
+
+#define SCAVENGE_GROWTH (1 << 16) /* heap growth that triggers a scavenge */
+
+/* private variables */
+static lock_t heap_lock = LOCK_INITIALIZER;
+static CacheMode cache_want = CACHE_NONE;
+static LockKind lock_kind = LOCK_MUTEX;
+static int runs_want;            /* serve small blocks from owned runs? */
+static int offload_want;         /* queue frees for a background thread? */
+static int prezero_want;         /* zero free blocks in the background? */
+static int lock_counting;        /* count heap lock contention? */
+static int scavenge_ms = -1;     /* scavenger period, 0 = on growth only */
+static size_t scavenge_mark;     /* heap size that triggers a scavenge */
+static pthread_t scavenger;
+static int scavenger_running;
+static pthread_mutex_t scavenger_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scavenger_wake = PTHREAD_COND_INITIALIZER;
+
+/*
+ * mt_set_cache - cache small free blocks in the given mode from the
+ *     next mt_init on
+ */
+void mt_set_cache(CacheMode mode)
+{
+    cache_want = mode;
+}
+
+/*
+ * mt_set_runs - serve small blocks from thread-owned runs, or not, from
+ *     the next mt_init on
+ */
+void mt_set_runs(int on)
+{
+    runs_want = on;
+}
+
+/*
+ * mt_set_offload - queue frees for a background thread to do, or not,
+ *     from the next mt_init on
+ */
+void mt_set_offload(int on)
+{
+    offload_want = on;
+}
+
+/*
+ * mt_set_prezero - zero large free blocks in a background thread, or
+ *     not, from the next mt_init on
+ */
+void mt_set_prezero(int on)
+{
+    prezero_want = on;
+}
+
+/*
+ * mt_set_lock - use the given kind of heap lock from the next mt_init on
+ */
+void mt_set_lock(LockKind kind)
+{
+    lock_kind = kind;
+}
+
+/*
+ * mt_set_lockstat - count heap lock contention from the next mt_init on
+ */
+void mt_set_lockstat(int on)
+{
+    lock_counting = on;
+}
+
+/*
+ * mt_set_scavenge - from the next mt_init on, scavenge idle thread
+ *     caches every ms milliseconds and on heap growth (ms > 0), only on
+ *     heap growth (ms == 0), or never (ms < 0)
+ */
+void mt_set_scavenge(int ms)
+{
+    scavenge_ms = ms;
+}
+
+/*
+ * release_blocks - give n cached blocks back to the heap, under one
+ *     acquisition of the heap lock
+ */
+static void release_blocks(void **blocks, int n)
+{
+    int i;
+
+    lock_acquire(&heap_lock);
+    for (i = 0; i < n; i++)
+	mm_free(blocks[i]);
+    lock_release(&heap_lock);
+}
+
+/*
+ * release_deferred - give n blocks whose readers are gone back to the
+ *     runs or the heap, the heap's under one acquisition of its lock
+ */
+static void release_deferred(void **blocks, int n)
+{
+    int i, k = 0;
+
+    for (i = 0; i < n; i++)
+	if (!runs_on() || !runs_free(blocks[i]))
+	    blocks[k++] = blocks[i];
+    if (k > 0)
+	release_blocks(blocks, k);
+}
+
+/*
+ * grab_chunk - a block of size bytes for runs, under the heap lock
+ */
+static void *grab_chunk(uint32_t size)
+{
+    void *p;
+
+    lock_acquire(&heap_lock);
+    p = mm_malloc(size);
+    lock_release(&heap_lock);
+    return p;
+}
+
+/*
+ * claim_dirty - a free block of PREZERO_MIN payload bytes or more that
+ *     isn't zeroed yet, taken out of the heap under its lock; sets
+ *     *size to its payload bytes. The heap is searched a bounded
+ *     stretch at a time, and the lock dropped in between, so the idle
+ *     priority zeroer never keeps other threads waiting on a long walk.
+ */
+static void *claim_dirty(uint32_t *size)
+{
+    void *p;
+    int more;
+
+    do {
+	lock_acquire(&heap_lock);
+	if ((p = mm_claim_dirty(PREZERO_MIN, &more)) != NULL)
+	    *size = mm_usable_size(p);
+	lock_release(&heap_lock);
+    } while (p == NULL && more);
+    return p;
+}
+
+/*
+ * give_back_clean - free a claimed block, now zeroed, under the heap lock
+ */
+static void give_back_clean(void *p)
+{
+    lock_acquire(&heap_lock);
+    mm_free_clean(p);
+    lock_release(&heap_lock);
+}
+
+/* scavenge_loop - scavenger thread body: scavenge until mt_fini */
+static void *scavenge_loop(void *arg)
+{
+    struct timespec ts;
+
+    pthread_mutex_lock(&scavenger_lock);
+    while (scavenger_running) {
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += scavenge_ms * 1000000L;
+	ts.tv_sec += ts.tv_nsec / 1000000000L;
+	ts.tv_nsec %= 1000000000L;
+	pthread_cond_timedwait(&scavenger_wake, &scavenger_lock, &ts);
+	if (!scavenger_running)
+	    break;
+	pthread_mutex_unlock(&scavenger_lock);
+	cache_scavenge();
+	pthread_mutex_lock(&scavenger_lock);
+    }
+    pthread_mutex_unlock(&scavenger_lock);
+    return NULL;
+}
+
+/*
+ * mt_init - initialize the mm package and empty the caches, and start
+ *     the scavenger, the free queue's drainer and the zeroer if asked
+ *     to. Must be called before any thread uses the mt_ functions.
+ */
+int mt_init(void)
+{
+    int rc;
+
+    mt_fini();
+    lock_reset(&heap_lock, lock_kind, lock_counting);
+    cache_init(cache_want, release_blocks);
+    runs_init(runs_want, grab_chunk);
+    freeq_init(offload_want, release_blocks);
+    epoch_init(release_deferred);
+    if ((rc = mm_init()) < 0)
+	return rc;
+    prezero_init(prezero_want, claim_dirty, give_back_clean);
+    scavenge_mark = mem_heapsize() + SCAVENGE_GROWTH;
+    if (scavenge_ms > 0 && cache_mode() == CACHE_THREAD) {
+	scavenger_running = 1;
+	if (pthread_create(&scavenger, NULL, scavenge_loop, NULL) != 0) {
+	    fprintf(stderr, "mt_init: pthread_create error\n");
+	    exit(1);
+	}
+    }
+    return rc;
+}
+
+/*
+ * mt_fini - stop the scavenger and the zeroer, and free what is left
+ *     on the free queue and every deferred block. Must be called once
+ *     no thread uses the mt_ functions.
+ */
+void mt_fini(void)
+{
+    prezero_fini();
+    freeq_fini();
+    epoch_fini();
+    pthread_mutex_lock(&scavenger_lock);
+    if (!scavenger_running) {
+	pthread_mutex_unlock(&scavenger_lock);
+	return;
+    }
+    scavenger_running = 0;
+    pthread_cond_signal(&scavenger_wake);
+    pthread_mutex_unlock(&scavenger_lock);
+    pthread_join(scavenger, NULL);
+}
+
+/*
+ * cached_malloc - a block of class cls from the caller's cache, which
+ *     is refilled from the heap when it runs dry
+ */
+static void *cached_malloc(int cls)
+{
+    uint32_t size = cache_class_size(cls);
+    void *p, *q;
+    int i, grown = 0;
+
+    if ((p = cache_get(cls)) != NULL)
+	return p;
+    lock_acquire(&heap_lock);
+    p = mm_malloc(size);
+    for (i = 1; p != NULL && i < CACHE_BATCH; i++) {
+	if ((q = mm_malloc(size)) == NULL)
+	    break;
+	if (!cache_put(cls, q)) {
+	    mm_free(q);
+	    break;
+	}
+    }
+    if (scavenge_ms >= 0 && mem_heapsize() >= scavenge_mark) {
+	scavenge_mark = mem_heapsize() + SCAVENGE_GROWTH;
+	grown = 1;
+    }
+    lock_release(&heap_lock);
+    if (grown)
+	cache_scavenge();
+    return p;
+}
+
+/*
+ * mt_malloc - mm_malloc under the heap lock, or from a run or a cache
+ */
+void *mt_malloc(uint32_t size)
+{
+    void *p;
+
+    if (size > 0 && size <= RUN_MAX && runs_on() &&
+	(p = runs_malloc(size)) != NULL)
+	return p;
+    if (size > 0 && size <= CACHE_MAX && cache_mode() != CACHE_NONE)
+	return cached_malloc(cache_class(size));
+    lock_acquire(&heap_lock);
+    p = mm_malloc(size);
+    lock_release(&heap_lock);
+    return p;
+}
+
+/*
+ * mt_calloc - allocate a zeroed payload of size bytes. The memset is
+ *     skipped when the heap serves it from a block zeroed already,
+ *     which a large one looks for when the zeroer is on.
+ */
+void *mt_calloc(uint32_t size)
+{
+    void *p;
+    int clean = 0;
+
+    if (size > CACHE_MAX || (!runs_on() && cache_mode() == CACHE_NONE)) {
+	lock_acquire(&heap_lock);
+	p = prezero_on() && size >= PREZERO_MIN ? mm_malloc_clean(size) :
+	    mm_malloc(size);
+	if (p != NULL)
+	    clean = mm_clean(p);
+	lock_release(&heap_lock);
+    }
+    else
+	p = mt_malloc(size);
+    if (p == NULL)
+	return NULL;
+    if (!clean)
+	memset(p, 0, size);
+    prezero_note(size, clean);
+    return p;
+}
+
+/*
+ * mt_free - mm_free under the heap lock, or into a run or a cache, or
+ *     onto the free queue. A block in a run is known by its page. Only
+ *     blocks that hold exactly a class's payload are cached, since
+ *     their size is all that says which class they belong to.
+ */
+void mt_free(void *ptr)
+{
+    uint32_t usable;
+    void *q;
+    int i, cls = -1, large;
+
+    if (runs_on() && runs_free(ptr))
+	return;
+    if (cache_mode() != CACHE_NONE && ptr != NULL) {
+	usable = mm_usable_size(ptr);
+	if (usable <= CACHE_MAX && usable % CACHE_QUANTUM == 0) {
+	    cls = cache_class(usable);
+	    if (cache_put(cls, ptr))
+		return;
+	}
+    }
+    if (ptr != NULL && freeq_push(ptr))
+	return;
+    large = prezero_on() && ptr != NULL && mm_usable_size(ptr) >= PREZERO_MIN;
+    lock_acquire(&heap_lock);
+    mm_free(ptr);
+    for (i = 1; cls >= 0 && i < CACHE_BATCH; i++) {
+	if ((q = cache_get(cls)) == NULL)
+	    break;
+	mm_free(q);
+    }
+    lock_release(&heap_lock);
+    if (large)
+	prezero_kick();
+}
+
+/*
+ * mt_realloc - mm_realloc under the heap lock. A block in a run can't
+ *     grow or shrink, so it moves.
+ */
+void *mt_realloc(void *ptr, uint32_t size)
+{
+    uint32_t oldsize;
+    void *p;
+
+    if (runs_on() && ptr != NULL && (oldsize = runs_size(ptr)) > 0) {
+	if (size == 0) {
+	    runs_free(ptr);
+	    return NULL;
+	}
+	if ((p = mt_malloc(size)) != NULL) {
+	    memcpy(p, ptr, oldsize < size ? oldsize : size);
+	    runs_free(ptr);
+	}
+	return p;
+    }
+    lock_acquire(&heap_lock);
+    p = mm_realloc(ptr, size);
+    lock_release(&heap_lock);
+    return p;
+}
+
+/*
+ * mt_read_enter - start a section in which the caller reads blocks that
+ *     other threads may unlink and mt_free_deferred meanwhile; sections
+ *     may nest
+ */
+void mt_read_enter(void)
+{
+    epoch_enter();
+}
+
+/*
+ * mt_read_exit - end a section started by mt_read_enter
+ */
+void mt_read_exit(void)
+{
+    epoch_exit();
+}
+
+/*
+ * mt_free_deferred - free ptr once no thread that may have seen it is
+ *     still inside a read section; the caller must have unlinked it
+ *     from wherever readers find it
+ */
+void mt_free_deferred(void *ptr)
+{
+    if (ptr != NULL)
+	epoch_retire(ptr);
+}
+
+/*
+ * mt_cached_bytes - payload bytes sitting free in the caches
+ */
+size_t mt_cached_bytes(void)
+{
+    return cache_bytes();
+}
+
+/*
+ * mt_scavenged_bytes - payload bytes scavenged since mt_init
+ */
+size_t mt_scavenged_bytes(void)
+{
+    return cache_scavenged();
+}
+
+/*
+ * mt_run_bytes - bytes taken from the heap for runs since mt_init
+ */
+size_t mt_run_bytes(void)
+{
+    return runs_pages() * RUN_SIZE;
+}
+
+/*
+ * mt_freeq_stats - what the free queue has been through since mt_init
+ */
+void mt_freeq_stats(freeqstat_t *stats)
+{
+    freeq_stats(stats);
+}
+
+/*
+ * mt_epoch_stats - what deferred freeing has been through since mt_init
+ */
+void mt_epoch_stats(epochstat_t *stats)
+{
+    epoch_stats(stats);
+}
+
+/*
+ * mt_zero_stats - who zeroed calloc'd payloads since mt_init
+ */
+void mt_zero_stats(zerostat_t *stats)
+{
+    prezero_stats(stats);
+}
+
+/*
+ * mt_arenas - the number of arenas, each a heap behind its own lock
+ */
+int mt_arenas(void)
+{
+    return 1;
+}
+
+/*
+ * mt_arena_stats - the lock counts of an arena since mt_init, all zero
+ *     unless mt_set_lockstat turned counting on
+ */
+void mt_arena_stats(int arena, lockstat_t *stats)
+{
+    lock_stats(&heap_lock, stats);
+}
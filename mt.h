@@ -0,0 +1,40 @@
+/*
+ * mt.h - thread-safe front end to the mm malloc package
+ */
+#ifndef __MT_H_
+#define __MT_H_
+
+#include <stdint.h>
+
+#include "cache.h"
+#include "lock.h"
+#include "freeq.h"
+#include "epoch.h"
+#include "prezero.h"
+
+void mt_set_cache(CacheMode mode);
+void mt_set_scavenge(int ms);
+void mt_set_lock(LockKind kind);
+void mt_set_lockstat(int on);
+void mt_set_runs(int on);
+void mt_set_offload(int on);
+void mt_set_prezero(int on);
+int mt_init(void);
+void mt_fini(void);
+void *mt_malloc(uint32_t size);
+void *mt_calloc(uint32_t size);
+void mt_free(void *ptr);
+void *mt_realloc(void *ptr, uint32_t size);
+void mt_read_enter(void);
+void mt_read_exit(void);
+void mt_free_deferred(void *ptr);
+size_t mt_cached_bytes(void);
+size_t mt_scavenged_bytes(void);
+size_t mt_run_bytes(void);
+void mt_freeq_stats(freeqstat_t *stats);
+void mt_epoch_stats(epochstat_t *stats);
+void mt_zero_stats(zerostat_t *stats);
+int mt_arenas(void);
+void mt_arena_stats(int arena, lockstat_t *stats);
+
+#endif /* __MT_H_ */
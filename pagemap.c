@@ -0,0 +1,90 @@
+/*
+ * pagemap.c - two-level radix tree over heap page numbers.
+ *
+ * Page numbers count from the base passed to pagemap_init, so the map
+ * covers PM_MAX_PAGES pages (4GB) above it. The root is a static array
+ * of leaf pointers and each leaf maps 1024 consecutive pages to their
+ * spans; leaves are allocated the first time one of their pages is
+ * claimed. A whole span is entered page by page, so a lookup never has
+ * to search.
+ *
+ * Threads setting pages must not race to make the same leaf, but
+ * lookups may run alongside any set: a new leaf is zeroed before it is
+ * published, and every entry is stored atomically.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pagemap.h"
+
+char *pm_base;
+span_t **pm_root[PM_ROOT_SIZE];
+
+/*
+ * pagemap_init - start an empty map for pages counted from base. The
+ *     leaves of an earlier map over the same base are cleared and kept.
+ */
+void pagemap_init(void *base)
+{
+    int i;
+
+    for (i = 0; i < PM_ROOT_SIZE; i++) {
+	if (pm_root[i] == NULL)
+	    continue;
+	if (base == pm_base)
+	    memset(pm_root[i], 0, PM_LEAF_SIZE * sizeof(span_t *));
+	else {
+	    free(pm_root[i]);
+	    pm_root[i] = NULL;
+	}
+    }
+    pm_base = base;
+}
+
+/*
+ * set_range - point every page that [start, start+len) touches at span
+ */
+static void set_range(void *start, size_t len, span_t *span)
+{
+    size_t pn, last;
+    span_t ***leafp, **leaf;
+
+    if (len == 0)
+	return;
+    pn = (size_t)((char *)start - pm_base) >> PM_PAGE_SHIFT;
+    last = (size_t)((char *)start + len - 1 - pm_base) >> PM_PAGE_SHIFT;
+    if (last >= PM_MAX_PAGES) {
+	fprintf(stderr, "pagemap: %p is beyond the map\n", start);
+	exit(1);
+    }
+    for (; pn <= last; pn++) {
+	leafp = &pm_root[pn >> PM_LEAF_BITS];
+	if ((leaf = *leafp) == NULL) {
+	    if (span == NULL)
+		continue;
+	    if ((leaf = calloc(PM_LEAF_SIZE, sizeof(span_t *))) == NULL) {
+		fprintf(stderr, "pagemap: calloc error\n");
+		exit(1);
+	    }
+	    __atomic_store_n(leafp, leaf, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&leaf[pn & (PM_LEAF_SIZE - 1)], span, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * pagemap_set - record that span owns the pages [start, start+len) touches
+ */
+void pagemap_set(void *start, size_t len, span_t *span)
+{
+    set_range(start, len, span);
+}
+
+/*
+ * pagemap_clear - forget the owner of the pages [start, start+len) touches
+ */
+void pagemap_clear(void *start, size_t len)
+{
+    set_range(start, len, NULL);
+}
@@ -0,0 +1,57 @@
+/*
+ * pagemap.h - map from heap pages to the spans that own them, so a
+ *             pointer can be traced to its tier without reading any
+ *             header next to it
+ */
+#ifndef __PAGEMAP_H_
+#define __PAGEMAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PM_PAGE_SHIFT 12                 /* 4KB pages */
+#define PM_LEAF_BITS  10                 /* pages per leaf: 1024 (4MB) */
+#define PM_ROOT_BITS  10                 /* leaves in the root: 1024 */
+#define PM_LEAF_SIZE  (1 << PM_LEAF_BITS)
+#define PM_ROOT_SIZE  (1 << PM_ROOT_BITS)
+#define PM_MAX_PAGES  ((size_t)1 << (PM_ROOT_BITS + PM_LEAF_BITS))
+
+/* The kinds of memory a span can hold */
+typedef enum {SPAN_HEAP, SPAN_SLAB, SPAN_LARGE, SPAN_RUN} SpanKind;
+
+/* A run of pages claimed by one tier */
+typedef struct span {
+    char *start;           /* first byte of the span */
+    size_t npages;         /* pages covered */
+    SpanKind kind;         /* what the pages hold */
+    int sizeclass;         /* object size class, for slabs and runs */
+    void *owner;           /* tier-specific: the arena, thread, ... */
+} span_t;
+
+/* The two levels; only pagemap.c and pagemap_lookup touch these */
+extern char *pm_base;
+extern span_t **pm_root[PM_ROOT_SIZE];
+
+void pagemap_init(void *base);
+void pagemap_set(void *start, size_t len, span_t *span);
+void pagemap_clear(void *start, size_t len);
+
+/*
+ * pagemap_lookup - the span owning the page p is on, or NULL. Two
+ *     dependent loads: the leaf from the root, then the span from the
+ *     leaf. A lookup may run while other threads set pages, so the
+ *     loads are atomic (plain loads on x86).
+ */
+static inline span_t *pagemap_lookup(const void *p)
+{
+    size_t pn = (size_t)((const char *)p - pm_base) >> PM_PAGE_SHIFT;
+    span_t **leaf;
+
+    if (pn >= PM_MAX_PAGES)
+	return NULL;
+    leaf = __atomic_load_n(&pm_root[pn >> PM_LEAF_BITS], __ATOMIC_ACQUIRE);
+    return leaf ? 
+	__atomic_load_n(&leaf[pn & (PM_LEAF_SIZE - 1)], __ATOMIC_ACQUIRE) : NULL;
+}
+
+#endif /* __PAGEMAP_H_ */
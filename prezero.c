@@ -0,0 +1,146 @@
+/*
+ * prezero.c - zeroing free blocks in the background.
+ *
+ * calloc has to hand back a zeroed payload, and for a large one the
+ * memset is most of the call. With pre-zeroing on, a background thread
+ * running at idle priority, so that it only gets CPU time no other
+ * thread wants, wakes every PREZERO_MS milliseconds and asks for a free
+ * block of at least PREZERO_MIN payload bytes that isn't known to be
+ * zero. The heap takes such a block out of use and hands it over; the
+ * thread zeroes it outside the heap lock and gives it back marked
+ * clean, and asks for the next until there are none. A large free
+ * wakes it early, since it may have made a dirty block worth zeroing.
+ * The heap keeps the mark as long as the block's payload stays zero,
+ * through splits and through coalescing with other clean blocks, and a
+ * calloc served from a clean block skips the memset.
+ *
+ * The counts here say who zeroed calloc'd bytes: calloc itself, inline,
+ * or nobody, since the background thread had.
+ */
+#define _GNU_SOURCE             /* for SCHED_IDLE */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "prezero.h"
+
+/* private variables */
+static int on;
+static zerostat_t stats;         /* updated atomically */
+static void *(*claim)(uint32_t *size); /* takes a dirty block from the heap */
+static void (*give_back)(void *p);     /* returns it, clean */
+static pthread_t zeroer;
+static int zeroer_running;
+static pthread_mutex_t zeroer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t zeroer_wake = PTHREAD_COND_INITIALIZER;
+
+/* zero_loop - zeroer thread body: zero dirty blocks until prezero_fini */
+static void *zero_loop(void *arg)
+{
+    struct timespec ts;
+    struct sched_param param = {0};
+    uint32_t size;
+    void *p;
+
+    /* Only take CPU time nothing else wants */
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    pthread_mutex_lock(&zeroer_lock);
+    while (zeroer_running) {
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += PREZERO_MS * 1000000L;
+	ts.tv_sec += ts.tv_nsec / 1000000000L;
+	ts.tv_nsec %= 1000000000L;
+	pthread_cond_timedwait(&zeroer_wake, &zeroer_lock, &ts);
+	while (zeroer_running) {
+	    pthread_mutex_unlock(&zeroer_lock);
+	    if ((p = claim(&size)) != NULL) {
+		memset(p, 0, size);
+		give_back(p);
+		__atomic_add_fetch(&stats.background, size, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&stats.blocks, 1, __ATOMIC_RELAXED);
+	    }
+	    pthread_mutex_lock(&zeroer_lock);
+	    if (p == NULL)
+		break;
+	}
+    }
+    pthread_mutex_unlock(&zeroer_lock);
+    return NULL;
+}
+
+/*
+ * prezero_init - empty the counts and zero free blocks ahead or not;
+ *     dirty blocks come from claim_fn, which sets their payload size,
+ *     and go back through give_back_fn. Starts the zeroer if on, so the
+ *     heap must be initialized. Must be called after prezero_fini.
+ */
+void prezero_init(int want, void *(*claim_fn)(uint32_t *size),
+		  void (*give_back_fn)(void *p))
+{
+    claim = claim_fn;
+    give_back = give_back_fn;
+    memset(&stats, 0, sizeof(stats));
+    on = want;
+    if (!on)
+	return;
+    zeroer_running = 1;
+    if (pthread_create(&zeroer, NULL, zero_loop, NULL) != 0) {
+	fprintf(stderr, "prezero_init: pthread_create error\n");
+	exit(1);
+    }
+}
+
+/*
+ * prezero_fini - stop the zeroer, once it has given back any block it
+ *     is zeroing
+ */
+void prezero_fini(void)
+{
+    pthread_mutex_lock(&zeroer_lock);
+    if (!zeroer_running) {
+	pthread_mutex_unlock(&zeroer_lock);
+	return;
+    }
+    zeroer_running = 0;
+    pthread_cond_signal(&zeroer_wake);
+    pthread_mutex_unlock(&zeroer_lock);
+    pthread_join(zeroer, NULL);
+    on = 0;
+}
+
+/* prezero_on - are free blocks zeroed in the background? */
+int prezero_on(void)
+{
+    return on;
+}
+
+/* prezero_kick - wake the zeroer, as a large block was just freed */
+void prezero_kick(void)
+{
+    if (on)
+	pthread_cond_signal(&zeroer_wake);
+}
+
+/*
+ * prezero_note - count a calloc of size bytes, which were zeroed
+ *     already if clean and zeroed inline if not
+ */
+void prezero_note(uint32_t size, int clean)
+{
+    if (clean)
+	__atomic_add_fetch(&stats.skipped, size, __ATOMIC_RELAXED);
+    else
+	__atomic_add_fetch(&stats.inline_bytes, size, __ATOMIC_RELAXED);
+}
+
+/* prezero_stats - copy out the counts since prezero_init */
+void prezero_stats(zerostat_t *s)
+{
+    s->inline_bytes = __atomic_load_n(&stats.inline_bytes, __ATOMIC_RELAXED);
+    s->skipped = __atomic_load_n(&stats.skipped, __ATOMIC_RELAXED);
+    s->background = __atomic_load_n(&stats.background, __ATOMIC_RELAXED);
+    s->blocks = __atomic_load_n(&stats.blocks, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,30 @@
+/*
+ * prezero.h - a background thread that zeroes large free blocks ahead
+ *             of time, so callocs that get one needn't
+ */
+#ifndef __PREZERO_H_
+#define __PREZERO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PREZERO_MIN 2048   /* smallest free payload zeroed ahead; mm.c's SCRUB_MAX */
+#define PREZERO_MS  1      /* zeroer looks for dirty blocks this often (ms) */
+
+/* Who zeroed calloc'd payloads since prezero_init */
+typedef struct {
+    size_t inline_bytes; /* zeroed by calloc itself */
+    size_t skipped;      /* ... not, since the block was zeroed already */
+    size_t background;   /* zeroed by the background thread */
+    long blocks;         /* ... in this many free blocks */
+} zerostat_t;
+
+void prezero_init(int on, void *(*claim)(uint32_t *size),
+		  void (*give_back)(void *p));
+void prezero_fini(void);
+int prezero_on(void);
+void prezero_kick(void);
+void prezero_note(uint32_t size, int clean);
+void prezero_stats(zerostat_t *stats);
+
+#endif /* __PREZERO_H_ */
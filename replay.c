@@ -0,0 +1,538 @@
+/*
+ * replay.c - multithreaded trace replay.
+ *
+ * Each thread id in the trace gets its own pthread, which issues that
+ * thread's requests in trace order. A request on a block must not run
+ * before the previous request on the same block (which may belong to
+ * another thread), so each op waits for that one op to be marked done.
+ * The trace order is a valid serialization, so the earliest unfinished
+ * op can always run and the replay cannot deadlock.
+ *
+ * In timed mode each op also waits until its timestamp, measured from
+ * the start of the replay; otherwise ops run as fast as possible.
+ *
+ * Every payload is filled with the low byte of its id, and the first
+ * and last bytes are checked again when the block is reallocated or
+ * freed, which catches blocks that the allocator handed out twice.
+ *
+ * When the mt_ front end caches blocks, the thread that completes each
+ * tenth of the ops also samples the bytes held in the caches, which
+ * shows how much memory sits stranded in them as the replay goes on.
+ *
+ * To count false sharing, each op stamps, from one shared counter, the
+ * moment just before its old block is freed and the moment just after
+ * its new block is allocated. A block can only be handed out again after
+ * the free that gave it back, so the stamps put the frees and allocations
+ * in the order they really happened, and once the replay is over a sweep
+ * in that order follows the live payloads on every cache line of the
+ * heap. A line is shared if it ever held live payloads allocated by two
+ * different threads at once. The counter is itself a shared line, so
+ * this is a diagnostic, not for timing.
+ *
+ * If asked to, each op also times its calls into the mt_ front end with
+ * the cycle counter, so the replay can report the latency that the
+ * threads issuing the ops see, and not just the total throughput.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "mt.h"
+#include "replay.h"
+#include "memlib.h"
+#include "clock.h"
+#include "config.h"
+
+#define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define LINESIZE 64      /* cache line size (bytes) */
+
+/* State shared by all the threads replaying one trace */
+typedef struct {
+    trace_t *trace;
+    int tracenum;
+    int timed;           /* honor the timestamps? */
+    long *deps;          /* previous op on the same id, or -1 */
+    char *done;          /* set once each op has completed */
+    char **raw;          /* block as returned by the allocator, per id */
+    long long start_ns;  /* when the replay started */
+    int errors;          /* number of failed checks */
+    long completed;      /* ops done, when sampling the caches */
+    long sample_every;   /* ops between samples, or 0 not to sample */
+    size_t *cached_at;   /* bytes in the caches at each sample */
+    int lines;           /* count the cache lines threads share? */
+    long clock;          /* next stamp */
+    long *stamps;        /* per op, when its old block went and new came */
+    char **payloads;     /* per op, the payload it allocated */
+    unsigned long long *cycles; /* per op, cycles in mt_ calls, if timed */
+    pthread_barrier_t barrier;
+} replay_t;
+
+/* A cache line, as the sweep goes */
+typedef struct {
+    int live;            /* live payloads on it */
+    int tid;             /* thread that allocated the last of them */
+    char seen;           /* has it held a live payload? */
+    char shared;         /* has it been mixed? */
+} line_t;
+
+/* One replay thread and the ops it issues */
+typedef struct {
+    replay_t *r;
+    long *ops;           /* indices of this thread's ops, in trace order */
+    long nops;
+    pthread_t thread;
+} worker_t;
+
+/* now_ns - monotonic clock in nsecs */
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* wait_until - sleep, then yield, until the monotonic clock reaches t */
+static void wait_until(long long t)
+{
+    struct timespec ts;
+    long long left;
+
+    while ((left = t - now_ns()) > 0) {
+	if (left > 100000) {
+	    ts.tv_sec = 0;
+	    ts.tv_nsec = left - 50000;
+	    nanosleep(&ts, NULL);
+	}
+	else
+	    sched_yield();
+    }
+}
+
+/* replay_error - report a failed check */
+static void replay_error(replay_t *r, long opnum, const char *msg)
+{
+    __atomic_add_fetch(&r->errors, 1, __ATOMIC_RELAXED);
+    printf("ERROR [trace %d, line %ld]: %s\n", r->tracenum, LINENUM(opnum), msg);
+}
+
+/*
+ * stamp - note, when counting shared lines, that op i's old block is
+ *     about to be freed (k = 0) or its new block has been allocated (k = 1)
+ */
+static void stamp(replay_t *r, long i, int k)
+{
+    if (r->lines)
+	r->stamps[2 * i + k] = __atomic_fetch_add(&r->clock, 1, __ATOMIC_RELAXED);
+}
+
+/* op_clock - the cycle counter, if the replay times its mt_ calls */
+static unsigned long long op_clock(replay_t *r)
+{
+    return r->cycles ? read_counter() : 0;
+}
+
+/* op_time - add the cycles since start to op i's time in mt_ calls */
+static void op_time(replay_t *r, long i, unsigned long long start)
+{
+    if (r->cycles)
+	r->cycles[i] += read_counter() - start;
+}
+
+/*
+ * alloc_block - allocate a payload for op, honoring its alignment and
+ *     zeroing flag. Returns the payload and sets *raw to the pointer
+ *     that has to be handed back to the allocator.
+ */
+static char *alloc_block(traceop_t *op, char **raw)
+{
+    uintptr_t align = (op->align > ALIGNMENT) ? op->align : ALIGNMENT;
+    uint32_t size = op->size + align - ALIGNMENT;
+
+    *raw = (op->flags & OP_ZERO) ? mt_calloc(size) : mt_malloc(size);
+    if (*raw == NULL)
+	return NULL;
+    return (char *)(((uintptr_t)*raw + align - 1) & ~(align - 1));
+}
+
+/* intact - does block p of size bytes still hold the fill for id? */
+static int intact(char *p, size_t size, int id)
+{
+    return size == 0 || 
+	(p[0] == (char)(id & 0xFF) && p[size - 1] == (char)(id & 0xFF));
+}
+
+/* do_op - issue op number i of the trace */
+static void do_op(replay_t *r, long i)
+{
+    trace_t *trace = r->trace;
+    traceop_t *op = &trace->ops[i];
+    int id = op->index;
+    unsigned long long start;
+    size_t oldsize, j;
+    char *p, *raw;
+
+    switch (op->type) {
+    case ALLOC:
+	start = op_clock(r);
+	p = alloc_block(op, &raw);
+	op_time(r, i, start);
+	if (p == NULL) {
+	    replay_error(r, i, "mt_malloc failed");
+	    return;
+	}
+	if (op->align > 0 && ((uintptr_t)p % op->align) != 0)
+	    replay_error(r, i, "payload not aligned as requested");
+	if (op->flags & OP_ZERO)
+	    for (j = 0; j < (size_t)op->size; j++)
+		if (p[j] != 0) {
+		    replay_error(r, i, "zeroed payload is not zero");
+		    break;
+		}
+	stamp(r, i, 1);
+	memset(p, id & 0xFF, op->size);
+	r->raw[id] = raw;
+	trace->blocks[id] = p;
+	trace->block_sizes[id] = op->size;
+	if (r->lines)
+	    r->payloads[i] = p;
+	break;
+
+    case REALLOC:
+	oldsize = trace->block_sizes[id];
+	if (!intact(trace->blocks[id], oldsize, id))
+	    replay_error(r, i, "block was overwritten before realloc");
+	if (op->align > ALIGNMENT || r->raw[id] != trace->blocks[id]) {
+	    /* mm has no aligned realloc, so move the block by hand */
+	    start = op_clock(r);
+	    p = alloc_block(op, &raw);
+	    op_time(r, i, start);
+	    if (p == NULL) {
+		replay_error(r, i, "mt_malloc failed");
+		return;
+	    }
+	    stamp(r, i, 1);
+	    memcpy(p, trace->blocks[id], 
+		   oldsize < (size_t)op->size ? oldsize : (size_t)op->size);
+	    stamp(r, i, 0);
+	    start = op_clock(r);
+	    mt_free(r->raw[id]);
+	    op_time(r, i, start);
+	}
+	else {
+	    stamp(r, i, 0);
+	    start = op_clock(r);
+	    p = raw = mt_realloc(r->raw[id], op->size);
+	    op_time(r, i, start);
+	    if (p == NULL) {
+		replay_error(r, i, "mt_realloc failed");
+		return;
+	    }
+	    stamp(r, i, 1);
+	}
+	if (!intact(p, oldsize < (size_t)op->size ? oldsize : (size_t)op->size, id))
+	    replay_error(r, i, "realloc did not preserve the data from old block");
+	memset(p, id & 0xFF, op->size);
+	r->raw[id] = raw;
+	trace->blocks[id] = p;
+	trace->block_sizes[id] = op->size;
+	if (r->lines)
+	    r->payloads[i] = p;
+	break;
+
+    case FREE:
+	if (!intact(trace->blocks[id], trace->block_sizes[id], id))
+	    replay_error(r, i, "block was overwritten before free");
+	stamp(r, i, 0);
+	start = op_clock(r);
+	mt_free(r->raw[id]);
+	op_time(r, i, start);
+	break;
+    }
+}
+
+/* worker - thread body: issue this thread's ops in order */
+static void *worker(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    replay_t *r = w->r;
+    long k, i, dep;
+
+    pthread_barrier_wait(&r->barrier);
+    for (k = 0; k < w->nops; k++) {
+	i = w->ops[k];
+	if (r->timed)
+	    wait_until(r->start_ns + r->trace->ops[i].ts);
+	if ((dep = r->deps[i]) >= 0)
+	    while (!__atomic_load_n(&r->done[dep], __ATOMIC_ACQUIRE))
+		sched_yield();
+	do_op(r, i);
+	__atomic_store_n(&r->done[i], 1, __ATOMIC_RELEASE);
+	if (r->sample_every > 0) {
+	    long c = __atomic_add_fetch(&r->completed, 1, __ATOMIC_RELAXED);
+
+	    if (c % r->sample_every == 0 || c == r->trace->num_ops)
+		r->cached_at[(c - 1) / r->sample_every] = mt_cached_bytes();
+	}
+    }
+    return NULL;
+}
+
+/*
+ * touch_lines - add (d = 1) or remove (d = -1) a live payload of size
+ *     bytes at p, allocated by thread tid, on the lines it covers
+ */
+static void touch_lines(line_t *lines, size_t nlines, char *p, size_t size,
+			int tid, int d)
+{
+    size_t lo, hi, k;
+    line_t *l;
+
+    if (p == NULL || size == 0 || p < (char *)mem_heap_lo())
+	return;
+    lo = (p - (char *)mem_heap_lo()) / LINESIZE;
+    hi = (p + size - 1 - (char *)mem_heap_lo()) / LINESIZE;
+    for (k = lo; k <= hi && k < nlines; k++) {
+	l = &lines[k];
+	if (d > 0) {
+	    if (l->live > 0 && l->tid != tid)
+		l->shared = 1;
+	    l->tid = tid;
+	    l->seen = 1;
+	}
+	l->live += d;
+    }
+}
+
+/*
+ * count_lines - sweep the stamped frees and allocations in the order
+ *     they happened, counting the lines that held live payloads and
+ *     those that held live payloads of two threads at once
+ */
+static void count_lines(replay_t *r, replay_stats_t *stats)
+{
+    trace_t *trace = r->trace;
+    size_t nlines = mem_heapsize() / LINESIZE + 1, k;
+    line_t *lines;
+    long *order, e, i, dep;
+
+    lines = (line_t *)calloc(nlines, sizeof(line_t));
+    order = (long *)malloc(r->clock * sizeof(long));
+    if (lines == NULL || (r->clock > 0 && order == NULL)) {
+	fprintf(stderr, "count_lines: malloc error\n");
+	exit(1);
+    }
+    for (e = 0; e < 2L * trace->num_ops; e++)
+	if (r->stamps[e] >= 0)
+	    order[r->stamps[e]] = e;
+    for (e = 0; e < r->clock; e++) {
+	i = order[e] / 2;
+	if (order[e] % 2 == 0) {
+	    if ((dep = r->deps[i]) >= 0)
+		touch_lines(lines, nlines, r->payloads[dep], 
+			    trace->ops[dep].size, trace->ops[dep].tid, -1);
+	}
+	else
+	    touch_lines(lines, nlines, r->payloads[i], 
+			trace->ops[i].size, trace->ops[i].tid, 1);
+    }
+    stats->lines = stats->shared_lines = 0;
+    for (k = 0; k < nlines; k++) {
+	stats->lines += lines[k].seen;
+	stats->shared_lines += lines[k].shared;
+    }
+    free(lines);
+    free(order);
+}
+
+/* cmp_cycles - qsort comparison for cycle counts in increasing order */
+static int cmp_cycles(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * percentiles - the median, 99th percentile and max of the cycles the
+ *     frees (frees != 0) or all the ops of the trace spent in mt_ calls
+ */
+static void percentiles(replay_t *r, int frees, double *pct)
+{
+    trace_t *trace = r->trace;
+    unsigned long long *c;
+    long i, n = 0;
+
+    if ((c = malloc(trace->num_ops * sizeof(*c))) == NULL) {
+	fprintf(stderr, "percentiles: malloc error\n");
+	exit(1);
+    }
+    for (i = 0; i < trace->num_ops; i++)
+	if (!frees || trace->ops[i].type == FREE)
+	    c[n++] = r->cycles[i];
+    pct[0] = pct[1] = pct[2] = 0;
+    if (n > 0) {
+	qsort(c, n, sizeof(*c), cmp_cycles);
+	pct[0] = c[n / 2];
+	pct[1] = c[(long)(n * 0.99)];
+	pct[2] = c[n - 1];
+    }
+    free(c);
+}
+
+/*
+ * free_replay - free what replay_trace allocated for a replay
+ */
+static void free_replay(replay_t *r, long *last, long *opslots, 
+			worker_t *workers)
+{
+    free(r->deps);
+    free(r->done);
+    free(r->raw);
+    free(last);
+    free(opslots);
+    free(workers);
+    free(r->stamps);
+    free(r->payloads);
+    free(r->cycles);
+}
+
+/*
+ * replay_trace - replay trace with one thread per thread id, using a
+ *     freshly initialized mm package; count the cache lines shared
+ *     between threads, and time each op's mt_ calls, if asked to.
+ *     Returns 1 if the replay was valid.
+ */
+int replay_trace(trace_t *trace, int tracenum, int timed, int lines,
+		 int latency, replay_stats_t *stats)
+{
+    replay_t r;
+    worker_t *workers;
+    long *last, *opslots, i;
+    int t, n = trace->num_threads;
+    long long end_ns;
+
+    memset(&r, 0, sizeof(r));
+    r.trace = trace;
+    r.tracenum = tracenum;
+    r.timed = timed;
+    r.lines = lines;
+    r.deps = (long *)malloc(trace->num_ops * sizeof(long));
+    r.done = (char *)calloc(trace->num_ops, 1);
+    r.raw = (char **)calloc(trace->num_ids, sizeof(char *));
+    last = (long *)malloc(trace->num_ids * sizeof(long));
+    opslots = (long *)malloc(trace->num_ops * sizeof(long));
+    workers = (worker_t *)calloc(n, sizeof(worker_t));
+    if (!r.deps || !r.done || !r.raw || !last || !opslots || !workers) {
+	fprintf(stderr, "replay_trace: malloc error\n");
+	exit(1);
+    }
+    if (lines) {
+	r.stamps = (long *)malloc(2L * trace->num_ops * sizeof(long));
+	r.payloads = (char **)calloc(trace->num_ops, sizeof(char *));
+	if (!r.stamps || !r.payloads) {
+	    fprintf(stderr, "replay_trace: malloc error\n");
+	    exit(1);
+	}
+	for (i = 0; i < 2 * trace->num_ops; i++)
+	    r.stamps[i] = -1;
+    }
+    if (latency && (r.cycles = calloc(trace->num_ops, 
+				      sizeof(unsigned long long))) == NULL) {
+	fprintf(stderr, "replay_trace: malloc error\n");
+	exit(1);
+    }
+
+    /* Chain the ops on each id, and count each thread's ops */
+    for (i = 0; i < trace->num_ids; i++)
+	last[i] = -1;
+    for (i = 0; i < trace->num_ops; i++) {
+	t = trace->ops[i].tid;
+	if (t < 0 || t >= n) {
+	    printf("ERROR [trace %d]: op %ld has thread id %d of %d\n", 
+		   tracenum, i, t, n);
+	    free_replay(&r, last, opslots, workers);
+	    return 0;
+	}
+	if (trace->ops[i].align < 0 || 
+	    (trace->ops[i].align & (trace->ops[i].align - 1)) != 0) {
+	    printf("ERROR [trace %d]: op %ld has alignment %d\n", 
+		   tracenum, i, trace->ops[i].align);
+	    free_replay(&r, last, opslots, workers);
+	    return 0;
+	}
+	r.deps[i] = last[trace->ops[i].index];
+	last[trace->ops[i].index] = i;
+	workers[t].nops++;
+    }
+
+    /* Give each thread its slice of opslots, filled in trace order */
+    for (t = 0, i = 0; t < n; t++) {
+	workers[t].r = &r;
+	workers[t].ops = opslots + i;
+	i += workers[t].nops;
+	workers[t].nops = 0;
+    }
+    for (i = 0; i < trace->num_ops; i++) {
+	t = trace->ops[i].tid;
+	workers[t].ops[workers[t].nops++] = i;
+    }
+
+    if (mt_init() < 0) {
+	printf("ERROR [trace %d]: mt_init failed\n", tracenum);
+	free_replay(&r, last, opslots, workers);
+	return 0;
+    }
+    memset(stats->cached_at, 0, sizeof(stats->cached_at));
+    if (cache_mode() != CACHE_NONE) {
+	r.sample_every = (trace->num_ops + REPLAY_SAMPLES - 1) / REPLAY_SAMPLES;
+	r.cached_at = stats->cached_at;
+    }
+
+    /* The last thread through the barrier is this one */
+    pthread_barrier_init(&r.barrier, NULL, n + 1);
+    for (t = 0; t < n; t++)
+	if (pthread_create(&workers[t].thread, NULL, worker, &workers[t]) != 0) {
+	    fprintf(stderr, "replay_trace: pthread_create error\n");
+	    exit(1);
+	}
+    r.start_ns = now_ns();
+    pthread_barrier_wait(&r.barrier);
+    for (t = 0; t < n; t++)
+	pthread_join(workers[t].thread, NULL);
+    end_ns = now_ns();
+    pthread_barrier_destroy(&r.barrier);
+    mt_fini();
+
+    stats->threads = n;
+    stats->ops = trace->num_ops;
+    stats->valid = (r.errors == 0);
+    stats->secs = (end_ns - r.start_ns) * 1e-9;
+    stats->cached = mt_cached_bytes();
+    stats->scavenged = mt_scavenged_bytes();
+    stats->arenas = mt_arenas();
+    stats->locks = (lockstat_t *)malloc(stats->arenas * sizeof(lockstat_t));
+    if (stats->locks == NULL) {
+	fprintf(stderr, "replay_trace: malloc error\n");
+	exit(1);
+    }
+    for (t = 0; t < stats->arenas; t++)
+	mt_arena_stats(t, &stats->locks[t]);
+    stats->run_bytes = mt_run_bytes();
+    mt_freeq_stats(&stats->freeq);
+    mt_zero_stats(&stats->zero);
+    if (latency) {
+	percentiles(&r, 0, stats->op_cycles);
+	percentiles(&r, 1, stats->free_cycles);
+    }
+    if (lines)
+	count_lines(&r, stats);
+
+    free_replay(&r, last, opslots, workers);
+    return stats->valid;
+}
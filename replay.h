@@ -0,0 +1,38 @@
+/*
+ * replay.h - replay a trace with one thread per trace thread id,
+ *            calling the thread-safe mt_ front end to mm.c
+ */
+#ifndef __REPLAY_H_
+#define __REPLAY_H_
+
+#include "trace.h"
+#include "lock.h"
+#include "freeq.h"
+#include "prezero.h"
+
+#define REPLAY_SAMPLES 10 /* times the cached bytes are sampled */
+
+/* Summarizes one threaded replay of a trace */
+typedef struct {
+    int threads;     /* number of replay threads */
+    double ops;      /* number of ops in the trace */
+    int valid;       /* did every op succeed with its data intact? */
+    double secs;     /* wall clock secs from first to last op */
+    size_t cached;   /* payload bytes left in the mt_ caches at the end */
+    size_t cached_at[REPLAY_SAMPLES]; /* ... after each tenth of the ops */
+    size_t scavenged; /* payload bytes scavenged from idle thread caches */
+    int arenas;      /* number of heaps, each behind its own lock */
+    lockstat_t *locks; /* lock counts per arena */
+    size_t run_bytes; /* heap taken for thread-owned runs */
+    long lines;      /* cache lines that held live payloads */
+    long shared_lines; /* ... of two threads at once */
+    freeqstat_t freeq; /* what the free queue went through */
+    zerostat_t zero; /* who zeroed calloc'd payloads */
+    double op_cycles[3];   /* p50, p99 and max cycles of an op's mt_ calls */
+    double free_cycles[3]; /* ... and of a free's */
+} replay_stats_t;
+
+int replay_trace(trace_t *trace, int tracenum, int timed, int lines,
+		 int latency, replay_stats_t *stats);
+
+#endif /* __REPLAY_H_ */
@@ -0,0 +1,385 @@
+/*
+ * runs.c - thread-owned runs of small blocks.
+ *
+ * A shared heap places each block wherever it fits, so the small blocks
+ * of different threads end up side by side, often in the same cache
+ * line. When the threads write their own blocks at the same time, the
+ * line bounces between CPUs though no byte of it is shared: false
+ * sharing. With runs on, the mt_ front end serves small mallocs from
+ * runs instead. A run is one page of equal slots of one of cache.h's
+ * size classes, and only the thread that owns it allocates from it, so
+ * every cache line of the run holds blocks of that one thread.
+ *
+ * Pages for runs are taken from the heap RUN_CHUNK at a time, as one
+ * block with room to align them, and each is entered in the page map as
+ * a span of kind SPAN_RUN, so mt_free can tell a block in a run from a
+ * heap block by its address alone. Their leaves of the map exist
+ * already, since the heap entered its pages when it grew, so entering a
+ * run only writes that run's own entries. The pages stay with the runs
+ * until the next runs_init.
+ *
+ * The owner takes slots from the run's local free list, then from its
+ * never-used tail. A slot the owner frees goes back on the local list;
+ * one freed by another thread is pushed onto the run's remote list with
+ * a compare-and-swap, and the owner takes the whole remote list at once
+ * when the local one runs dry. Only the owner takes from the remote
+ * list, so the pushes are safe from ABA.
+ *
+ * A thread keeps a list of its runs of each class, the one it allocates
+ * from first. When that one is full, the thread looks through the rest
+ * for a slot before it takes a new run. A run the owner empties goes
+ * back to the pool of empty runs, for any class. When a thread exits,
+ * its runs are abandoned, blocks still out and all, and a thread that
+ * needs a new run of the class adopts one of those first.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "runs.h"
+
+/* A run, on a cache line of its own */
+typedef struct run {
+    span_t span;          /* first, so the page map leads to the run */
+    void *local;          /* slots freed by the owner */
+    void *remote;         /* slots freed by other threads */
+    char *bump;           /* first slot never handed out */
+    int used;             /* slots out, as far as the owner knows */
+    struct run *next;     /* on the owner's list or a pool */
+    struct run *prev;     /* on the owner's list */
+    struct run *all;      /* next run made since runs_init */
+} __attribute__((aligned(64))) run_t;
+
+/* The runs of one thread */
+typedef struct owner {
+    run_t *runs[CACHE_CLASSES]; /* per class, the one allocated from first */
+    struct owner *next;         /* next owner that hasn't exited */
+} owner_t;
+
+/* private variables */
+static int on;
+static pthread_mutex_t runs_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *(*grab)(uint32_t size); /* takes a chunk from the heap */
+static run_t *all_runs;         /* every run made since runs_init */
+static run_t *empty_runs;       /* runs with no owner and no blocks out */
+static run_t *abandoned[CACHE_CLASSES]; /* runs of threads that exited */
+static owner_t *owners;         /* owners of threads that haven't exited */
+static size_t pages;            /* pages taken for runs */
+static unsigned generation;     /* bumped by runs_init */
+static pthread_key_t runs_key;  /* destructor abandons an exiting thread's */
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+static __thread owner_t *me;
+static __thread unsigned my_generation;
+
+/* current - the calling thread's owner, or NULL if it has none yet */
+static owner_t *current(void)
+{
+    return my_generation == generation ? me : NULL;
+}
+
+/*
+ * my_owner - the calling thread's owner, made on its first use since
+ *     the last runs_init; NULL if there's no memory for one
+ */
+static owner_t *my_owner(void)
+{
+    owner_t *o;
+
+    if ((o = current()) != NULL)
+	return o;
+    if ((o = (owner_t *)calloc(1, sizeof(owner_t))) == NULL)
+	return NULL;
+    pthread_mutex_lock(&runs_lock);
+    o->next = owners;
+    owners = o;
+    pthread_mutex_unlock(&runs_lock);
+    me = o;
+    my_generation = generation;
+    pthread_setspecific(runs_key, o);
+    return o;
+}
+
+/* collect - move the slots other threads freed onto r's local list */
+static void collect(run_t *r)
+{
+    void *p = __atomic_exchange_n(&r->remote, NULL, __ATOMIC_ACQUIRE);
+    void *q;
+
+    for (; p != NULL; p = q) {
+	q = *(void **)p;
+	*(void **)p = r->local;
+	r->local = p;
+	r->used--;
+    }
+}
+
+/* take - a free slot of the owner's run r, or NULL if r is full */
+static void *take(run_t *r)
+{
+    uint32_t size = cache_class_size(r->span.sizeclass);
+    void *p;
+
+    if (r->local == NULL && __atomic_load_n(&r->remote, __ATOMIC_RELAXED))
+	collect(r);
+    if ((p = r->local) != NULL)
+	r->local = *(void **)p;
+    else if (r->bump + size <= r->span.start + RUN_SIZE) {
+	p = r->bump;
+	r->bump += size;
+    }
+    else
+	return NULL;
+    r->used++;
+    return p;
+}
+
+/* push - put r at the front of o's runs of its class */
+static void push(owner_t *o, run_t *r)
+{
+    run_t **head = &o->runs[r->span.sizeclass];
+
+    r->prev = NULL;
+    r->next = *head;
+    if (*head != NULL)
+	(*head)->prev = r;
+    *head = r;
+}
+
+/* unlink_run - take r off o's runs of its class */
+static void unlink_run(owner_t *o, run_t *r)
+{
+    if (r->prev != NULL)
+	r->prev->next = r->next;
+    else
+	o->runs[r->span.sizeclass] = r->next;
+    if (r->next != NULL)
+	r->next->prev = r->prev;
+}
+
+/*
+ * make_runs - take a chunk from the heap and make a run of each of its
+ *     pages; returns them in a list, or NULL if the heap is out of memory
+ */
+static run_t *make_runs(void)
+{
+    run_t *r, *list = NULL;
+    char *chunk, *page;
+    int i;
+
+    if ((chunk = (char *)grab(RUN_CHUNK * RUN_SIZE + RUN_SIZE)) == NULL)
+	return NULL;
+    /* Start past the block's first byte, so its page stays the heap's */
+    page = pm_base + ((chunk - pm_base + RUN_SIZE) & ~(RUN_SIZE - 1));
+    for (i = 0; i < RUN_CHUNK; i++, page += RUN_SIZE) {
+	if ((r = (run_t *)aligned_alloc(64, sizeof(run_t))) == NULL) {
+	    fprintf(stderr, "make_runs: aligned_alloc failed\n");
+	    exit(1);
+	}
+	memset(r, 0, sizeof(run_t));
+	r->span.start = page;
+	r->span.npages = 1;
+	r->span.kind = SPAN_RUN;
+	pagemap_set(page, RUN_SIZE, &r->span);
+	r->next = list;
+	list = r;
+    }
+    return list;
+}
+
+/*
+ * new_run - give o a run of class cls, adopting an abandoned one if
+ *     there is one; NULL if the heap is out of memory. The heap lock
+ *     is never taken inside the runs lock.
+ */
+static run_t *new_run(owner_t *o, int cls)
+{
+    run_t *r, *list;
+
+    pthread_mutex_lock(&runs_lock);
+    if ((r = abandoned[cls]) != NULL)
+	abandoned[cls] = r->next;
+    else {
+	if (empty_runs == NULL) {
+	    pthread_mutex_unlock(&runs_lock);
+	    list = make_runs();
+	    pthread_mutex_lock(&runs_lock);
+	    while ((r = list) != NULL) {
+		list = r->next;
+		r->all = all_runs;
+		all_runs = r;
+		r->next = empty_runs;
+		empty_runs = r;
+		pages++;
+	    }
+	}
+	if ((r = empty_runs) != NULL) {
+	    empty_runs = r->next;
+	    r->span.sizeclass = cls;
+	    r->local = NULL;
+	    r->bump = r->span.start;
+	}
+    }
+    pthread_mutex_unlock(&runs_lock);
+    if (r == NULL)
+	return NULL;
+    __atomic_store_n(&r->span.owner, o, __ATOMIC_RELAXED);
+    push(o, r);
+    return r;
+}
+
+/* retire - put r, which its owner has taken off its list, in pool */
+static void retire(run_t *r, run_t **pool)
+{
+    __atomic_store_n(&r->span.owner, NULL, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&runs_lock);
+    r->next = *pool;
+    *pool = r;
+    pthread_mutex_unlock(&runs_lock);
+}
+
+/*
+ * thread_exit - pthread key destructor: abandon an exiting thread's
+ *     runs, or pool them if they are empty, and forget its owner
+ */
+static void thread_exit(void *arg)
+{
+    owner_t *o = (owner_t *)arg, **pp;
+    run_t *r;
+    int cls;
+
+    /* An owner of before the last runs_init is freed already */
+    if (my_generation != generation || me != o)
+	return;
+    for (cls = 0; cls < CACHE_CLASSES; cls++) {
+	while ((r = o->runs[cls]) != NULL) {
+	    o->runs[cls] = r->next;
+	    collect(r);
+	    retire(r, r->used == 0 ? &empty_runs : &abandoned[cls]);
+	}
+    }
+    pthread_mutex_lock(&runs_lock);
+    for (pp = &owners; *pp != NULL; pp = &(*pp)->next)
+	if (*pp == o) {
+	    *pp = o->next;
+	    break;
+	}
+    pthread_mutex_unlock(&runs_lock);
+    free(o);
+    me = NULL;
+}
+
+static void make_key(void)
+{
+    pthread_key_create(&runs_key, thread_exit);
+}
+
+/*
+ * runs_init - forget every run and serve small blocks from runs or not;
+ *     chunks for runs come from grab_fn. Must be called while no other
+ *     thread uses the runs, before the heap is initialized.
+ */
+void runs_init(int want, void *(*grab_fn)(uint32_t size))
+{
+    run_t *r;
+    owner_t *o;
+
+    pthread_once(&key_once, make_key);
+    pthread_mutex_lock(&runs_lock);
+    while ((r = all_runs) != NULL) {
+	all_runs = r->all;
+	free(r);
+    }
+    while ((o = owners) != NULL) {
+	owners = o->next;
+	free(o);
+    }
+    empty_runs = NULL;
+    memset(abandoned, 0, sizeof(abandoned));
+    pages = 0;
+    generation++;
+    pthread_mutex_unlock(&runs_lock);
+    grab = grab_fn;
+    on = want;
+}
+
+/* runs_on - are small blocks served from runs? */
+int runs_on(void)
+{
+    return on;
+}
+
+/*
+ * runs_malloc - a block of size 1..RUN_MAX bytes from one of the
+ *     caller's runs; NULL if the heap has no memory for a new run
+ */
+void *runs_malloc(uint32_t size)
+{
+    int cls = cache_class(size);
+    owner_t *o;
+    run_t *r;
+    void *p;
+
+    if ((o = my_owner()) == NULL)
+	return NULL;
+    for (r = o->runs[cls]; r != NULL; r = r->next)
+	if ((p = take(r)) != NULL) {
+	    if (r != o->runs[cls]) {
+		unlink_run(o, r);
+		push(o, r);
+	    }
+	    return p;
+	}
+    if ((r = new_run(o, cls)) == NULL)
+	return NULL;
+    return take(r);
+}
+
+/*
+ * runs_free - free p if it is a block in a run; returns 0 if it isn't
+ */
+int runs_free(void *p)
+{
+    span_t *s = pagemap_lookup(p);
+    owner_t *o = current();
+    run_t *r;
+    void *head;
+
+    if (s == NULL || s->kind != SPAN_RUN)
+	return 0;
+    r = (run_t *)s;
+    if (o != NULL && __atomic_load_n(&r->span.owner, __ATOMIC_RELAXED) == o) {
+	*(void **)p = r->local;
+	r->local = p;
+	if (--r->used == 0 && r != o->runs[r->span.sizeclass]) {
+	    unlink_run(o, r);
+	    retire(r, &empty_runs);
+	}
+	return 1;
+    }
+    head = __atomic_load_n(&r->remote, __ATOMIC_RELAXED);
+    do
+	*(void **)p = head;
+    while (!__atomic_compare_exchange_n(&r->remote, &head, p, 1,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return 1;
+}
+
+/*
+ * runs_size - the payload bytes of p if it is a block in a run, else 0
+ */
+uint32_t runs_size(void *p)
+{
+    span_t *s = pagemap_lookup(p);
+
+    if (s == NULL || s->kind != SPAN_RUN)
+	return 0;
+    return cache_class_size(s->sizeclass);
+}
+
+/* runs_pages - pages taken from the heap for runs since runs_init */
+size_t runs_pages(void)
+{
+    return pages;
+}
@@ -0,0 +1,25 @@
+/*
+ * runs.h - runs of small blocks owned by one thread, on pages no other
+ *          thread's blocks share, so threads writing their own blocks
+ *          never write the same cache line
+ */
+#ifndef __RUNS_H_
+#define __RUNS_H_
+
+#include <stdint.h>
+
+#include "cache.h"
+#include "pagemap.h"
+
+#define RUN_SIZE  (1 << PM_PAGE_SHIFT) /* a run is one page ... */
+#define RUN_CHUNK 16      /* ... of a chunk of this many taken from the heap */
+#define RUN_MAX   CACHE_MAX /* largest payload served from runs */
+
+void runs_init(int on, void *(*grab)(uint32_t size));
+int runs_on(void);
+void *runs_malloc(uint32_t size);
+int runs_free(void *p);
+uint32_t runs_size(void *p);
+size_t runs_pages(void);
+
+#endif /* __RUNS_H_ */
@@ -0,0 +1,158 @@
+/*
+ * stream.c - double-buffered trace reader.
+ *
+ * A reader thread parses the trace file into one of two chunk buffers
+ * while the replay consumes the other. The buffers are handed back and
+ * forth under a mutex, so the memory used is two chunks no matter how
+ * long the trace is.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "stream.h"
+
+#define MAXLINE 1024 /* max string size */
+
+typedef struct {
+    traceop_t ops[STREAM_CHUNK]; /* the requests in this chunk */
+    int n;                       /* number of valid requests */
+    int full;                    /* set by the reader, cleared by the replay */
+    long first_op;               /* trace op number of ops[0] */
+} chunk_t;
+
+struct stream {
+    FILE *tracefile;
+    char path[MAXLINE];
+    chunk_t chunks[2];
+    int next;                    /* chunk the replay will consume next */
+    int busy;                    /* chunk the replay is consuming, or -1 */
+    int stop;                    /* tells the reader to give up early */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t reader;
+};
+
+/*
+ * reader - fill the two chunks in turn until the file is exhausted.
+ *     A chunk with n < STREAM_CHUNK marks the end of the trace.
+ */
+static void *reader(void *arg)
+{
+    stream_t *s = (stream_t *)arg;
+    long op_num = 0;
+    int k = 0;
+    int n, stop;
+    chunk_t *c;
+
+    do {
+	c = &s->chunks[k];
+	pthread_mutex_lock(&s->lock);
+	while (c->full && !s->stop)
+	    pthread_cond_wait(&s->cond, &s->lock);
+	stop = s->stop;
+	pthread_mutex_unlock(&s->lock);
+	if (stop)
+	    break;
+
+	/* The replay doesn't touch a chunk until it is marked full */
+	for (n = 0; n < STREAM_CHUNK; n++)
+	    if (!trace_read_op(s->tracefile, s->path, &c->ops[n]))
+		break;
+	c->n = n;
+	c->first_op = op_num;
+	op_num += n;
+
+	pthread_mutex_lock(&s->lock);
+	c->full = 1;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	k = 1 - k;
+    } while (n == STREAM_CHUNK);
+
+    return NULL;
+}
+
+/*
+ * stream_open - open a trace file, fill in its header, and start the
+ *     reader thread. The ops, blocks and block_sizes fields of header
+ *     are left NULL.
+ */
+stream_t *stream_open(char *tracedir, char *filename, trace_t *header)
+{
+    stream_t *s;
+
+    if ((s = (stream_t *)calloc(1, sizeof(stream_t))) == NULL) {
+	fprintf(stderr, "stream_open: calloc error\n");
+	exit(1);
+    }
+    s->tracefile = trace_open(tracedir, filename, s->path);
+    trace_read_header(s->tracefile, header);
+    header->num_threads = 1;
+    header->ops = NULL;
+    header->blocks = NULL;
+    header->block_sizes = NULL;
+
+    s->busy = -1;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    if (pthread_create(&s->reader, NULL, reader, s) != 0) {
+	fprintf(stderr, "stream_open: pthread_create error\n");
+	exit(1);
+    }
+    return s;
+}
+
+/*
+ * stream_next - release the chunk returned by the previous call and
+ *     return the next one, setting *n to its length and *first_op to
+ *     the trace op number of its first op. Returns NULL at the end.
+ */
+traceop_t *stream_next(stream_t *s, int *n, long *first_op)
+{
+    chunk_t *c;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->busy >= 0) {
+	c = &s->chunks[s->busy];
+	s->busy = -1;
+	c->full = 0;
+	pthread_cond_broadcast(&s->cond);
+
+	/* A short chunk was the last one */
+	if (c->n < STREAM_CHUNK) {
+	    pthread_mutex_unlock(&s->lock);
+	    return NULL;
+	}
+    }
+
+    c = &s->chunks[s->next];
+    while (!c->full)
+	pthread_cond_wait(&s->cond, &s->lock);
+    s->busy = s->next;
+    s->next = 1 - s->next;
+    pthread_mutex_unlock(&s->lock);
+
+    if (c->n == 0)
+	return NULL;
+    *n = c->n;
+    *first_op = c->first_op;
+    return c->ops;
+}
+
+/*
+ * stream_close - stop the reader and free the stream
+ */
+void stream_close(stream_t *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->reader, NULL);
+
+    fclose(s->tracefile);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    free(s);
+}
@@ -0,0 +1,18 @@
+/*
+ * stream.h - read a trace file in chunks on a separate thread, so a
+ *            replay never holds more than two chunks of ops in memory
+ */
+#ifndef __STREAM_H_
+#define __STREAM_H_
+
+#include "trace.h"
+
+#define STREAM_CHUNK (1 << 16) /* ops per chunk */
+
+typedef struct stream stream_t;
+
+stream_t *stream_open(char *tracedir, char *filename, trace_t *header);
+traceop_t *stream_next(stream_t *stream, int *n, long *first_op);
+void stream_close(stream_t *stream);
+
+#endif /* __STREAM_H_ */
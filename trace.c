@@ -0,0 +1,289 @@
+/*
+ * trace.c - read malloc lab trace files.
+ *
+ * A trace file has a four line header (suggested heap size, number of
+ * block ids, number of ops, weight) followed by one request per line:
+ *
+ *      a <id> <bytes>    allocate a block
+ *      r <id> <bytes>    reallocate block id
+ *      f <id>            free block id
+ *
+ * Extended traces captured from real programs may append, in order,
+ * the id of the thread that made the request, its time in nsecs since
+ * the start of the trace, and for a and r the required alignment and
+ * OP_xxx flags:
+ *
+ *      a <id> <bytes> <tid> <nsecs> [<align> [<flags>]]
+ *      r <id> <bytes> <tid> <nsecs> [<align> [<flags>]]
+ *      f <id> <tid> <nsecs>
+ *
+ * Missing fields default to thread 0, time 0, default alignment and
+ * no flags, so plain and extended requests can be mixed freely. Thread
+ * ids must not be negative and alignments must be powers of two; the
+ * thread ids of a trace read into memory are renumbered densely from 0
+ * in increasing order, so that sparse OS thread ids replay on as many
+ * threads as the trace has.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024 /* max string size */
+
+extern int verbose; /* -v option in mdriver.c */
+
+/*
+ * trace_error - Report a Unix-style error while reading a trace
+ */
+static void trace_error(const char *msg)
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/*
+ * trace_open - open tracedir/filename for reading, leaving the full
+ *     path in path (at least MAXLINE bytes)
+ */
+FILE *trace_open(char *tracedir, char *filename, char *path)
+{
+    FILE *tracefile;
+    char msg[MAXLINE];
+
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if ((tracefile = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in read_trace", path);
+	trace_error(msg);
+    }
+    return tracefile;
+}
+
+/*
+ * trace_read_header - read the four header lines of a trace file
+ */
+void trace_read_header(FILE *tracefile, trace_t *trace)
+{
+    if (1 != fscanf(tracefile, "%d", &(trace->sugg_heapsize)) ) {
+      trace_error("fscanf of heapsize\n");
+    }
+    if (1 != fscanf(tracefile, "%ld", &(trace->num_ids)) ) {
+      trace_error("fscanf of num_ids");
+    }
+    if (1 != fscanf(tracefile, "%ld", &(trace->num_ops)) ) {
+      trace_error("fscanf of num_ops");
+    }
+    if (1 != fscanf(tracefile, "%d", &(trace->weight)) ) {
+      trace_error("fscan of weight");
+    }
+}
+
+/*
+ * trace_read_op - read the next request line into op. Returns 1 if a
+ *     request was read and 0 at the end of the file.
+ */
+int trace_read_op(FILE *tracefile, char *path, traceop_t *op)
+{
+    char line[MAXLINE];
+    char *p;
+
+    /* Skip blank lines, including the end of the last header line */
+    do {
+	if (fgets(line, MAXLINE, tracefile) == NULL)
+	    return 0;
+	for (p = line; *p == ' ' || *p == '\t'; p++)
+	    ;
+    } while (*p == '\n' || *p == '\0');
+
+    op->size = 0;
+    op->tid = 0;
+    op->ts = 0;
+    op->align = 0;
+    op->flags = 0;
+
+    switch(*p) {
+    case 'a':
+      if ( 2 > sscanf(p + 1, "%d %d %d %lld %d %d", &op->index, &op->size, 
+		      &op->tid, &op->ts, &op->align, &op->flags) ) {
+	trace_error("fscanf of allocation");
+      } 
+	op->type = ALLOC;
+	break;
+    case 'r':
+      if ( 2 > sscanf(p + 1, "%d %d %d %lld %d %d", &op->index, &op->size, 
+		      &op->tid, &op->ts, &op->align, &op->flags) ) {
+	trace_error("fscanf of relloc");
+      } 
+	op->type = REALLOC;
+	break;
+    case 'f':
+      if ( 1 > sscanf(p + 1, "%d %d %lld", &op->index, &op->tid, &op->ts) ) {
+	trace_error("fscanf of free\n");
+      }
+	op->type = FREE;
+	break;
+    default:
+	printf("Bogus type character (%c) in tracefile %s\n", 
+	       *p, path);
+	exit(1);
+    }
+    if (op->index < 0) {
+	printf("Bad block id (%d) in tracefile %s\n", op->index, path);
+	exit(1);
+    }
+    if (op->tid < 0) {
+	printf("Bad thread id (%d) in tracefile %s\n", op->tid, path);
+	exit(1);
+    }
+    if (op->align < 0 || (op->align & (op->align - 1)) != 0) {
+	printf("Bad alignment (%d) in tracefile %s\n", op->align, path);
+	exit(1);
+    }
+    return 1;
+}
+
+/* cmp_int - qsort comparison for ints in increasing order */
+static int cmp_int(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * renumber_threads - renumber the thread ids of trace densely from 0,
+ *     keeping their order, and set num_threads to how many there are
+ */
+static void renumber_threads(trace_t *trace)
+{
+    int *tids, *t;
+    long i, n = 0;
+
+    if (trace->num_ops == 0)
+	return;
+    if ((tids = (int *)malloc(trace->num_ops * sizeof(int))) == NULL)
+	trace_error("malloc failed in renumber_threads");
+    for (i = 0; i < trace->num_ops; i++)
+	tids[i] = trace->ops[i].tid;
+    qsort(tids, trace->num_ops, sizeof(int), cmp_int);
+    for (i = 0; i < trace->num_ops; i++)
+	if (n == 0 || tids[i] != tids[n - 1])
+	    tids[n++] = tids[i];
+    for (i = 0; i < trace->num_ops; i++) {
+	t = (int *)bsearch(&trace->ops[i].tid, tids, n, sizeof(int), cmp_int);
+	trace->ops[i].tid = t - tids;
+    }
+    trace->num_threads = n;
+    free(tids);
+}
+
+/*
+ * read_trace - read a trace file and store it in memory
+ */
+trace_t *read_trace(char *tracedir, char *filename)
+{
+    FILE *tracefile;
+    trace_t *trace;
+    char path[MAXLINE];
+    int max_index = 0;
+    long op_index;
+    traceop_t op;
+
+    if (verbose > 1)
+	printf("Reading tracefile: %s\n", filename);
+
+    /* Allocate the trace record */
+    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+	trace_error("malloc 1 failed in read_trance");
+	
+    /* Read the trace file header */
+    tracefile = trace_open(tracedir, filename, path);
+    trace_read_header(tracefile, trace);
+    
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops = 
+	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	trace_error("malloc 2 failed in read_trace");
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	trace_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	trace_error("malloc 4 failed in read_trace");
+    
+    /* read every request line in the trace file */
+    op_index = 0;
+    trace->num_threads = 1;
+    while (trace_read_op(tracefile, path, &op)) {
+	assert(op_index < trace->num_ops);
+	trace->ops[op_index] = op;
+	if (op.type != FREE)
+	    max_index = (op.index > max_index) ? op.index : max_index;
+	op_index++;
+    }
+    fclose(tracefile);
+    assert(max_index == trace->num_ids - 1);
+    assert(trace->num_ops == op_index);
+    renumber_threads(trace);
+    
+    return trace;
+}
+
+/*
+ * write_trace - write trace in trace file format. The extended fields
+ *     are written only if some request uses them.
+ */
+void write_trace(FILE *tracefile, trace_t *trace)
+{
+    traceop_t *op;
+    long i;
+    int extended = 0;
+
+    for (i = 0; i < trace->num_ops; i++) {
+	op = &trace->ops[i];
+	if (op->tid || op->ts || op->align || op->flags)
+	    extended = 1;
+    }
+
+    fprintf(tracefile, "%d\n%ld\n%ld\n%d\n", trace->sugg_heapsize, 
+	    trace->num_ids, trace->num_ops, trace->weight);
+    for (i = 0; i < trace->num_ops; i++) {
+	op = &trace->ops[i];
+	switch (op->type) {
+	case ALLOC:
+	case REALLOC:
+	    fprintf(tracefile, "%c %d %d", op->type == ALLOC ? 'a' : 'r', 
+		    op->index, op->size);
+	    if (extended)
+		fprintf(tracefile, " %d %lld %d %d", op->tid, op->ts, 
+			op->align, op->flags);
+	    break;
+	case FREE:
+	    fprintf(tracefile, "f %d", op->index);
+	    if (extended)
+		fprintf(tracefile, " %d %lld", op->tid, op->ts);
+	    break;
+	}
+	fprintf(tracefile, "\n");
+    }
+}
+
+/*
+ * free_trace - Free the trace record and the three arrays it points
+ *              to, all of which were allocated in read_trace().
+ */
+void free_trace(trace_t *trace)
+{
+    free(trace->ops);         /* free the three arrays... */
+    free(trace->blocks);      
+    free(trace->block_sizes);
+    free(trace);              /* and the trace record itself... */
+}
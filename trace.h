@@ -0,0 +1,47 @@
+/*
+ * trace.h - trace file records and the routines that read them
+ */
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* Flags of an extended alloc/realloc request */
+#define OP_ZERO 0x1 /* payload must be zeroed, as by calloc */
+
+/* Characterizes a single trace operation (allocator request) */
+typedef enum {ALLOC, FREE, REALLOC} RequestType;
+typedef struct {
+    RequestType type; /* type of request */
+    int index;                        /* index for free() to use later */
+    int size;                         /* byte size of alloc/realloc request */
+    int tid;                          /* thread that made the request */
+    long long ts;                     /* nsecs since the start of the trace */
+    int align;                        /* required alignment (0 = default) */
+    int flags;                        /* OP_xxx flags */
+} traceop_t;
+
+/* Holds the information for one trace file*/
+typedef struct {
+    int sugg_heapsize;   /* suggested heap size (unused) */
+    long num_ids;        /* number of alloc/realloc ids */
+    long num_ops;        /* number of distinct requests */
+    int weight;          /* weight for this trace (unused) */
+    int num_threads;     /* number of thread ids, which run from 0 */
+    traceop_t *ops;      /* array of requests */
+    char **blocks;       /* array of ptrs returned by malloc/realloc... */
+    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+} trace_t;
+
+/* Read a whole trace file into memory, write one out, and free it */
+trace_t *read_trace(char *tracedir, char *filename);
+void write_trace(FILE *tracefile, trace_t *trace);
+void free_trace(trace_t *trace);
+
+/* Lower-level routines shared by read_trace and the streaming reader */
+FILE *trace_open(char *tracedir, char *filename, char *path);
+void trace_read_header(FILE *tracefile, trace_t *trace);
+int trace_read_op(FILE *tracefile, char *path, traceop_t *op);
+
+#endif /* __TRACE_H_ */
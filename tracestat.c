@@ -0,0 +1,285 @@
+/*
+ * tracestat.c - Characterize the workload in a trace before
+ *     benchmarking on it.
+ *
+ * For each trace, prints the distribution of request sizes and of
+ * block lifetimes (measured in ops from allocation to free), the peak
+ * live bytes and blocks, how reallocs change block sizes, and whether
+ * blocks tend to be freed in LIFO or FIFO order or neither.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define NBUCKETS  32 /* log2 buckets: [2^k, 2^(k+1)) */
+#define BARWIDTH  50 /* width of the longest histogram bar */
+
+int verbose = 0;        /* read_trace is quiet unless this is set */
+
+/* The statistics gathered for one trace */
+typedef struct {
+    long sizes[NBUCKETS];     /* alloc/realloc request sizes */
+    long lifetimes[NBUCKETS]; /* ops from allocation to free */
+    long never_freed;         /* blocks still live at the end */
+    long num_allocs, num_frees, num_reallocs;
+    double total_bytes;       /* bytes requested by allocs */
+    long peak_bytes;          /* most bytes live at once */
+    long peak_blocks;         /* most blocks live at once */
+    long grows, shrinks, sames;   /* reallocs by direction */
+    long growth[5];           /* new/old: <1, <1.5, <2, <4, >=4 */
+    long from_empty;          /* reallocs of a 0-byte block, with no ratio */
+    int max_chain;            /* most reallocs of a single block */
+    long lifo, fifo, other;   /* frees of the newest, oldest, other block */
+} tracestat_t;
+
+/* Function prototypes */
+static void characterize(trace_t *trace, tracestat_t *st);
+static void print_stats(char *name, trace_t *trace, tracestat_t *st);
+static void print_histogram(const char *title, const char *unit, long *h);
+static int log2_bucket(long n);
+static void usage(void);
+static void unix_error(const char *msg);
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv)
+{
+    int i, c;
+    trace_t *trace;
+    tracestat_t st;
+
+    while ((c = getopt(argc, argv, "h")) != EOF) {
+        switch (c) {
+        case 'h': /* Print this message */
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (optind == argc) {
+        usage();
+        exit(1);
+    }
+
+    for (i = optind; i < argc; i++) {
+        trace = read_trace("", argv[i]);
+        characterize(trace, &st);
+        print_stats(argv[i], trace, &st);
+        free_trace(trace);
+    }
+    exit(0);
+}
+
+/*
+ * characterize - replay the trace on paper and gather its statistics.
+ *     Live blocks are kept on a list in order of allocation, so each
+ *     free can be classified as LIFO (newest live block), FIFO (oldest)
+ *     or neither.
+ */
+static void characterize(trace_t *trace, tracestat_t *st)
+{
+    long i, *born;
+    int id;
+    int *chain, *prev, *next;
+    int oldest = -1, newest = -1;
+    long live_bytes = 0, live_blocks = 0;
+    double ratio;
+    traceop_t *op;
+
+    memset(st, 0, sizeof(*st));
+    born = (long *)malloc(trace->num_ids * sizeof(long));
+    chain = (int *)calloc(trace->num_ids, sizeof(int));
+    prev = (int *)malloc(trace->num_ids * sizeof(int));
+    next = (int *)malloc(trace->num_ids * sizeof(int));
+    if (!born || !chain || !prev || !next)
+        unix_error("malloc failed in characterize");
+    for (i = 0; i < trace->num_ids; i++)
+        born[i] = -1;
+
+    for (i = 0; i < trace->num_ops; i++) {
+        op = &trace->ops[i];
+        id = op->index;
+        switch (op->type) {
+        case ALLOC:
+            st->num_allocs++;
+            st->total_bytes += op->size;
+            st->sizes[log2_bucket(op->size)]++;
+            trace->block_sizes[id] = op->size;
+            born[id] = i;
+            live_bytes += op->size;
+            live_blocks++;
+
+            /* Append to the live list */
+            prev[id] = newest;
+            next[id] = -1;
+            if (newest >= 0)
+                next[newest] = id;
+            else
+                oldest = id;
+            newest = id;
+            break;
+
+        case REALLOC:
+            st->num_reallocs++;
+            st->sizes[log2_bucket(op->size)]++;
+            if (++chain[id] > st->max_chain)
+                st->max_chain = chain[id];
+            if (op->size > (int)trace->block_sizes[id])
+                st->grows++;
+            else if (op->size < (int)trace->block_sizes[id])
+                st->shrinks++;
+            else
+                st->sames++;
+            if (trace->block_sizes[id] == 0)
+                st->from_empty++;
+            else {
+                ratio = (double)op->size / trace->block_sizes[id];
+                st->growth[ratio < 1 ? 0 : ratio < 1.5 ? 1 : ratio < 2 ? 2 :
+                           ratio < 4 ? 3 : 4]++;
+            }
+            live_bytes += op->size - (long)trace->block_sizes[id];
+            trace->block_sizes[id] = op->size;
+            break;
+
+        case FREE:
+            st->num_frees++;
+            st->lifetimes[log2_bucket(i - born[id])]++;
+            born[id] = -1;
+            live_bytes -= trace->block_sizes[id];
+            live_blocks--;
+
+            if (id == newest)
+                st->lifo++;
+            else if (id == oldest)
+                st->fifo++;
+            else
+                st->other++;
+
+            /* Unlink from the live list */
+            if (prev[id] >= 0)
+                next[prev[id]] = next[id];
+            else
+                oldest = next[id];
+            if (next[id] >= 0)
+                prev[next[id]] = prev[id];
+            else
+                newest = prev[id];
+            break;
+        }
+
+        if (live_bytes > st->peak_bytes)
+            st->peak_bytes = live_bytes;
+        if (live_blocks > st->peak_blocks)
+            st->peak_blocks = live_blocks;
+    }
+
+    for (i = 0; i < trace->num_ids; i++)
+        if (born[i] >= 0)
+            st->never_freed++;
+
+    free(born);
+    free(chain);
+    free(prev);
+    free(next);
+}
+
+/*
+ * print_stats - print the statistics for one trace
+ */
+static void print_stats(char *name, trace_t *trace, tracestat_t *st)
+{
+    long frees = st->lifo + st->fifo + st->other;
+
+    printf("Trace %s: %ld ops, %ld ids, %d threads\n", name, trace->num_ops,
+           trace->num_ids, trace->num_threads);
+    printf("  allocs %ld, reallocs %ld, frees %ld, never freed %ld\n",
+           st->num_allocs, st->num_reallocs, st->num_frees, st->never_freed);
+    printf("  mean alloc size %.1f bytes\n",
+           st->num_allocs ? st->total_bytes / st->num_allocs : 0);
+    printf("  peak live %ld bytes in %ld blocks\n",
+           st->peak_bytes, st->peak_blocks);
+    if (st->num_reallocs) {
+        printf("  reallocs: %ld grow, %ld shrink, %ld same size; "
+               "at most %d of one block\n",
+               st->grows, st->shrinks, st->sames, st->max_chain);
+        printf("  realloc new/old size: <1 %ld, 1-1.5 %ld, 1.5-2 %ld, "
+               "2-4 %ld, >=4 %ld\n", st->growth[0], st->growth[1],
+               st->growth[2], st->growth[3], st->growth[4]);
+        if (st->from_empty)
+            printf("  reallocs of 0-byte blocks: %ld\n", st->from_empty);
+    }
+    if (frees)
+        printf("  free order: %.1f%% LIFO, %.1f%% FIFO, %.1f%% other\n",
+               100.0 * st->lifo / frees, 100.0 * st->fifo / frees,
+               100.0 * st->other / frees);
+    print_histogram("request sizes", "bytes", st->sizes);
+    print_histogram("lifetimes", "ops", st->lifetimes);
+    printf("\n");
+}
+
+/*
+ * print_histogram - print the nonempty range of log2 histogram h
+ */
+static void print_histogram(const char *title, const char *unit, long *h)
+{
+    int k, lo = NBUCKETS, hi = -1;
+    long max = 0;
+
+    for (k = 0; k < NBUCKETS; k++) {
+        if (h[k] == 0)
+            continue;
+        lo = (k < lo) ? k : lo;
+        hi = k;
+        max = (h[k] > max) ? h[k] : max;
+    }
+    if (hi < 0)
+        return;
+
+    printf("  %s (%s):\n", title, unit);
+    for (k = lo; k <= hi; k++)
+        printf("  %10lu-%-10lu %8ld %.*s\n", 1UL << k, (2UL << k) - 1, h[k],
+               (int)((h[k] * BARWIDTH + max - 1) / max),
+               "##################################################");
+}
+
+/*
+ * log2_bucket - bucket k holds [2^k, 2^(k+1)); 0 goes in bucket 0
+ */
+static int log2_bucket(long n)
+{
+    int k = 0;
+
+    while (n > 1 && k < NBUCKETS - 1) {
+        n >>= 1;
+        k++;
+    }
+    return k;
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(const char *msg)
+{
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracestat [-h] <trace>...\n");
+    fprintf(stderr, "Prints size, lifetime, peak, realloc and free-order "
+            "statistics for each trace.\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+}
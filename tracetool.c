@@ -0,0 +1,266 @@
+/*
+ * tracetool.c - Build smaller or larger traces out of existing ones.
+ *
+ * The input traces are first spliced together, one after another,
+ * with the block ids of each renumbered past those of the ones before
+ * it and its timestamps shifted to follow theirs. The result can then
+ * be sampled, keeping every request on a random subset of the block
+ * ids so that each kept block is still allocated before it is freed;
+ * scaled, multiplying every request size; and time-compressed, dividing
+ * the gaps between the timestamps of a range of requests. The output
+ * always has its ids renumbered densely from 0 and a header whose
+ * num_ids and num_ops match its requests, so mdriver can replay it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "trace.h"
+
+int verbose = 0;        /* read_trace is quiet unless this is set */
+
+/* Function prototypes */
+static trace_t *splice_traces(trace_t **traces, int n);
+static void sample_trace(trace_t *trace, double frac, unsigned seed);
+static void scale_trace(trace_t *trace, double factor);
+static void compress_trace(trace_t *trace, long from, long to, double factor);
+static void renumber_trace(trace_t *trace);
+static void usage(void);
+static void unix_error(const char *msg);
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv)
+{
+    int i, c;
+    trace_t **traces;
+    trace_t *trace;
+    FILE *out = stdout;
+    double frac = 1.0;          /* fraction of ids to keep (-s) */
+    unsigned seed = 1;          /* seed for choosing ids (-S) */
+    double scale = 1.0;         /* factor for request sizes (-z) */
+    long from = 0, to = 0;      /* ops whose time gaps shrink (-c) */
+    double compress = 1.0;      /* ... and by how much */
+
+    while ((c = getopt(argc, argv, "hs:S:z:c:o:")) != EOF) {
+        switch (c) {
+        case 's': /* Keep a fraction of the block ids */
+            frac = atof(optarg);
+            if (frac <= 0 || frac > 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'S': /* Seed for choosing the ids */
+            seed = (unsigned)atoi(optarg);
+            break;
+        case 'z': /* Scale the request sizes */
+            scale = atof(optarg);
+            if (scale <= 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'c': /* Compress the time between ops from..to */
+            if (sscanf(optarg, "%ld:%ld:%lf", &from, &to, &compress) != 3 ||
+                from < 0 || to < from || compress <= 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'o': /* Write the result here instead of stdout */
+            if ((out = fopen(optarg, "w")) == NULL)
+                unix_error("Could not open output file");
+            break;
+        case 'h': /* Print this message */
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (optind == argc) {
+        usage();
+        exit(1);
+    }
+
+    /* Read the input traces and splice them into one */
+    if ((traces = (trace_t **)malloc((argc - optind) * sizeof(trace_t *))) == NULL)
+        unix_error("malloc failed in main");
+    for (i = optind; i < argc; i++)
+        traces[i - optind] = read_trace("", argv[i]);
+    trace = splice_traces(traces, argc - optind);
+
+    /* Transform it */
+    if (frac < 1.0)
+        sample_trace(trace, frac, seed);
+    if (scale != 1.0)
+        scale_trace(trace, scale);
+    if (compress != 1.0)
+        compress_trace(trace, from, to, compress);
+    renumber_trace(trace);
+
+    write_trace(out, trace);
+    if (out != stdout)
+        fclose(out);
+    for (i = 0; i < argc - optind; i++)
+        free_trace(traces[i]);
+    free(traces);
+    free_trace(trace);
+    exit(0);
+}
+
+/*
+ * splice_traces - concatenate n traces into a new one. The ids of each
+ *     trace are moved past those of the traces before it, and its
+ *     timestamps past their last timestamp.
+ */
+static trace_t *splice_traces(trace_t **traces, int n)
+{
+    trace_t *trace;
+    int i;
+    long j, k;
+    int id_base = 0;
+    long long ts_base = 0, last_ts = 0;
+
+    if ((trace = (trace_t *)calloc(1, sizeof(trace_t))) == NULL)
+        unix_error("calloc failed in splice_traces");
+    trace->weight = 1;
+    for (i = 0; i < n; i++) {
+        trace->num_ops += traces[i]->num_ops;
+        trace->num_ids += traces[i]->num_ids;
+        if (traces[i]->sugg_heapsize > trace->sugg_heapsize)
+            trace->sugg_heapsize = traces[i]->sugg_heapsize;
+    }
+    if ((trace->ops = (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+        unix_error("malloc failed in splice_traces");
+
+    for (i = 0, k = 0; i < n; i++) {
+        for (j = 0; j < traces[i]->num_ops; j++, k++) {
+            trace->ops[k] = traces[i]->ops[j];
+            trace->ops[k].index += id_base;
+            trace->ops[k].ts += ts_base;
+            last_ts = trace->ops[k].ts;
+        }
+        id_base += traces[i]->num_ids;
+        ts_base = last_ts;
+    }
+    return trace;
+}
+
+/*
+ * sample_trace - keep only the requests on about frac of the block ids.
+ *     Whether an id is kept depends only on the id and the seed, so all
+ *     of a block's requests are kept or dropped together.
+ */
+static void sample_trace(trace_t *trace, double frac, unsigned seed)
+{
+    long i, k;
+    uint32_t h;
+    uint32_t cutoff = (uint32_t)(frac * 4294967295.0);
+
+    for (i = 0, k = 0; i < trace->num_ops; i++) {
+        h = ((uint32_t)trace->ops[i].index ^ seed) * 2654435761u;
+        h ^= h >> 16;
+        h *= 2246822519u;
+        h ^= h >> 13;
+        if (h <= cutoff)
+            trace->ops[k++] = trace->ops[i];
+    }
+    trace->num_ops = k;
+}
+
+/*
+ * scale_trace - multiply every request size by factor, keeping each
+ *     request at least one byte
+ */
+static void scale_trace(trace_t *trace, double factor)
+{
+    long i;
+    double size;
+
+    for (i = 0; i < trace->num_ops; i++) {
+        if (trace->ops[i].type == FREE)
+            continue;
+        size = trace->ops[i].size * factor + 0.5;
+        if (size < 1)
+            size = 1;
+        if (size > INT32_MAX)
+            size = INT32_MAX;
+        trace->ops[i].size = (int)size;
+    }
+}
+
+/*
+ * compress_trace - divide the time between each of ops from..to-1 and
+ *     the op before it by factor. Later ops move up by the time saved.
+ */
+static void compress_trace(trace_t *trace, long from, long to, double factor)
+{
+    long i;
+    long long prev_old = 0, prev_new = 0, gap;
+
+    for (i = 0; i < trace->num_ops; i++) {
+        gap = trace->ops[i].ts - prev_old;
+        prev_old = trace->ops[i].ts;
+        if (i >= from && i < to)
+            gap = (long long)(gap / factor);
+        trace->ops[i].ts = prev_new + gap;
+        prev_new = trace->ops[i].ts;
+    }
+}
+
+/*
+ * renumber_trace - number the block ids densely from 0 in order of
+ *     first use, and set num_ids to match
+ */
+static void renumber_trace(trace_t *trace)
+{
+    long i;
+    int *newid;
+    int next = 0;
+
+    if ((newid = (int *)malloc(trace->num_ids * sizeof(int))) == NULL)
+        unix_error("malloc failed in renumber_trace");
+    for (i = 0; i < trace->num_ids; i++)
+        newid[i] = -1;
+    for (i = 0; i < trace->num_ops; i++) {
+        if (newid[trace->ops[i].index] < 0)
+            newid[trace->ops[i].index] = next++;
+        trace->ops[i].index = newid[trace->ops[i].index];
+    }
+    trace->num_ids = next;
+    free(newid);
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(const char *msg)
+{
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracetool [-h] [-s <frac>] [-S <seed>] [-z <factor>]\n"
+            "                 [-c <from>:<to>:<factor>] [-o <file>] <trace>...\n");
+    fprintf(stderr, "Splices the traces together, then transforms the result.\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-c <from>:<to>:<factor>  Divide the time gaps before ops\n");
+    fprintf(stderr, "\t                         from..to-1 by <factor>.\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-o <file>  Write the new trace to <file> (default stdout).\n");
+    fprintf(stderr, "\t-s <frac>  Keep the requests on about <frac> of the block ids.\n");
+    fprintf(stderr, "\t-S <seed>  Seed for choosing the ids kept by -s.\n");
+    fprintf(stderr, "\t-z <factor> Multiply every request size by <factor>.\n");
+}
@@ -0,0 +1,140 @@
+/*
+ * verify.c - find the first byte of a payload that isn't the fill byte.
+ *
+ * The validity pass checks every byte that realloc should have carried
+ * over, which dominates its running time on traces with large reallocs.
+ * On x86-64 the check compares 32 bytes at a time with AVX2 when the CPU
+ * has it, and 16 at a time with SSE2 otherwise; elsewhere it compares a
+ * word at a time. The choice is made on the first call, so one binary
+ * runs on any x86-64 machine whatever -march it was built with.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "verify.h"
+
+/* scalar_tail - byte-at-a-time check of p[from..n) */
+static long scalar_tail(const unsigned char *p, unsigned char c, 
+			size_t from, size_t n)
+{
+    size_t i;
+
+    for (i = from; i < n; i++)
+	if (p[i] != c)
+	    return (long)i;
+    return -1;
+}
+
+#if !defined(__x86_64__)
+/* verify_word - compare 8 bytes at a time, then find the odd one out */
+static long verify_word(const void *p, int c, size_t n)
+{
+    const unsigned char *s = (const unsigned char *)p;
+    uint64_t pattern = 0x0101010101010101ULL * (unsigned char)c;
+    uint64_t w;
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+	memcpy(&w, s + i, 8);
+	if (w != pattern)
+	    return scalar_tail(s, (unsigned char)c, i, i + 8);
+    }
+    return scalar_tail(s, (unsigned char)c, i, n);
+}
+#endif
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+/* verify_sse2 - compare 16 bytes at a time */
+static long verify_sse2(const void *p, int c, size_t n)
+{
+    const unsigned char *s = (const unsigned char *)p;
+    __m128i pattern = _mm_set1_epi8((char)c);
+    unsigned mask;
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+	mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+	    _mm_loadu_si128((const __m128i *)(s + i)), pattern));
+	if (mask != 0xffff)
+	    return (long)(i + __builtin_ctz(~mask));
+    }
+    return scalar_tail(s, (unsigned char)c, i, n);
+}
+
+/* verify_avx2 - compare 32 bytes at a time, two vectors per iteration */
+__attribute__((target("avx2")))
+static long verify_avx2(const void *p, int c, size_t n)
+{
+    const unsigned char *s = (const unsigned char *)p;
+    __m256i pattern = _mm256_set1_epi8((char)c);
+    __m256i a, b;
+    unsigned mask;
+    size_t i;
+
+    for (i = 0; i + 64 <= n; i += 64) {
+	a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s + i)), 
+			      pattern);
+	b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s + i + 32)), 
+			      pattern);
+	if (_mm256_movemask_epi8(_mm256_and_si256(a, b)) == -1)
+	    continue;
+	mask = _mm256_movemask_epi8(a);
+	if (mask != 0xffffffff)
+	    return (long)(i + __builtin_ctz(~mask));
+	mask = _mm256_movemask_epi8(b);
+	return (long)(i + 32 + __builtin_ctz(~mask));
+    }
+    for (; i + 32 <= n; i += 32) {
+	mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+	    _mm256_loadu_si256((const __m256i *)(s + i)), pattern));
+	if (mask != 0xffffffff)
+	    return (long)(i + __builtin_ctz(~mask));
+    }
+    return scalar_tail(s, (unsigned char)c, i, n);
+}
+#endif
+
+/* The implementation picked on the first call, and its name */
+static long (*verify_fn)(const void *, int, size_t);
+static const char *verify_name;
+
+static void pick_impl(void)
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+	verify_fn = verify_avx2;
+	verify_name = "avx2";
+    }
+    else {
+	verify_fn = verify_sse2;
+	verify_name = "sse2";
+    }
+#else
+    verify_fn = verify_word;
+    verify_name = "word";
+#endif
+}
+
+/*
+ * verify_fill - return the offset of the first of the n bytes at p that
+ *     isn't c, or -1 if they all are
+ */
+long verify_fill(const void *p, int c, size_t n)
+{
+    if (verify_fn == NULL)
+	pick_impl();
+    return verify_fn(p, c, n);
+}
+
+/*
+ * verify_impl - the name of the implementation verify_fill uses
+ */
+const char *verify_impl(void)
+{
+    if (verify_fn == NULL)
+	pick_impl();
+    return verify_name;
+}
@@ -0,0 +1,13 @@
+/*
+ * verify.h - fast check that a payload still holds the byte mdriver
+ *            filled it with
+ */
+#ifndef __VERIFY_H_
+#define __VERIFY_H_
+
+#include <stddef.h>
+
+long verify_fill(const void *p, int c, size_t n);
+const char *verify_impl(void);
+
+#endif /* __VERIFY_H_ */